@@ -0,0 +1,72 @@
+#!/bin/sh
+# Loop heavy scripts run by 90s, dash and bash, seconds each (best of 3).
+# Only what all three parse the same way is used. Usage: bench/loop.sh [90s]
+shell=${1:-./90s}
+dir=$(mktemp -d)
+trap 'rm -rf "$dir"' EXIT INT TERM
+
+cat > "$dir/count" <<'SCRIPT'
+i=0
+while [ $i -lt 200000 ]; do
+    i=$((i + 1))
+done
+SCRIPT
+
+cat > "$dir/branch" <<'SCRIPT'
+i=0
+odd=0
+while [ $i -lt 100000 ]; do
+    if [ $((i % 2)) -eq 1 ]; then
+        odd=$((odd + 1))
+    elif [ $i = 50000 ]; then
+        half=$i
+    else
+        :
+    fi
+    i=$((i + 1))
+done
+SCRIPT
+
+cat > "$dir/call" <<'SCRIPT'
+add() {
+    total=$((total + $1))
+}
+total=0
+for a in 1 2 3 4 5 6 7 8 9 10; do
+    for b in 1 2 3 4 5 6 7 8 9 10; do
+        for c in 1 2 3 4 5 6 7 8 9 10; do
+            for d in 1 2 3 4 5 6 7 8 9 10 11 12 13 14 15 16 17 18 19 20; do
+                add $d
+            done
+        done
+    done
+done
+SCRIPT
+
+# best wall time of three runs in seconds
+best() {
+    b=
+    for run in 1 2 3; do
+        start=$(date +%s%N)
+        "$1" "$2" > /dev/null 2>&1
+        end=$(date +%s%N)
+        t=$((end - start))
+        if [ -z "$b" ] || [ $t -lt $b ]; then
+            b=$t
+        fi
+    done
+    printf '%d.%03d' $((b / 1000000000)) $((b / 1000000 % 1000))
+}
+
+printf '%-8s %8s %8s %8s\n' script 90s dash bash
+for script in count branch call; do
+    row=$(printf '%-8s' $script)
+    for sh in "$shell" dash bash; do
+        if command -v "$sh" > /dev/null 2>&1; then
+            row="$row $(printf '%8s' "$(XDG_CONFIG_HOME=$dir best "$sh" "$dir/$script")")"
+        else
+            row="$row $(printf '%8s' -)"
+        fi
+    done
+    echo "$row"
+done
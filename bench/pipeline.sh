@@ -0,0 +1,50 @@
+#!/bin/sh
+# Throughput of builtins writing into a pipe or a file from the shell.
+# A history of $LINES generated lines is listed $RUNS times per case, the
+# time of a shell running only ':' is taken off. Usage: bench/pipeline.sh [90s]
+shell=${1:-./90s}
+lines=${LINES:-500000}
+runs=${RUNS:-10}
+dir=$(mktemp -d)
+trap 'rm -rf "$dir"' EXIT INT TERM
+
+awk -v n="$lines" 'BEGIN {
+    split("git status commit make ls cd grep vim docker run build src test echo cat", w, " ")
+    for (i = 0; i < n; i++) {
+        line = ""
+        for (k = 0; k <= i % 6; k++) {
+            line = line w[(i * 7 + k * 3) % 15 + 1] " "
+        }
+        print line i
+    }
+}' > "$dir/90s_history"
+size=$(wc -c < "$dir/90s_history")
+
+# seconds for the shell to run a line $runs times
+elapsed() {
+    i=0
+    while [ $i -lt "$runs" ]; do
+        printf '%s\n' "$1"
+        i=$((i + 1))
+    done > "$dir/input"
+    echo exit >> "$dir/input"
+    start=$(date +%s%N)
+    XDG_CONFIG_HOME=$dir "$shell" < "$dir/input" > /dev/null 2>&1
+    end=$(date +%s%N)
+    echo $((end - start))
+}
+
+base=$(elapsed ':')
+printf '%d lines, %d bytes, %d runs\n' "$lines" "$size" "$runs"
+printf '%-40s %10s\n' case MB/s
+for line in \
+        'history | wc -c' \
+        'history -r | wc -c' \
+        "history > $dir/out" \
+        "history -r > $dir/out" \
+        "cat $dir/90s_history | wc -c"; do
+    ns=$(($(elapsed "$line") - base))
+    [ "$ns" -gt 0 ] || ns=1
+    label=$(printf '%s' "$line" | sed "s|$dir/||g")
+    printf '%-40s %10d\n' "$label" $((size * runs * 1000 / ns))
+done
@@ -0,0 +1,82 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <spawn.h>
+#include <unistd.h>
+#include <sys/wait.h>
+
+/*
+ * Process creation latency of fork+exec against posix_spawn, the way
+ * launch() starts programs, while the process holds more and more
+ * touched memory like a shell with a large history and caches does.
+ * Usage: bench/spawn [iterations [megabytes...]]
+ */
+extern char **environ;
+
+static double now(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static void run_fork(char **argv)
+{
+    pid_t pid = fork();
+    if (pid == 0) {
+        execv(argv[0], argv);
+        _exit(127);
+    }
+    if (pid > 0) {
+        waitpid(pid, NULL, 0);
+    }
+}
+
+static void run_spawn(char **argv)
+{
+    pid_t pid;
+    if (posix_spawn(&pid, argv[0], NULL, NULL, argv, environ) == 0) {
+        waitpid(pid, NULL, 0);
+    }
+}
+
+// microseconds per launch
+static double measure(void (*run)(char **), char **argv, int iterations)
+{
+    run(argv); // warm the page cache for the program
+    double start = now();
+    for (int i = 0; i < iterations; i++) {
+        run(argv);
+    }
+    return (now() - start) * 1e6 / iterations;
+}
+
+int main(int argc, char **argv)
+{
+    int iterations = argc > 1 ? atoi(argv[1]) : 500;
+    static const char *sizes[] = { "0", "64", "256", "1024" };
+    const char **mb = argc > 2 ? (const char **) argv + 2 : sizes;
+    int num_sizes = argc > 2 ? argc - 2 : (int) (sizeof(sizes) / sizeof(sizes[0]));
+    char *target[] = { "/bin/true", NULL };
+
+    printf("%10s %14s %14s\n", "rss MB", "fork+exec us", "posix_spawn us");
+    char *ballast = NULL;
+    for (int i = 0; i < num_sizes; i++) {
+        size_t bytes = (size_t) atol(mb[i]) << 20;
+        free(ballast);
+        ballast = bytes > 0 ? malloc(bytes) : NULL;
+        if (bytes > 0 && ballast == NULL) {
+            fprintf(stderr, "spawn: can not allocate %s MB\n", mb[i]);
+            return 1;
+        }
+        if (ballast != NULL) {
+            memset(ballast, 1, bytes); // resident, so fork has page tables to copy
+        }
+        double forked = measure(run_fork, target, iterations);
+        double spawned = measure(run_spawn, target, iterations);
+        printf("%10s %14.1f %14.1f\n", mb[i], forked, spawned);
+    }
+    free(ballast);
+    return 0;
+}
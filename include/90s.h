@@ -3,7 +3,16 @@
 
 #include <stdio.h>
 
+typedef struct arena_mark {
+    void *chunk;
+    size_t off;
+} arena_mark;
+
 void *memalloc(size_t size);
-char **argsplit(char *line);
+void *arena_alloc(size_t size);
+void *arena_grow(void *ptr, size_t old, size_t size);
+arena_mark arena_save(void);
+void arena_restore(arena_mark mark);
+void arena_reset(void);
 
 #endif
@@ -0,0 +1,21 @@
+#ifndef ALIAS_H_
+#define ALIAS_H_
+
+#include <stddef.h>
+#include <stdbool.h>
+
+typedef struct aliasdef {
+    char *name;
+    char *value;
+    bool active; /* being expanded, not expanded again inside itself */
+} aliasdef;
+
+void alias_init(void);
+aliasdef *alias_find(const char *name);
+void alias_record(void);
+const char *alias_recorded(size_t *len);
+unsigned long alias_digest(const char *list, size_t len);
+int alias_define(char **args);
+int alias_remove(char **args);
+
+#endif
@@ -0,0 +1,18 @@
+#ifndef BUILTINS_H_
+#define BUILTINS_H_
+
+/* only writes output, inside a pipeline it runs in the shell itself */
+#define BUILTIN_PRINTS 1
+
+typedef struct builtin {
+    const char *name;
+    int (*func)(char **args);
+    int flags;
+} builtin;
+
+extern const builtin builtin_list[];
+extern const int builtin_count;
+
+const builtin *builtin_find(const char *name);
+
+#endif
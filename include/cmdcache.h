@@ -0,0 +1,13 @@
+#ifndef CMDCACHE_H_
+#define CMDCACHE_H_
+
+#include <stddef.h>
+
+void cmdcache_init(void);
+void cmdcache_rehash(void);
+void cmdcache_revalidate(void);
+const char *cmdcache_lookup(const char *name);
+const char **cmdcache_names(size_t *count);
+void cmdcache_print(void);
+
+#endif
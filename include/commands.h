@@ -1,9 +1,13 @@
 #ifndef COMMANDS_H_
 #define COMMANDS_H_
 
-int num_builtins(void);
-bool is_builtin(char *command);
-int execute(char **args, int fd, int options);
-int execute_pipe(char ***args);
+#include <stdbool.h>
+
+#include "parse.h"
+
+extern bool job_control;
+
+int execute_list(cmdlist *list);
+int execute_pipeline(pipeline *pipe_line);
 
 #endif
@@ -0,0 +1,21 @@
+#ifndef COMPLETE_H_
+#define COMPLETE_H_
+
+#include <stddef.h>
+#include <stdbool.h>
+
+#include "dircache.h"
+
+typedef struct completion {
+    direntry *items; /* sorted, names borrowed from the caches */
+    int count;
+    int cap;
+    size_t base; /* length of the part of the word the names start with */
+    size_t common; /* length every name shares */
+    bool fuzzy; /* names replace the last base bytes of the word instead of extending it */
+} completion;
+
+void complete_word(const char *word, size_t len, bool command, char **words, completion *c);
+int complete_spec(char **args);
+
+#endif
@@ -2,15 +2,13 @@
 #define CONSTANTS_H_
 
 #define HISTFILE "90s_history" // history file name
-#define TOK_BUFSIZE 64 // buffer size of each token
+#define HISTINDEX "90s_history.idx" // line offset index of history file
+#define RUNLOG "90s_runlog" // log of commands run with duration and status
+#define DIRFILE "90s_dirs" // directories visited with cd, ranked for j
+#define RCFILE "90s_rc" // commands run when the shell starts
+#define CACHEDIR "90s_cache" // compiled scripts, by a hash of their path
+#define TOK_BUFSIZE 64 // initial number of arguments of a command
 #define RL_BUFSIZE 1024 // size of each command
-#define TOK_DELIM " \t\r\n\a" // delimiter for token
-#define MAX_HISTORY 8192 // maximum lines of reading history
+#define HIST_SIZE 1048576 // maximum lines of history kept in memory
 
-#define MAX_JOBS 64 // maximum number of jobs
-#define OPT_STDIN 0x01 // option for stdin
-#define OPT_STDOUT 0x02 // option for stdout
-#define OPT_STDERR 0x04 // option for stderr
-#define OPT_FGJ 0x08 // option for foreground job
-#define OPT_BGJ 0x10 // option for background job
 #endif
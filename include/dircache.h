@@ -0,0 +1,26 @@
+#ifndef DIRCACHE_H_
+#define DIRCACHE_H_
+
+#include <stdbool.h>
+
+typedef struct direntry {
+    const char *name;
+    bool dir; /* a directory or a link to one */
+} direntry;
+
+typedef struct dirlist {
+    direntry *entries; /* sorted by name, without . and .. */
+    int count;
+} dirlist;
+
+enum { PATH_UNKNOWN, PATH_MISSING, PATH_FILE, PATH_DIR };
+
+const dirlist *dircache_get(const char *path);
+int dircache_peek(const char *path, const char *name);
+bool dircache_busy(void);
+bool dircache_work(void);
+int dircache_fd(void);
+bool dircache_collect(void);
+void dircache_expire(void);
+
+#endif
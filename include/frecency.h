@@ -0,0 +1,8 @@
+#ifndef FRECENCY_H_
+#define FRECENCY_H_
+
+void frecency_visit(const char *path);
+const char *frecency_best(char **fragments, const char *skip);
+void frecency_print(char **fragments, int limit);
+
+#endif
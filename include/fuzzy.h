@@ -0,0 +1,18 @@
+#ifndef FUZZY_H_
+#define FUZZY_H_
+
+#include <stddef.h>
+#include <stdbool.h>
+
+#define FUZZY_MAX 64 // pattern bytes looked at
+
+typedef struct fuzzy {
+    char lower[FUZZY_MAX]; /* each pattern byte as it may appear in the text */
+    char upper[FUZZY_MAX];
+    size_t len;
+} fuzzy;
+
+void fuzzy_init(fuzzy *f, const char *pattern, size_t len);
+int fuzzy_score(const fuzzy *f, const char *text, size_t len);
+
+#endif
@@ -0,0 +1,17 @@
+#ifndef GITSTAT_H_
+#define GITSTAT_H_
+
+#include <stddef.h>
+#include <stdbool.h>
+
+typedef struct gitrepo gitrepo;
+
+gitrepo *git_open(const char *dir);
+void git_update(gitrepo *repo, bool head);
+bool git_busy(gitrepo *repo);
+void git_work(gitrepo *repo, int budget);
+const char *git_range(gitrepo *repo);
+void git_counts(gitrepo *repo, const char *range, long ahead, long behind);
+void git_segment(gitrepo *repo, char *buf, size_t size);
+
+#endif
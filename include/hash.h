@@ -0,0 +1,33 @@
+#ifndef HASH_H_
+#define HASH_H_
+
+#include <stddef.h>
+#include <stdbool.h>
+
+/*
+ * Open addressing string hash table, keys are borrowed (not copied),
+ * the caller owns key storage and must keep it alive while in the table
+ */
+typedef struct hentry {
+    const char *key;
+    size_t len;
+    unsigned long hash;
+    void *val;
+} hentry;
+
+typedef struct htable {
+    hentry *slots;
+    size_t cap; /* always a power of two */
+    size_t count;
+} htable;
+
+unsigned long strhash(const char *s, size_t len);
+void ht_init(htable *t, size_t cap);
+void ht_free(htable *t);
+void ht_clear(htable *t);
+hentry *ht_find(htable *t, const char *key, size_t len);
+void *ht_get(htable *t, const char *key, size_t len);
+bool ht_put(htable *t, const char *key, size_t len, void *val);
+bool ht_del(htable *t, const char *key, size_t len);
+
+#endif
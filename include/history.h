@@ -2,10 +2,16 @@
 #define HISTORY_H_
 
 extern int cmd_count;
+extern char *histfile_path; /* NULL when running a script */
 
 void save_command_history(char *args);
+char *config_path(const char *name);
 void check_history_file(void);
-char *read_command(int direction);
-char **get_all_history(bool check);
+const char *read_command(int direction, size_t *len);
+void print_history(size_t last, bool unique, bool reverse);
+long history_build_index(void);
+size_t hist_first(void);
+size_t hist_end(void);
+const char *hist_entry(size_t id, size_t *len);
 
 #endif
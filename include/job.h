@@ -4,14 +4,39 @@
 #include <unistd.h>
 #include <stdbool.h>
 
+typedef enum { JOB_RUNNING, JOB_STOPPED, JOB_DONE } job_state;
+
+/*
+ * A pipeline in its own process group. statuses holds the exit status
+ * of each process once it is reaped and -1 while it lives, processes that
+ * never started have pid -1 and their status already.
+ */
 typedef struct job {
-    pid_t pid;
+    int id; /* 0 until it is in the table */
+    pid_t pgid;
+    pid_t *pids;
+    int *statuses;
+    int num_pids;
+    int live;
+    job_state state;
+    bool changed; /* state not reported yet */
     char *command;
-    bool status;
-    struct job *next;
 } job;
 
-int add_job(pid_t pid, char *command, bool status);
-job *get_job(pid_t pid);
+void job_init(void);
+int job_fd(void);
+job *job_new(pid_t pgid, pid_t *pids, int *statuses, int n, const char *command);
+int job_insert(job *j);
+void job_free(job *j);
+void job_remove(job *j);
+job *job_get(int id);
+job *job_spec(const char *spec);
+int job_max(void);
+bool job_wait(job *j);
+int job_kill(job *j, int sig);
+int job_status(job *j, int i);
+void job_reap(void);
+void job_print(job *j);
+void job_notify(void);
 
 #endif
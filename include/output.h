@@ -0,0 +1,15 @@
+#ifndef OUTPUT_H_
+#define OUTPUT_H_
+
+#include <stddef.h>
+#include <sys/types.h>
+
+extern int out_fd;
+
+void out_write(const void *buf, size_t n);
+void out_printf(const char *fmt, ...);
+void out_flush(void);
+void out_file(int fd, off_t off, size_t len);
+int out_redirect(int fd);
+
+#endif
@@ -0,0 +1,64 @@
+#ifndef PARSE_H_
+#define PARSE_H_
+
+#include <stddef.h>
+#include <stdbool.h>
+
+enum { REDIR_IN, REDIR_OUT, REDIR_APPEND, REDIR_DUP };
+
+typedef struct redir {
+    int fd; /* descriptor redirected, -1 for both stdout and stderr */
+    int kind;
+    char *path;
+    int target; /* REDIR_DUP copies this descriptor */
+} redir;
+
+typedef struct command {
+    char **argv; /* NULL terminated */
+    int argc;
+    int cap;
+    redir *redirs;
+    int num_redirs;
+} command;
+
+/* how the pipeline after this one runs */
+enum { NEXT_ALWAYS, NEXT_AND, NEXT_OR };
+
+typedef struct pipeline {
+    command *cmds;
+    int num_cmds;
+    bool background;
+    int next;
+} pipeline;
+
+typedef struct cmdlist {
+    pipeline *pipes;
+    int num_pipes;
+    char *words; /* unquoted text of every word */
+    const char *error; /* syntax error, nothing may run */
+} cmdlist;
+
+/*
+ * A $ reference in a word is kept as a marker, the text after the $ and
+ * EXPAND_END, so it is expanded when the command runs. Inside double
+ * quotes the marker is EXPAND_QUOTED and the value is not split.
+ */
+#define EXPAND_MARK '\001'
+#define EXPAND_END '\002'
+#define EXPAND_QUOTED '\003'
+
+enum { SPAN_COMMAND, SPAN_ARG, SPAN_REDIRECT, SPAN_OPERATOR };
+
+/* a token of the source line, for the highlighter */
+typedef struct span {
+    int start;
+    int end;
+    int kind;
+    const char *word; /* unquoted text, NULL for operators */
+} span;
+
+cmdlist *parse(const char *line, size_t len, span **spans, int *num_spans);
+void command_insert(command *cmd, int pos, char *arg);
+bool is_keyword(const char *word);
+
+#endif
@@ -0,0 +1,17 @@
+#ifndef PROMPT_H_
+#define PROMPT_H_
+
+#include <stdbool.h>
+
+void prompt_refresh(void);
+void prompt_async(void);
+const char *prompt_text(int *len);
+const char *prompt_cwd(void);
+void prompt_invalidate_cwd(void);
+void prompt_finished(int status, double duration);
+int prompt_fd(void);
+bool prompt_collect(void);
+bool prompt_busy(void);
+bool prompt_work(void);
+
+#endif
@@ -0,0 +1,25 @@
+#ifndef RUNLOG_H_
+#define RUNLOG_H_
+
+#include <time.h>
+#include <sys/resource.h>
+
+typedef struct runrec {
+    time_t when; /* wall clock at start */
+    struct timespec start; /* monotonic */
+    struct timespec end;
+} runrec;
+
+extern int last_status;
+extern int last_signal;
+extern struct rusage last_usage;
+
+void runlog_open(void);
+void runlog_begin(runrec *rec);
+void runlog_end(runrec *rec, const char *command);
+void runlog_wait_status(int status, struct rusage *usage);
+void runlog_pipestatus(int *statuses, int n);
+double runlog_duration(runrec *rec);
+int runlog_report(char **args);
+
+#endif
@@ -0,0 +1,36 @@
+#ifndef SCRIPT_H_
+#define SCRIPT_H_
+
+#include <stddef.h>
+#include <stdbool.h>
+
+#include "parse.h"
+
+/* compiled commands: code and the strings it refers to, in one block */
+typedef struct program {
+    const int *code;
+    int code_len;
+    const char *strings;
+    void *block; /* freed, or unmapped when mapped, with the program */
+    size_t size;
+    bool mapped;
+    int refs; /* owner, running instances and the functions it defined */
+} program;
+
+typedef struct scriptfn {
+    char *name;
+    program *prog;
+    int entry;
+} scriptfn;
+
+program *script_compile(cmdlist *list, const char *name);
+const char *script_build(void);
+program *script_load(void *block, size_t size);
+void script_release(program *prog);
+int script_run(program *prog, char **args, int count);
+int script_execute(cmdlist *list);
+int script_file(const char *path, char **args, int count);
+scriptfn *script_function(const char *name);
+int script_call(scriptfn *fn, char **argv);
+
+#endif
@@ -0,0 +1,12 @@
+#ifndef SCRIPTCACHE_H_
+#define SCRIPTCACHE_H_
+
+#include <sys/stat.h>
+
+#include "script.h"
+
+program *scriptcache_load(const char *path, struct stat *st);
+void scriptcache_store(const char *path, struct stat *st, program *prog,
+        const char *names, size_t names_len);
+
+#endif
@@ -0,0 +1,8 @@
+#ifndef SEARCH_H_
+#define SEARCH_H_
+
+#include <stddef.h>
+
+size_t hist_fuzzy(const char *query, size_t qlen, size_t *ids, size_t max);
+
+#endif
@@ -0,0 +1,27 @@
+#ifndef VARS_H_
+#define VARS_H_
+
+#include <stdbool.h>
+
+#include "parse.h"
+
+/* positional parameters, saved around a function call or a sourced file */
+typedef struct params {
+    char **args;
+    int count;
+} params;
+
+const char *var_get(const char *name);
+void var_set(const char *name, const char *value);
+void var_export(const char *name, const char *value);
+void var_unset(const char *name);
+bool var_name(const char *name, int len);
+bool var_assignment(const char *word);
+void var_assign(const char *word);
+params params_set(char **args, int count);
+void params_restore(params saved);
+bool params_shift(int n);
+void expand_word(const char *word, command *cmd);
+char *expand_text(const char *word);
+
+#endif
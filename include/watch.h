@@ -0,0 +1,14 @@
+#ifndef WATCH_H_
+#define WATCH_H_
+
+#include <stdint.h>
+
+/* called with the name inside the watched directory, NULL for the directory itself */
+typedef void (*watch_fn)(void *data, const char *name, uint32_t mask);
+
+int watch_add(const char *path, uint32_t mask, watch_fn fn, void *data);
+void watch_remove(int wd, watch_fn fn, void *data);
+int watch_fd(void);
+void watch_poll(void);
+
+#endif
@@ -4,14 +4,29 @@
 #include <stdio.h>
 #include <string.h>
 #include <limits.h>
-#include <time.h>
 #include <stdbool.h>
 #include <signal.h>
-#include <ctype.h>
+#include <errno.h>
+#include <poll.h>
+#include <sys/ioctl.h>
 
 #include "constants.h"
+#include "90s.h"
 #include "history.h"
 #include "commands.h"
+#include "builtins.h"
+#include "cmdcache.h"
+#include "search.h"
+#include "runlog.h"
+#include "parse.h"
+#include "prompt.h"
+#include "watch.h"
+#include "complete.h"
+#include "job.h"
+#include "alias.h"
+#include "dircache.h"
+#include "script.h"
+#include "vars.h"
 
 void *memalloc(size_t size)
 {
@@ -23,6 +38,86 @@ void *memalloc(size_t size)
 	return ptr;
 }
 
+/*
+ * Everything a command line needs until it has run (tokens, argv arrays,
+ * expanded strings, redirections) is bumped out of one arena which is
+ * reset after the line. Chunks are kept for the next line, so a shell
+ * whose lines fit stops calling malloc for them.
+ */
+#define ARENA_CHUNK 65536
+#define ARENA_ALIGN(n) (((n) + 15) & ~(size_t) 15)
+
+typedef struct chunk {
+	struct chunk *next;
+	size_t size;
+	char data[];
+} chunk;
+
+static chunk *arena_head = NULL, *arena_cur = NULL;
+static size_t arena_off = 0;
+static size_t arena_last = (size_t) -1; /* offset of the last allocation */
+
+void *arena_alloc(size_t size)
+{
+	size = ARENA_ALIGN(size);
+	if (arena_cur == NULL || arena_off + size > arena_cur->size) {
+		chunk *next = arena_cur != NULL ? arena_cur->next : arena_head;
+		if (next == NULL || next->size < size) {
+			size_t chunk_size = size > ARENA_CHUNK ? size : ARENA_CHUNK;
+			chunk *c = memalloc(sizeof(chunk) + chunk_size);
+			c->size = chunk_size;
+			c->next = next;
+			if (arena_cur != NULL) {
+				arena_cur->next = c;
+			} else {
+				arena_head = c;
+			}
+			next = c;
+		}
+		arena_cur = next;
+		arena_off = 0;
+	}
+	arena_last = arena_off;
+	arena_off += size;
+	return arena_cur->data + arena_last;
+}
+
+// resize an arena allocation, in place when it is the last one and fits
+void *arena_grow(void *ptr, size_t old, size_t size)
+{
+	if (ptr != NULL && arena_cur != NULL && ptr == arena_cur->data + arena_last &&
+			arena_last + ARENA_ALIGN(size) <= arena_cur->size) {
+		arena_off = arena_last + ARENA_ALIGN(size);
+		return ptr;
+	}
+	void *new = arena_alloc(size);
+	if (ptr != NULL) {
+		memcpy(new, ptr, old < size ? old : size);
+	}
+	return new;
+}
+
+arena_mark arena_save(void)
+{
+	arena_mark mark = { arena_cur, arena_off };
+	return mark;
+}
+
+// drop everything allocated after mark
+void arena_restore(arena_mark mark)
+{
+	arena_cur = mark.chunk;
+	arena_off = mark.off;
+	arena_last = (size_t) -1;
+}
+
+void arena_reset(void)
+{
+	arena_cur = arena_head;
+	arena_off = 0;
+	arena_last = (size_t) -1;
+}
+
 void change_terminal_attribute(int option)
 {  
 	static struct termios oldt, newt;
@@ -36,475 +131,872 @@ void change_terminal_attribute(int option)
 	}
 }  
 
-char **setup_path_variable(void)
+// commands are looked up in the PATH cache, no syscalls on each keystroke
+bool find_command(const char *command)
 {
-	char *envpath = getenv("PATH");
-	if (envpath == NULL) {
-		fprintf(stderr, "90s: PATH environment variable is missing\n");
-		exit(EXIT_FAILURE);
+	if (*command == '\0') {
+		return false;
 	}
-	char *path_cpy = memalloc(strlen(envpath) + 1);
-	char *path = memalloc(strlen(envpath) + 1);
-	strcpy(path_cpy, envpath);
-	strcpy(path, envpath);
-	int path_count = 0;
-	while (*path_cpy != '\0') {
-		// count number of : to count number of elements
-		if (*path_cpy == ':') {
-			path_count++;
+	return builtin_find(command) != NULL || script_function(command) != NULL ||
+		is_keyword(command) || cmdcache_lookup(command) != NULL;
+}
+
+/*
+ * Line editor render model: the terminal contents after the prompt are
+ * remembered (text, color of each cell and cursor column), every redraw
+ * compares the wanted line against it and only sends the changed span,
+ * batched into a single write()
+ */
+enum { HL_NONE, HL_VALID, HL_INVALID, HL_ARG, HL_PATH };
+static const char *hl_sgr[] = { "\033[m", "\033[32m", "\033[31m", "\033[37m", "\033[37;4m" };
+
+typedef struct view {
+	char *text;
+	unsigned char *attr;
+	int len;
+	int cap;
+	int cursor;
+} view;
+
+typedef struct editline {
+	char *buf;
+	int len;
+	int cap;
+	int pos;
+	char *label; /* uncolored text shown before the line, NULL for none */
+	int label_len;
+} editline;
+
+static view drawn, wanted;
+static char *termbuf = NULL;
+static size_t termlen = 0, termcap = 0;
+
+static void term_append(const char *s, size_t n)
+{
+	if (termlen + n > termcap) {
+		termcap = (termlen + n) * 2 + 256;
+		termbuf = realloc(termbuf, termcap);
+		if (!termbuf) {
+			fprintf(stderr, "90s: Error allocating memory\n");
+			exit(EXIT_FAILURE);
 		}
-		path_cpy++;
-	}
-	path_count += 2; // adding one to be correct and one for terminator
-	char **paths = memalloc(sizeof(char *) * path_count);
-	char *token = strtok(path, ":");
-	int counter = 0;
-	while (token != NULL) {
-		paths[counter] = token; // set element to the pointer of start of path
-		token = strtok(NULL, ":");
-		counter++;
 	}
-	paths[counter] = NULL;
-	return paths;
+	memcpy(termbuf + termlen, s, n);
+	termlen += n;
 }
 
-bool find_command(char **paths, char *command)
+static void term_csi(int n, char final)
 {
-	if (strncmp(command, "", 1) == 0) {
-		return false;
+	char seq[32];
+	int len = snprintf(seq, sizeof(seq), "\033[%d%c", n, final);
+	term_append(seq, len);
+}
+
+static void term_flush(void)
+{
+	size_t done = 0;
+	while (done < termlen) {
+		ssize_t n = write(STDOUT_FILENO, termbuf + done, termlen - done);
+		if (n == -1) {
+			break;
+		}
+		done += n;
 	}
-	while (*paths != NULL) {
-		char current_path[PATH_MAX];
-		current_path[0] = '\0';
-		sprintf(current_path, "%s/%s", *paths, command);
-		if (access(current_path, X_OK) == 0) {
-			// command is executable
-			return true;
-		} else {
-			if (is_builtin(command)) {
-				return true;
-			}
+	termlen = 0;
+}
+
+static void view_reserve(view *v, int size)
+{
+	if (size > v->cap) {
+		v->cap = size * 2;
+		v->text = realloc(v->text, v->cap);
+		v->attr = realloc(v->attr, v->cap);
+		if (!v->text || !v->attr) {
+			fprintf(stderr, "90s: Error allocating memory\n");
+			exit(EXIT_FAILURE);
 		}
-		paths++;
 	}
-	return false;
 }
 
-void shiftleft(int chars)
+// a fresh prompt has been printed, nothing of the line is on screen yet
+static void view_reset(void)
 {
-	printf("\033[%dD", chars);
+	drawn.len = 0;
+	drawn.cursor = 0;
 }
 
-void shiftright(int chars)
+static void move_cursor(int to)
 {
-	printf("\033[%dC", chars);
+	if (to < drawn.cursor) {
+		term_csi(drawn.cursor - to, 'D');
+	} else if (to > drawn.cursor) {
+		term_csi(to - drawn.cursor, 'C');
+	}
+	drawn.cursor = to;
 }
 
-void clearline(void)
+// print cells [from, to) of the wanted line at the cursor
+static void emit_cells(int from, int to)
 {
-	printf("\033[K"); // clear line to the right of cursor
+	int cur = -1;
+	for (int i = from; i < to; i++) {
+		if (wanted.attr[i] != cur) {
+			cur = wanted.attr[i];
+			term_append(hl_sgr[cur], strlen(hl_sgr[cur]));
+		}
+		term_append(&wanted.text[i], 1);
+	}
+	if (cur != -1 && cur != HL_NONE) {
+		term_append(hl_sgr[HL_NONE], strlen(hl_sgr[HL_NONE]));
+	}
+	drawn.cursor = to;
 }
 
-void highlight(char *buffer, char **paths)
+static bool cell_eq(int old, int new)
 {
-	char *cmd_part = strchr(buffer, ' ');
-	char *command_without_arg = NULL;
-	int cmd_len = 0;
-	bool valid;
+	return drawn.text[old] == wanted.text[new] && drawn.attr[old] == wanted.attr[new];
+}
 
-	if (cmd_part != NULL) {
-		cmd_len = cmd_part - buffer;
-		char *cmd = memalloc(cmd_len + 1);
-		command_without_arg = memalloc(cmd_len + 1);
-		memcpy(cmd, buffer, cmd_len);
-		cmd[cmd_len] = '\0';
-		memcpy(command_without_arg, cmd, cmd_len + 1);
-		cmd[cmd_len] = '\0';
-		command_without_arg[cmd_len] = '\0';
-		valid = find_command(paths, cmd);
-		free(cmd);
-	} else {
-		valid = find_command(paths, buffer);
+/*
+ * The line is parsed once per change: the highlighter keeps the parse of
+ * the text it colored and the command loop runs that parse when the line
+ * is entered as it was drawn
+ */
+static struct {
+	char *text;
+	int len;
+	cmdlist *list;
+	span *spans;
+	int num_spans;
+	arena_mark mark; /* arena before the cached parse, which is its last allocation */
+} parsed;
+
+static void parse_cached(const char *text, int len)
+{
+	if (parsed.list != NULL && parsed.len == len && memcmp(parsed.text, text, len) == 0) {
+		return;
 	}
+	if (parsed.list != NULL) {
+		arena_restore(parsed.mark);
+	}
+	parsed.mark = arena_save();
+	parsed.text = realloc(parsed.text, len + 1);
+	if (!parsed.text) {
+		fputs("90s: Error allocating memory\n", stderr);
+		exit(EXIT_FAILURE);
+	}
+	memcpy(parsed.text, text, len);
+	parsed.len = len;
+	parsed.list = parse(text, len, &parsed.spans, &parsed.num_spans);
+}
 
-	if (valid) {
-		if (command_without_arg != NULL) {
-			buffer += cmd_len;
-			printf("\x1b[32m%s\x1b[37m%s\x1b[m", command_without_arg, buffer); // print green as valid command, but only color the command, not the arguments
-			buffer -= cmd_len;
-		} else {
-			printf("\x1b[32m%s\x1b[m", buffer); // print green as valid command
-		}
+// the parse of line, which lives until the arena is reset
+static cmdlist *take_parsed(const char *line)
+{
+	parse_cached(line, strlen(line));
+	cmdlist *list = parsed.list;
+	parsed.list = NULL;
+	parsed.spans = NULL;
+	parsed.num_spans = 0;
+	return list;
+}
+
+/*
+ * Whether an argument names an existing file, asked from the directory
+ * cache which never does I/O here: a directory not read yet is read
+ * between keystrokes and the line drawn again
+ */
+static bool path_exists(const char *word)
+{
+	const char *slash = strrchr(word, '/');
+	const char *name = slash != NULL ? slash + 1 : word;
+	int dir_len = name - word;
+	const char *home = getenv("HOME");
+	const char *cwd = prompt_cwd();
+	char path[PATH_MAX];
+	int n;
+	if (*word == '\0' || strpbrk(word, "\001\003") != NULL) { // expanded when it runs
+		return false;
+	}
+	if (word[0] == '/') {
+		n = snprintf(path, sizeof(path), "%.*s", dir_len, word);
+	} else if (word[0] == '~' && (word[1] == '/' || word[1] == '\0') && home != NULL) {
+		n = snprintf(path, sizeof(path), "%s/%.*s", home, dir_len > 1 ? dir_len - 2 : 0, word + 2);
+		name = word[1] == '\0' ? "" : name;
+	} else if (cwd[0] == '/') {
+		n = snprintf(path, sizeof(path), "%s/%.*s", cwd, dir_len, word);
 	} else {
-		if (command_without_arg != NULL) {
-			buffer += cmd_len;
-			printf("\x1b[31m%s\x1b[37m%s\x1b[m", command_without_arg, buffer); // print red as invalid command, but only color the command, not the arguments
-			buffer -= cmd_len;
-		} else {
-			printf("\x1b[31m%s\x1b[m", buffer); // print red as invalid command
-		}
+		return false;
+	}
+	if (n <= 0 || (size_t) n >= sizeof(path)) {
+		return false;
 	}
-	fflush(stdout);
-	free(command_without_arg);
+	int state = dircache_peek(path, name);
+	return state == PATH_FILE || state == PATH_DIR;
 }
 
-char *readline(char **paths)
+/*
+ * Color every command word green if it can be run and red otherwise,
+ * arguments and file names are white and underlined when they exist,
+ * operators are left alone
+ */
+void highlight(const char *buffer, int len, unsigned char *attr)
 {
-	int bufsize = RL_BUFSIZE;
-	int position = 0;
-	char *buffer = memalloc(bufsize);
+	parse_cached(buffer, len);
+	memset(attr, HL_NONE, len);
+	for (int i = 0; i < parsed.num_spans; i++) {
+		span *sp = &parsed.spans[i];
+		unsigned char color = HL_ARG;
+		if (sp->kind == SPAN_COMMAND && var_assignment(sp->word)) {
+			color = HL_ARG;
+		} else if (sp->kind == SPAN_COMMAND) {
+			color = find_command(sp->word) ? HL_VALID : HL_INVALID;
+		} else if (sp->kind == SPAN_OPERATOR) {
+			color = HL_NONE;
+		} else if (path_exists(sp->word)) {
+			color = HL_PATH;
+		}
+		memset(attr + sp->start, color, sp->end - sp->start);
+	}
+}
 
-	bool moved = false;
-	bool backspaced = false;
-	bool navigated = false;
-	bool insertatmiddle = false;
-	bool replaced = false;
+/*
+ * Bring the terminal from the drawn line to the edit line with the
+ * smallest change: insert or delete a span in place, overwrite a
+ * recolored span, or rewrite the tail when nothing better applies
+ */
+static void render(editline *line)
+{
+	int label_len = line->label != NULL ? line->label_len : 0;
+	view_reserve(&wanted, label_len + line->len + 1);
+	view_reserve(&drawn, label_len + line->len + 1);
+	if (label_len > 0) {
+		memcpy(wanted.text, line->label, label_len);
+		memset(wanted.attr, HL_NONE, label_len);
+	}
+	memcpy(wanted.text + label_len, line->buf, line->len);
+	wanted.len = label_len + line->len;
+	highlight(wanted.text + label_len, line->len, wanted.attr + label_len);
 
-	buffer[0] = '\0';
-	while (1) {
-		int c = getchar(); // read a character
-		int buf_len = strlen(buffer);
+	int oldlen = drawn.len, newlen = wanted.len;
+	int min = oldlen < newlen ? oldlen : newlen;
+	int prefix = 0;
+	while (prefix < min && cell_eq(prefix, prefix)) {
+		prefix++;
+	}
+	int suffix = 0;
+	while (suffix < min - prefix && cell_eq(oldlen - 1 - suffix, newlen - 1 - suffix)) {
+		suffix++;
+	}
+	int oldmid = oldlen - prefix - suffix;
+	int newmid = newlen - prefix - suffix;
 
-		// check each character user has input
-		switch (c) {
-			case EOF:
-				exit(EXIT_SUCCESS);
-			case 10: {
-						 // enter/new line feed
-						 if (buf_len == 0) {
-							 return NULL;
-						 }
-						 // check if command includes !!
-						 if (strstr(buffer, "!!") != NULL) {
-							 char *last_command = read_command(1);
-							 if (last_command != NULL) {
-								 // replace !! with the last command
-								 char *replace = strstr(buffer, "!!");
-								 int replace_len = strlen(replace);
-								 int last_command_len = strlen(last_command);
-								 int buffer_len = strlen(buffer);
-								 if (last_command_len > replace_len) {
-									 buffer = realloc(buffer, buffer_len + last_command_len - replace_len + 1);
-									 if (!buffer) {
-										 fprintf(stderr, "90s: Error allocating memory\n");
-										 exit(EXIT_FAILURE);
-									 }
-								 }
-								 memmove(replace + last_command_len, replace + replace_len, buffer_len - (replace - buffer) - replace_len + 1);
-								 memcpy(replace, last_command, last_command_len);
-								 position += last_command_len - replace_len;
-								 shiftright(last_command_len - replace_len);
-								 replaced = true;
-								 break;
-							 }
-						 } else {
-							 buffer[buf_len] = '\0';
-							 // clear all characters after the command
-							 for (int start = buf_len + 1; buffer[start] != '\0'; start++) {
-								 buffer[start] = '\0';
-							 }
-							 printf("\n"); // give space for response
-							 position = 0;
-							 return buffer;
-						 }
-					 }
-			case 127: // backspace
-					 if (buf_len >= 1) {
-						 position--;
-						 for (int i = position; i < buf_len; i++) {
-							 // shift the buffer
-							 buffer[i] = buffer[i + 1];
-						 }
-						 backspaced = true;
-						 moved = false;
-					 }
-					 break;
-			case 27: // arrow keys comes at three characters, 27, 91, then 65-68
-					 if (getchar() == 91) {
-						 int arrow_key = getchar();
-						 if (arrow_key == 65) { // up
-												// read history file and fill prompt with latest command
-							 char *last_command = read_command(1);
-							 if (last_command != NULL) {
-								 strcpy(buffer, last_command);
-							 }
-							 navigated = true;
-							 moved = false;
-							 break;
-						 } else if (arrow_key == 66) { // down
-							 char *last_command = read_command(0);
-							 if (last_command != NULL) {
-								 strcpy(buffer, last_command);
-							 }
-							 navigated = true;
-							 moved = false;
-							 break;
-						 } else if (arrow_key == 67) { // right
-							 if (position < buf_len) {
-								 shiftright(1);
-								 position++;
-							 }
-							 moved = true;
-							 break;
-						 } else if (arrow_key == 68) { // left
-							 if (position >= 1) {
-								 shiftleft(1);
-								 position--;
-							 }
-							 moved = true;
-							 break;
-						 } 
-					 }
-			default:
-					 if (c > 31 && c < 127) {
-						 if (position == buf_len) {
-							 // Append character to the end of the buffer
-							 buffer[buf_len] = c;
-							 buffer[buf_len + 1] = '\0';
-							 moved = false;
-							 navigated = false;
-						 } else {
-							 // Insert character at the current position
-							 memmove(&buffer[position + 1], &buffer[position], buf_len - position + 1);
-							 buffer[position] = c;
-							 shiftright(1);
-							 insertatmiddle = true;
-						 }
-						 position++;
-					 }
-		}
-
-		buf_len = strlen(buffer);
-
-		if (replaced) {
-			shiftleft(buf_len);
-			clearline();
-		}
-
-		if (navigated && buf_len >= 1) {
-			if (position > 0) {
-				shiftleft(position);  // move cursor to the beginning
+	if (oldmid != 0 || newmid != 0) {
+		move_cursor(prefix);
+		if (suffix > 0 && oldmid == 0) {
+			term_csi(newmid, '@'); // insert blank cells, then fill them
+			emit_cells(prefix, prefix + newmid);
+		} else if (suffix > 0 && newmid == 0) {
+			term_csi(oldmid, 'P'); // delete cells, the rest shifts left
+		} else if (suffix > 0 && oldmid == newmid) {
+			emit_cells(prefix, prefix + newmid);
+		} else {
+			emit_cells(prefix, newlen);
+			if (newlen < oldlen) {
+				term_append("\033[K", 3); // clear line to the right of cursor
 			}
-			clearline();
-			position = buf_len;
 		}
+	}
+	move_cursor(label_len + line->pos);
+	term_flush();
 
-		if (moved) {
-			moved = false;
-			continue;
-		}
+	memcpy(drawn.text, wanted.text, newlen);
+	memcpy(drawn.attr, wanted.attr, newlen);
+	drawn.len = newlen;
+}
 
-		if (!navigated && !replaced) {
-			if (position != buf_len) {
-				// not at normal place
-				if (backspaced) {
-					shiftleft(position + 1);
-				} else {
-					shiftleft(position);  // move cursor to the beginning
-				}
-			} else if (buf_len > 1) {
-				if (backspaced) {
-					shiftleft(buf_len + 1);  // move cursor to the beginning
-				} else {
-					shiftleft(buf_len - 1);  // move cursor to the beginning
-				}
-			} else if (buf_len == 1) {
-				if (backspaced) {
-					shiftleft(2);
-				}
-			} else if (buf_len == 0) {
-				if (backspaced) {
-					shiftleft(1);	
-				}
-			}
-			clearline();
-		} else {
-			navigated = false;
+static void line_reserve(editline *line, int extra)
+{
+	if (line->len + extra + 1 > line->cap) {
+		line->cap = line->len + extra + 1 + RL_BUFSIZE;
+		line->buf = realloc(line->buf, line->cap);
+		if (!line->buf) {
+			fprintf(stderr, "90s: Error allocating memory\n");
+			exit(EXIT_FAILURE);
 		}
+	}
+}
 
-		highlight(buffer, paths);
+static void line_insert(editline *line, const char *s, int n)
+{
+	line_reserve(line, n);
+	memmove(line->buf + line->pos + n, line->buf + line->pos, line->len - line->pos + 1);
+	memcpy(line->buf + line->pos, s, n);
+	line->len += n;
+	line->pos += n;
+}
 
-		if (backspaced) {
-			if (buf_len != position) {
-				shiftleft(buf_len - position);
-			}
-			backspaced = false;
+static void line_delete(editline *line, int at, int n)
+{
+	memmove(line->buf + at, line->buf + at + n, line->len - at - n + 1);
+	line->len -= n;
+	if (line->pos > at) {
+		line->pos = line->pos - n < at ? at : line->pos - n;
+	}
+}
+
+static void line_set(editline *line, const char *s, int n)
+{
+	line->len = 0;
+	line_reserve(line, n);
+	memcpy(line->buf, s, n);
+	line->buf[n] = '\0';
+	line->len = n;
+	line->pos = n;
+}
+
+// replace !! with the last command, false if there is none
+static bool expand_bang(editline *line)
+{
+	char *replace = strstr(line->buf, "!!");
+	if (replace == NULL) {
+		return false;
+	}
+	size_t len;
+	const char *last_command = read_command(1, &len);
+	if (last_command == NULL) {
+		return false;
+	}
+	int at = replace - line->buf;
+	int end = line->pos;
+	line->pos = at;
+	line_delete(line, at, 2);
+	line_insert(line, last_command, len);
+	if (end > at + 2) {
+		line->pos = end - 2 + len;
+	}
+	return true;
+}
+
+/*
+ * Terminal input is read in bulk: everything the tty has ready comes in
+ * with one read(), all of it is applied to the edit line and the line is
+ * redrawn once per batch instead of once per byte
+ */
+static unsigned char inbuf[RL_BUFSIZE * 4];
+static int inlen = 0, inpos = 0;
+
+// read what is available, block until something arrives if asked to
+static bool fill_input(bool block)
+{
+	struct pollfd pfd = { STDIN_FILENO, POLLIN, 0 };
+	if (!block && poll(&pfd, 1, 0) <= 0) {
+		return false;
+	}
+	ssize_t n;
+	do {
+		n = read(STDIN_FILENO, inbuf, sizeof(inbuf));
+	} while (n == -1 && errno == EINTR);
+	if (n <= 0) {
+		exit(EXIT_SUCCESS); // end of input
+	}
+	inlen = n;
+	inpos = 0;
+	return true;
+}
+
+// wait for keys, repainting the prompt when a slow segment arrives meanwhile
+static void wait_input(editline *line)
+{
+	for (;;) {
+		struct pollfd pfd[5] = { { STDIN_FILENO, POLLIN, 0 }, { prompt_fd(), POLLIN, 0 },
+			{ watch_fd(), POLLIN, 0 }, { job_fd(), POLLIN, 0 }, { dircache_fd(), POLLIN, 0 } };
+		// while the prompt or the directory cache have work left it is done between keystrokes
+		int ready = poll(pfd, 5, prompt_busy() || dircache_busy() ? 0 : -1);
+		if (ready == -1) {
+			continue; // interrupted
 		}
-		if (insertatmiddle) {
-			shiftleft(buf_len - position); // move cursor back to where it was
-			insertatmiddle = false;
+		bool changed = pfd[1].revents != 0 && prompt_collect();
+		bool listed = pfd[4].revents != 0 && dircache_collect();
+		if (ready == 0) {
+			listed |= dircache_work();
 		}
-		if (replaced) {
-			replaced = false;
+		if (pfd[3].revents != 0) {
+			job_reap(); // background jobs are told about before the next prompt
 		}
-
-		// If we have exceeded the buffer, reallocate.
-		if ((buf_len + 1) >= bufsize) {
-			bufsize += RL_BUFSIZE;
-			buffer = realloc(buffer, bufsize);
-			if (!buffer) {
-				fprintf(stderr, "90s: Error allocating memory\n");
-				exit(EXIT_FAILURE);
-			}
+		if (pfd[2].revents != 0 || ready == 0) {
+			changed |= prompt_work();
+		}
+		if (changed) {
+			int len;
+			const char *prompt = prompt_text(&len);
+			term_append("\r", 1);
+			term_append(prompt, len);
+			term_append("\033[K", 3);
+			view_reset(); // the line after the prompt is drawn again
+			render(line);
+		} else if (listed) {
+			render(line); // paths can be underlined now
+		}
+		if (pfd[0].revents != 0) {
+			break;
 		}
 	}
+	fill_input(true);
 }
 
-// split line into arguments
-char **argsplit(char *line)
+static bool input_pending(void)
 {
-	int bufsize = TOK_BUFSIZE, position = 0;
-	char **tokens = memalloc(sizeof(char *) * bufsize);
-	char *token;
+	return inpos < inlen || fill_input(false);
+}
 
-	token = strtok(line, TOK_DELIM);
-	while (token != NULL) {
-		tokens[position] = token;
-		position++;
+static int getbyte(void)
+{
+	if (inpos == inlen) {
+		fill_input(true);
+	}
+	return inbuf[inpos++];
+}
 
-		if (position >= bufsize) {
-			bufsize += TOK_BUFSIZE;
-			tokens = realloc(tokens, sizeof(char *) * bufsize);
-			if (!tokens) {
+// read a CSI sequence after ESC [, returns the final byte and numeric parameter
+static int read_csi(int *param)
+{
+	int c;
+	*param = 0;
+	while ((c = getbyte()) >= '0' && c <= ';') {
+		if (c >= '0' && c <= '9') {
+			*param = *param * 10 + c - '0';
+		}
+	}
+	return c;
+}
+
+// bracketed paste, take everything up to ESC [ 201 ~ and insert it at once
+static void read_paste(editline *line)
+{
+	static const char end[] = "\033[201~";
+	static char *paste = NULL;
+	static int cap = 0;
+	int len = 0, matched = 0;
+	while (end[matched] != '\0') {
+		int c = getbyte();
+		if (c == end[matched]) {
+			matched++;
+			continue;
+		}
+		if (len + matched + 1 > cap) {
+			cap = (len + matched + 1) * 2 + RL_BUFSIZE;
+			paste = realloc(paste, cap);
+			if (!paste) {
 				fprintf(stderr, "90s: Error allocating memory\n");
 				exit(EXIT_FAILURE);
 			}
 		}
+		// partial terminator match was content after all
+		for (int i = 0; i < matched; i++) {
+			paste[len++] = end[i] == '\033' ? ' ' : end[i];
+		}
+		matched = c == end[0] ? 1 : 0;
+		if (matched == 0) {
+			// newlines and tabs become spaces, other control bytes are dropped
+			if (c == '\n' || c == '\r' || c == '\t') {
+				paste[len++] = ' ';
+			} else if (c > 31 && c < 127) {
+				paste[len++] = c;
+			}
+		}
+	}
+	line_insert(line, paste, len);
+}
+
+/*
+ * Ctrl-R fuzzy history search, the edit line shows the match and the
+ * query is kept in its own line shown in the label. The history is
+ * ranked again when the query changes, Ctrl-R steps to the next best.
+ */
+#define SEARCH_RESULTS 256 // matches kept per query
 
-		token = strtok(NULL, TOK_DELIM);
+typedef struct isearch {
+	bool active;
+	editline query;
+	editline saved; /* line before the search, restored by Ctrl-G */
+	size_t ranked[SEARCH_RESULTS];
+	size_t num_ranked;
+	size_t at; /* match shown */
+} isearch;
+
+static void search_show(editline *line, isearch *search)
+{
+	bool found = search->at < search->num_ranked;
+	if (found) {
+		size_t len;
+		const char *text = hist_entry(search->ranked[search->at], &len);
+		line_set(line, text, len);
+	}
+	const char *fmt = !found && search->query.len > 0 ?
+		"(failed fuzzy-search)`%s': " : "(fuzzy-search)`%s': ";
+	int size = strlen(fmt) + search->query.len;
+	line->label = realloc(line->label, size);
+	if (!line->label) {
+		fprintf(stderr, "90s: Error allocating memory\n");
+		exit(EXIT_FAILURE);
 	}
-	tokens[position] = NULL;
-	return tokens;
+	line->label_len = snprintf(line->label, size, fmt, search->query.buf);
 }
 
-char **modifyargs(char **args)
+static void search_update(editline *line, isearch *search)
 {
-	int num_arg = 0;
+	search->num_ranked = hist_fuzzy(search->query.buf, search->query.len,
+			search->ranked, SEARCH_RESULTS);
+	search->at = 0;
+	search_show(line, search);
+}
 
-	// check if command is ls, diff, or grep, if so, add --color=auto to the arguments
-	// this is to make ls, diff, and grep have color without user typing it
-	// this is to make the shell more user friendly
-	while (args[num_arg] != NULL) {
-		num_arg++;
-	}
-	for (int i = 0; i < num_arg; i++) {
-		// makes ls and diff and grep have color without user typing it
-		if (strncmp(args[i], "ls", 2) == 0 || strncmp(args[i], "diff", 4) == 0 || strncmp(args[i], "grep", 4) == 0) {
-			for (int j = num_arg; j > i; j--) {
-				args[j + 1] = args[j];
-			}
-			args[i + 1] = "--color=auto";
-			num_arg++;
+static void search_start(editline *line, isearch *search)
+{
+	search->active = true;
+	search->query.len = search->query.pos = 0;
+	line_reserve(&search->query, 0);
+	search->query.buf[0] = '\0';
+	line_set(&search->saved, line->buf, line->len);
+	search->saved.pos = line->pos;
+	search_update(line, search);
+}
+
+static void search_end(editline *line, isearch *search)
+{
+	search->active = false;
+	free(line->label);
+	line->label = NULL;
+	line->label_len = 0;
+}
+
+// handle a key while searching, false when it should be handled as usual
+static bool search_key(editline *line, isearch *search, int c)
+{
+	if (c == 18) { // Ctrl-R again, next best match
+		if (search->at + 1 < search->num_ranked) {
+			search->at++;
+			search_show(line, search);
+		}
+	} else if (c == 7) { // Ctrl-G, give up and restore the line
+		line_set(line, search->saved.buf, search->saved.len);
+		line->pos = search->saved.pos;
+		search_end(line, search);
+	} else if (c == 127) {
+		if (search->query.len > 0) {
+			line_delete(&search->query, search->query.len - 1, 1);
+			search_update(line, search);
 		}
+	} else if (c > 31 && c < 127) {
+		char ch = c;
+		line_insert(&search->query, &ch, 1);
+		search_update(line, search);
+	} else {
+		search_end(line, search); // accept the match, key acts on it
+		return false;
 	}
+	return true;
+}
 
-	return args;
+/*
+ * Tab completion of the word before the cursor. A single match or the
+ * part all matches share is inserted, otherwise the matches are listed
+ * in columns below the line and the cursor goes back to where it was,
+ * the line itself is not drawn again
+ */
+static bool is_word_break(const char *buf, int at)
+{
+	char c = buf[at];
+	bool escaped = at > 0 && buf[at - 1] == '\\';
+	return !escaped && (c == ' ' || c == '\t' || c == '|' || c == '&' || c == ';' ||
+		c == '<' || c == '>');
 }
 
-char *trimws(char *str)
+// insert a name the way it has to be typed
+static void insert_escaped(editline *line, const char *s, size_t n)
 {
-	char *end;
-	while (isspace((unsigned char) *str))
-		str++;
-	if(*str == 0)
-		return str;
-	end = str + strlen(str) - 1;
-	while (end > str && isspace((unsigned char) *end))
-		end--;
-	*(end+1) = 0;
-	return str;
+	for (size_t i = 0; i < n; i++) {
+		if (strchr(" \t'\"\\|&;<>#", s[i]) != NULL) {
+			line_insert(line, "\\", 1);
+		}
+		line_insert(line, &s[i], 1);
+	}
 }
 
-char ***pipe_argsplit(char *line)
+// columns of the prompt on screen, escape sequences take none
+static int visible_width(const char *s, int len)
 {
-	char ***cmdv = memalloc(sizeof(char **) * 128); // 127 commands, 1 for NULL
-	char **cmds = memalloc(sizeof(char *) * 128); // 127 arguments, 1 for NULL
-	int num_arg = 0;
-	char *pipe = strtok(line, "|");
-	while (pipe != NULL) {
-		pipe = trimws(pipe);
-		cmds[num_arg] = strdup(pipe);
-		pipe = strtok(NULL, "|");
-		num_arg++;
+	int width = 0;
+	for (int i = 0; i < len; i++) {
+		if (s[i] == '\033' && i + 1 < len && s[i + 1] == '[') {
+			i += 2;
+			while (i < len && !(s[i] >= '@' && s[i] <= '~')) {
+				i++;
+			}
+		} else if ((s[i] & 0xC0) != 0x80) {
+			width++;
+		}
 	}
-	cmds[num_arg] = NULL;
+	return width;
+}
 
-	for (int i = 0; i < num_arg; i++) {
-		char **splitted = argsplit(cmds[i]);
-		cmdv[i] = modifyargs(splitted);
+static void show_candidates(completion *c)
+{
+	struct winsize ws;
+	int width = 80, height = 24;
+	if (ioctl(STDOUT_FILENO, TIOCGWINSZ, &ws) == 0 && ws.ws_col > 0) {
+		width = ws.ws_col;
+		height = ws.ws_row;
+	}
+	size_t longest = 0;
+	for (int i = 0; i < c->count; i++) {
+		size_t len = strlen(c->items[i].name) + c->items[i].dir;
+		if (len > longest) {
+			longest = len;
+		}
+	}
+	int colwidth = longest + 2;
+	int cols = width / colwidth > 0 ? width / colwidth : 1;
+	int rows = (c->count + cols - 1) / cols;
+	int shown = rows;
+	if (shown > height - 2) {
+		shown = height > 3 ? height - 3 : 1; // room for the line and a note
+	}
+	term_append("\r\n", 2);
+	for (int r = 0; r < shown; r++) {
+		// down the columns, like ls
+		for (int k = 0; k < cols; k++) {
+			int i = k * rows + r;
+			if (i >= c->count) {
+				break;
+			}
+			const char *name = c->items[i].name;
+			size_t len = strlen(name);
+			term_append(name, len);
+			if (c->items[i].dir) {
+				term_append("/", 1);
+			}
+			for (int pad = len + c->items[i].dir; pad < colwidth && k + 1 < cols &&
+					(k + 1) * rows + r < c->count; pad++) {
+				term_append(" ", 1);
+			}
+		}
+		term_append("\033[K\r\n", 5);
+	}
+	int lines = shown;
+	if (shown < rows) {
+		char note[64];
+		int n = snprintf(note, sizeof(note), "... %d more\033[K\r\n", (rows - shown) * cols);
+		term_append(note, n);
+		lines++;
+	}
+	term_append("\033[J", 3); // a longer list from before
+	int prompt_len;
+	const char *prompt = prompt_text(&prompt_len);
+	term_csi(lines + 1, 'A');
+	term_append("\r", 1);
+	int col = visible_width(prompt, prompt_len) + drawn.cursor;
+	if (col > 0) {
+		term_csi(col, 'C');
+	}
+	term_flush();
+}
 
+static void complete_line(editline *line)
+{
+	static completion c = { NULL, 0, 0, 0, 0 };
+	int start = line->pos;
+	while (start > 0 && !is_word_break(line->buf, start - 1)) {
+		start--;
+	}
+	// a command is expected at the start and after an operator
+	parse_cached(line->buf, line->len);
+	bool command = true;
+	// the command the word is an argument of and the arguments before it
+	char **words = memalloc(sizeof(char *) * (parsed.num_spans + 3));
+	int num_words = 1;
+	for (int i = 0; i < parsed.num_spans; i++) {
+		span *sp = &parsed.spans[i];
+		if (sp->start >= start) {
+			if (sp->start == start) {
+				command = sp->kind == SPAN_COMMAND;
+			}
+			break;
+		}
+		command = sp->kind == SPAN_OPERATOR;
+		if (sp->kind == SPAN_COMMAND || sp->kind == SPAN_OPERATOR) {
+			num_words = 1;
+		}
+		if (sp->kind == SPAN_COMMAND || (sp->kind == SPAN_ARG && num_words > 1)) {
+			words[num_words++] = (char *) sp->word;
+		}
+	}
+	// match against the word as the parser would read it
+	char *word = memalloc(line->pos - start + 1);
+	size_t len = 0;
+	for (int i = start; i < line->pos; i++) {
+		if (line->buf[i] == '\\' && i + 1 < line->pos) {
+			word[len++] = line->buf[++i];
+		} else if (line->buf[i] != '\'' && line->buf[i] != '"') {
+			word[len++] = line->buf[i];
+		}
+	}
+	word[len] = '\0';
+	words[num_words] = num_words > 1 ? word : NULL;
+	words[num_words + 1] = NULL;
+	complete_word(word, len, command, words, &c);
+	free(words);
+	free(word);
+	if (c.count == 0) {
+		term_append("\a", 1);
+		term_flush();
+	} else if (c.fuzzy && c.count == 1) {
+		// the typed part after the last slash is replaced
+		int from = line->pos;
+		while (from > start && line->buf[from - 1] != '/') {
+			from--;
+		}
+		line_delete(line, from, line->pos - from);
+		insert_escaped(line, c.items[0].name, strlen(c.items[0].name));
+		line_insert(line, c.items[0].dir ? "/" : " ", 1);
+	} else if (c.count == 1) {
+		const char *name = c.items[0].name;
+		insert_escaped(line, name + c.base, strlen(name) - c.base);
+		line_insert(line, c.items[0].dir ? "/" : " ", 1);
+	} else if (c.common > c.base) {
+		insert_escaped(line, c.items[0].name + c.base, c.common - c.base);
+	} else {
+		render(line);
+		show_candidates(&c);
 	}
-	cmdv[num_arg] = NULL;
-	free(cmds);
-	return cmdv;
 }
 
-// continously prompt for command and execute it
-void command_loop(char **paths)
+char *readline(void)
 {
-	char *line;
-	char **args;
-	int status = 1;
+	editline line = { memalloc(RL_BUFSIZE), 0, RL_BUFSIZE, 0, NULL, 0 };
+	static isearch search;
+	line.buf[0] = '\0';
+	view_reset();
+	term_append("\033[?2004h", 8); // enable bracketed paste
+	term_flush();
 
-	while (status) {
-		/* Get current time */
-		time_t t = time(NULL);
-		struct tm *current_time = localtime(&t);
-		char timestr[256];
-		/* Format time string */
-		if (strftime(timestr, sizeof(timestr), "[%H:%M:%S]", current_time) == 0) {
-			return;
+	while (1) {
+		if (!input_pending()) {
+			render(&line);
+			wait_input(&line);
 		}
-		char cwd[PATH_MAX];
-		/* Get current working directory */
-		if (getcwd(cwd, PATH_MAX) == NULL) {
-			return;
+		int c = getbyte(); // read a character
+		if (search.active && search_key(&line, &search, c)) {
+			continue;
 		}
-		char *home = getenv("HOME");
-		size_t home_len = strlen(home);
 
-		int i = 0, j = 0;
-		/* Check if cwd starts with home */
-		if (home && strncmp(cwd, home, home_len) == 0) {
-			cwd[j++] = '~';
-			i += home_len;
-		}
-		while (cwd[i] != '\0') {
-			cwd[j++] = cwd[i++];
+		// check each character user has input
+		switch (c) {
+			case 9: // tab
+				complete_line(&line);
+				break;
+			case 18: // Ctrl-R
+				search_start(&line, &search);
+				break;
+			case 10: // enter/new line feed
+			case 13:
+				if (line.len == 0) {
+					term_append("\033[?2004l", 8);
+					term_flush();
+					free(line.buf);
+					return NULL;
+				}
+				// check if command includes !!, show the expanded line first
+				if (expand_bang(&line)) {
+					break;
+				}
+				line.pos = line.len;
+				render(&line);
+				term_append("\033[J\033[?2004l\n", 12); // clear a completion list, give space for response
+				term_flush();
+				return line.buf;
+			case 127: // backspace
+				if (line.pos >= 1) {
+					line_delete(&line, line.pos - 1, 1);
+				}
+				break;
+			case 27: { // escape sequences, arrow keys are ESC [ A-D
+				if (getbyte() != '[') {
+					break;
+				}
+				int param;
+				int key = read_csi(&param);
+				if (key == 'A') { // up
+					// fill prompt with previous command in history
+					size_t len;
+					const char *last_command = read_command(1, &len);
+					if (last_command != NULL) {
+						line_set(&line, last_command, len);
+					}
+				} else if (key == 'B') { // down
+					size_t len;
+					const char *last_command = read_command(0, &len);
+					if (last_command != NULL) {
+						line_set(&line, last_command, len);
+					}
+				} else if (key == 'C') { // right
+					if (line.pos < line.len) {
+						line.pos++;
+					}
+				} else if (key == 'D') { // left
+					if (line.pos >= 1) {
+						line.pos--;
+					}
+				} else if (key == '~' && param == 200) {
+					read_paste(&line);
+				}
+				break;
+			}
+			default:
+				if (c > 31 && c < 127) {
+					// take the whole run of plain characters in one insert
+					int start = inpos - 1;
+					while (inpos < inlen && inbuf[inpos] > 31 && inbuf[inpos] < 127) {
+						inpos++;
+					}
+					line_insert(&line, (char *) &inbuf[start], inpos - start);
+				}
 		}
-		cwd[j] = '\0';
+	}
+}
 
-		/* Blue time string, pink time, teal arrow */
-		printf("\033[34m%s\033[m \033[35m[%s] \033[36m>\033[m ", timestr, cwd);
-		fflush(stdout);
+// continously prompt for command and execute it
+void command_loop(void)
+{
+	char *line;
+	int status = 1;
+
+	while (status) {
+		job_notify();
+		cmdcache_revalidate();
+		dircache_expire();
+		prompt_refresh();
+		int prompt_len;
+		const char *prompt = prompt_text(&prompt_len);
+		term_append(prompt, prompt_len);
+		term_flush();
+		prompt_async(); // after the prompt is up, keys are accepted meanwhile
 
 		cmd_count = 0; // upward arrow key resets command count
-		line = readline(paths);
+		line = readline();
 		if (line == NULL) {
 			printf("\n");
 			continue;
 		}
 		save_command_history(line);
-		bool has_pipe = false;
-		for (int i = 0; line[i] != '\0'; i++) {
-			if (line[i] == '|') {
-				has_pipe = true;
-				break;
-			}
-		}
-		if (has_pipe) {
-			char ***pipe_args = pipe_argsplit(line);
-			status = execute_pipe(pipe_args);
-			while (*pipe_args != NULL) {
-				free(*pipe_args);
-				pipe_args++;
-			}
-		} else {
-			args = argsplit(line);
-			args = modifyargs(args);
-			status = execute(args, STDOUT_FILENO, OPT_FGJ);
-			free(args);
-		}
+		runrec rec;
+		runlog_begin(&rec);
+		cmdlist *list = take_parsed(line);
+		status = execute_list(list);
+		runlog_end(&rec, line);
+		prompt_finished(last_status, runlog_duration(&rec));
+		arena_reset();
 		free(line);
 	};
 }
@@ -520,14 +1012,35 @@ int main(int argc, char **argv)
 	signal(SIGINT, quit_sig);
 	signal(SIGTERM, quit_sig);
 	signal(SIGQUIT, quit_sig);
+	signal(SIGTTOU, SIG_IGN); // taking the terminal back from a pipeline
+	signal(SIGTTIN, SIG_IGN);
+	signal(SIGTSTP, SIG_IGN); // ^Z stops the foreground job, not the shell
+	job_init();
+	signal(SIGPIPE, SIG_IGN); // builtins writing into a pipe whose reader quit
+	// jobs get process groups and the terminal only when the shell owns it
+	job_control = argc == 1 && isatty(STDIN_FILENO) &&
+		tcgetpgrp(STDIN_FILENO) == getpgrp();
+	if (argc > 1) {
+		// 90s file [args] runs the file and exits with its status
+		cmdcache_init();
+		alias_init(); // the same aliases as an interactive shell starts with
+		script_file(argv[1], argv + 2, argc - 2);
+		return last_status;
+	}
 	check_history_file();
-	char **paths = setup_path_variable();
+	runlog_open();
+	cmdcache_init();
+	alias_init();
+	char *rc = config_path(RCFILE);
+	if (access(rc, R_OK) == 0 && script_file(rc, NULL, 0) == 0) {
+		return last_status; // it ran exit
+	}
+	free(rc);
 	change_terminal_attribute(1); // turn off echoing and disabling getchar requires pressing enter key to return
 
-	command_loop(paths);
+	command_loop();
 
 	// cleanup
-	free(paths);
 	change_terminal_attribute(0); // change back to default settings
 	return EXIT_SUCCESS;
 }   
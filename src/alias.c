@@ -0,0 +1,235 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdbool.h>
+
+#include "alias.h"
+#include "hash.h"
+#include "output.h"
+#include "90s.h"
+
+/*
+ * Aliases by name. The parser looks a command word up once and parses
+ * the value in its place, so running and highlighting both see the
+ * expanded command. The colored output of ls, diff and grep is done with
+ * aliases defined at startup which unalias can take away.
+ */
+static htable aliases;
+static bool aliases_ready = false;
+
+static void set_alias(const char *name, size_t len, const char *value)
+{
+    aliasdef *a = ht_get(&aliases, name, len);
+    if (a == NULL) {
+        a = memalloc(sizeof(aliasdef));
+        a->name = memalloc(len + 1);
+        memcpy(a->name, name, len);
+        a->name[len] = '\0';
+        a->active = false;
+        ht_put(&aliases, a->name, len, a);
+    } else {
+        free(a->value);
+    }
+    a->value = memalloc(strlen(value) + 1);
+    strcpy(a->value, value);
+}
+
+void alias_init(void)
+{
+    static const char *colored[] = { "ls", "diff", "grep" };
+    ht_init(&aliases, 32);
+    aliases_ready = true;
+    for (size_t i = 0; i < sizeof(colored) / sizeof(char *); i++) {
+        char value[32];
+        snprintf(value, sizeof(value), "%s --color=auto", colored[i]);
+        set_alias(colored[i], strlen(colored[i]), value);
+    }
+}
+
+/*
+ * While recording, the names the parser looks up are kept so a cache of
+ * parsed text can tell whether it depends on an alias that changed.
+ * They come back NUL separated in the order they were first looked up.
+ */
+static bool recording = false;
+static htable looked_up;
+static char *names = NULL;
+static size_t names_len = 0, names_cap = 0;
+
+void alias_record(void)
+{
+    ht_init(&looked_up, 64);
+    names_len = 0;
+    recording = true;
+}
+
+const char *alias_recorded(size_t *len)
+{
+    for (size_t i = 0; i < looked_up.cap; i++) {
+        free((char *) looked_up.slots[i].key);
+    }
+    ht_free(&looked_up);
+    recording = false;
+    *len = names_len;
+    return names;
+}
+
+static void remember(const char *name, size_t len)
+{
+    if (ht_get(&looked_up, name, len) != NULL) {
+        return;
+    }
+    if (names_len + len + 1 > names_cap) {
+        names_cap = (names_len + len + 1) * 2;
+        names = realloc(names, names_cap);
+        if (!names) {
+            fprintf(stderr, "90s: Error allocating memory\n");
+            exit(EXIT_FAILURE);
+        }
+    }
+    memcpy(names + names_len, name, len + 1);
+    names_len += len + 1;
+    char *key = memalloc(len + 1);
+    memcpy(key, name, len + 1);
+    ht_put(&looked_up, key, len, key);
+}
+
+// what the NUL separated names stand for now, same value same aliases
+unsigned long alias_digest(const char *list, size_t len)
+{
+    unsigned long digest = 0;
+    for (size_t i = 0; i < len; i += strlen(list + i) + 1) {
+        size_t n = strlen(list + i);
+        aliasdef *a = aliases_ready ? ht_get(&aliases, list + i, n) : NULL;
+        digest = digest * 31 + strhash(list + i, n);
+        if (a != NULL) {
+            digest = digest * 31 + strhash(a->value, strlen(a->value)) + 1;
+        }
+    }
+    return digest;
+}
+
+aliasdef *alias_find(const char *name)
+{
+    size_t len = strlen(name);
+    if (recording) {
+        remember(name, len);
+    }
+    return aliases_ready ? ht_get(&aliases, name, len) : NULL;
+}
+
+// in a form that can be sourced again
+static void print_alias(aliasdef *a)
+{
+    out_printf("alias %s='", a->name);
+    for (const char *p = a->value; *p != '\0'; p++) {
+        if (*p == '\'') {
+            out_printf("'\\''");
+        } else {
+            out_write(p, 1);
+        }
+    }
+    out_printf("'\n");
+}
+
+static int cmp_alias(const void *a, const void *b)
+{
+    return strcmp((*(aliasdef **) a)->name, (*(aliasdef **) b)->name);
+}
+
+static bool valid_name(const char *name, size_t len)
+{
+    if (len == 0) {
+        return false;
+    }
+    for (size_t i = 0; i < len; i++) {
+        if (strchr(" \t\n/|&;<>()'\"\\$`=", name[i]) != NULL) {
+            return false;
+        }
+    }
+    return true;
+}
+
+/*
+ * alias name=value... defines, alias name... shows and alias alone lists
+ * every alias sorted by name
+ */
+int alias_define(char **args)
+{
+    if (!aliases_ready) {
+        alias_init();
+    }
+    if (args[1] == NULL) {
+        aliasdef **all = memalloc(sizeof(aliasdef *) * (aliases.count + 1));
+        size_t n = 0;
+        for (size_t i = 0; i < aliases.cap; i++) {
+            if (aliases.slots[i].key != NULL) {
+                all[n++] = aliases.slots[i].val;
+            }
+        }
+        qsort(all, n, sizeof(aliasdef *), cmp_alias);
+        for (size_t i = 0; i < n; i++) {
+            print_alias(all[i]);
+        }
+        free(all);
+        return 1;
+    }
+    int ret = 1;
+    for (int i = 1; args[i] != NULL; i++) {
+        char *eq = strchr(args[i], '=');
+        size_t len = eq != NULL ? (size_t) (eq - args[i]) : strlen(args[i]);
+        if (eq == NULL) {
+            aliasdef *a = alias_find(args[i]);
+            if (a == NULL) {
+                fprintf(stderr, "90s: alias: %s: not found\n", args[i]);
+                ret = -1;
+            } else {
+                print_alias(a);
+            }
+        } else if (!valid_name(args[i], len)) {
+            fprintf(stderr, "90s: alias: %.*s: invalid alias name\n", (int) len, args[i]);
+            ret = -1;
+        } else {
+            set_alias(args[i], len, eq + 1);
+        }
+    }
+    return ret;
+}
+
+// unalias name..., unalias -a removes every alias
+int alias_remove(char **args)
+{
+    if (!aliases_ready) {
+        alias_init();
+    }
+    if (args[1] == NULL) {
+        fprintf(stderr, "90s: unalias: usage: unalias [-a] name...\n");
+        return -1;
+    }
+    if (strcmp(args[1], "-a") == 0) {
+        for (size_t i = 0; i < aliases.cap; i++) {
+            aliasdef *a = aliases.slots[i].val;
+            if (aliases.slots[i].key != NULL) {
+                free(a->name);
+                free(a->value);
+                free(a);
+            }
+        }
+        ht_clear(&aliases);
+        return 1;
+    }
+    int ret = 1;
+    for (int i = 1; args[i] != NULL; i++) {
+        aliasdef *a = alias_find(args[i]);
+        if (a == NULL) {
+            fprintf(stderr, "90s: unalias: %s: not found\n", args[i]);
+            ret = -1;
+            continue;
+        }
+        ht_del(&aliases, a->name, strlen(a->name));
+        free(a->name);
+        free(a->value);
+        free(a);
+    }
+    return ret;
+}
@@ -0,0 +1,87 @@
+/* generated by tools/mkbuiltins from tools/builtins.def, do not edit */
+#include <stdint.h>
+#include <string.h>
+
+#include "builtins.h"
+
+int true_status(char **args);
+int test(char **args);
+int alias(char **args);
+int bg(char **args);
+int cd(char **args);
+int complete(char **args);
+int echo(char **args);
+int quit(char **args);
+int export(char **args);
+int false_status(char **args);
+int fg(char **args);
+int hash(char **args);
+int help(char **args);
+int history(char **args);
+int j(char **args);
+int jobs(char **args);
+int kill_jobs(char **args);
+int runlog(char **args);
+int set(char **args);
+int shift(char **args);
+int source(char **args);
+int unalias(char **args);
+int unset(char **args);
+int wait_jobs(char **args);
+
+/* sorted by name */
+const builtin builtin_list[] = {
+    { ":", true_status, 0 },
+    { "[", test, 0 },
+    { "alias", alias, 0 },
+    { "bg", bg, 0 },
+    { "cd", cd, 0 },
+    { "complete", complete, 0 },
+    { "echo", echo, BUILTIN_PRINTS },
+    { "exit", quit, 0 },
+    { "export", export, 0 },
+    { "false", false_status, 0 },
+    { "fg", fg, 0 },
+    { "hash", hash, BUILTIN_PRINTS },
+    { "help", help, BUILTIN_PRINTS },
+    { "history", history, BUILTIN_PRINTS },
+    { "j", j, 0 },
+    { "jobs", jobs, BUILTIN_PRINTS },
+    { "kill", kill_jobs, 0 },
+    { "rehash", hash, 0 },
+    { "runlog", runlog, BUILTIN_PRINTS },
+    { "set", set, 0 },
+    { "shift", shift, 0 },
+    { "source", source, 0 },
+    { "test", test, 0 },
+    { "true", true_status, 0 },
+    { "unalias", unalias, 0 },
+    { "unset", unset, 0 },
+    { "wait", wait_jobs, 0 },
+};
+
+const int builtin_count = 27;
+
+/* slot of each name, -1 for none */
+static const signed char slots[64] = {
+    9, 12, -1, -1, -1, 23, 8, 21, -1, -1, 6, -1, -1, 20, -1, -1,
+    17, -1, 7, 24, -1, -1, -1, -1, 14, 11, 3, 1, -1, 19, -1, -1,
+    -1, 15, -1, -1, 10, -1, -1, -1, 0, 18, -1, 5, -1, 25, -1, 4,
+    -1, -1, -1, 13, -1, 26, 16, -1, -1, 2, -1, -1, -1, 22, -1, -1,
+};
+
+static uint32_t name_hash(const char *s)
+{
+    uint32_t h = 2166136261u ^ 115u;
+    for (; *s != '\0'; s++) {
+        h ^= (unsigned char) *s;
+        h *= 16777619u;
+    }
+    return h ^ (h >> 16);
+}
+
+const builtin *builtin_find(const char *name)
+{
+    int i = slots[name_hash(name) & 63];
+    return i != -1 && strcmp(builtin_list[i].name, name) == 0 ? &builtin_list[i] : NULL;
+}
@@ -0,0 +1,207 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdbool.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <dirent.h>
+#include <sys/stat.h>
+
+#include "cmdcache.h"
+#include "hash.h"
+#include "output.h"
+#include "90s.h"
+
+/*
+ * Hash of every executable reachable through $PATH, so highlighting and
+ * launching never have to walk PATH with access(). Each PATH directory is
+ * listed once and its mtime remembered, a changed mtime triggers a rescan.
+ */
+typedef struct pathdir {
+    char *path;
+    bool exists;
+    struct timespec mtime;
+} pathdir;
+
+static pathdir *dirs = NULL;
+static int num_dirs = 0;
+static char *path_storage = NULL;
+static htable commands; /* name -> full path, key points into the value */
+static const char **sorted = NULL; /* names in order, built when first asked for */
+static size_t num_sorted = 0;
+static bool sorted_valid = false;
+
+static char **setup_path_variable(char **storage)
+{
+    char *envpath = getenv("PATH");
+    if (envpath == NULL) {
+        fprintf(stderr, "90s: PATH environment variable is missing\n");
+        exit(EXIT_FAILURE);
+    }
+    char *path = memalloc(strlen(envpath) + 1);
+    strcpy(path, envpath);
+    int path_count = 2; // one for last element and one for terminator
+    for (char *p = path; *p != '\0'; p++) {
+        // count number of : to count number of elements
+        if (*p == ':') {
+            path_count++;
+        }
+    }
+    char **paths = memalloc(sizeof(char *) * path_count);
+    char *token = strtok(path, ":");
+    int counter = 0;
+    while (token != NULL) {
+        paths[counter] = token; // set element to the pointer of start of path
+        token = strtok(NULL, ":");
+        counter++;
+    }
+    paths[counter] = NULL;
+    *storage = path;
+    return paths;
+}
+
+static void drop_commands(void)
+{
+    for (size_t i = 0; i < commands.cap; i++) {
+        if (commands.slots[i].key != NULL) {
+            free(commands.slots[i].val);
+        }
+    }
+    ht_clear(&commands);
+}
+
+static void scan_dir(pathdir *dir)
+{
+    struct stat st;
+    dir->exists = false;
+    int dfd = open(dir->path, O_RDONLY | O_DIRECTORY);
+    if (dfd == -1) {
+        return;
+    }
+    if (fstat(dfd, &st) == -1) {
+        close(dfd);
+        return;
+    }
+    dir->exists = true;
+    dir->mtime = st.st_mtim;
+    DIR *dp = fdopendir(dfd);
+    if (dp == NULL) {
+        close(dfd);
+        return;
+    }
+    size_t dirlen = strlen(dir->path);
+    struct dirent *ent;
+    while ((ent = readdir(dp)) != NULL) {
+        if (ent->d_name[0] == '.' || ent->d_type == DT_DIR) {
+            continue;
+        }
+        if (ent->d_type == DT_UNKNOWN) {
+            if (fstatat(dfd, ent->d_name, &st, 0) == -1 || S_ISDIR(st.st_mode)) {
+                continue;
+            }
+        }
+        size_t namelen = strlen(ent->d_name);
+        // earlier PATH entries take precedence
+        if (ht_find(&commands, ent->d_name, namelen) != NULL) {
+            continue;
+        }
+        if (faccessat(dfd, ent->d_name, X_OK, 0) != 0) {
+            continue;
+        }
+        char *full = memalloc(dirlen + namelen + 2);
+        memcpy(full, dir->path, dirlen);
+        full[dirlen] = '/';
+        memcpy(full + dirlen + 1, ent->d_name, namelen + 1);
+        ht_put(&commands, full + dirlen + 1, namelen, full);
+    }
+    closedir(dp);
+}
+
+void cmdcache_rehash(void)
+{
+    drop_commands();
+    sorted_valid = false;
+    for (int i = 0; i < num_dirs; i++) {
+        scan_dir(&dirs[i]);
+    }
+}
+
+void cmdcache_init(void)
+{
+    char *storage;
+    char **paths = setup_path_variable(&storage);
+    if (dirs != NULL) {
+        free(dirs);
+        free(path_storage);
+    } else {
+        ht_init(&commands, 1024);
+    }
+    num_dirs = 0;
+    while (paths[num_dirs] != NULL) {
+        num_dirs++;
+    }
+    dirs = memalloc(sizeof(pathdir) * (num_dirs + 1));
+    for (int i = 0; i < num_dirs; i++) {
+        dirs[i].path = paths[i];
+        dirs[i].exists = false;
+    }
+    path_storage = storage;
+    free(paths);
+    cmdcache_rehash();
+}
+
+/*
+ * Called once per prompt rather than per keystroke, one stat per PATH
+ * directory and a full rescan only when one of them changed
+ */
+void cmdcache_revalidate(void)
+{
+    struct stat st;
+    for (int i = 0; i < num_dirs; i++) {
+        bool exists = stat(dirs[i].path, &st) == 0;
+        if (exists != dirs[i].exists || (exists &&
+                    (st.st_mtim.tv_sec != dirs[i].mtime.tv_sec ||
+                     st.st_mtim.tv_nsec != dirs[i].mtime.tv_nsec))) {
+            cmdcache_rehash();
+            return;
+        }
+    }
+}
+
+const char *cmdcache_lookup(const char *name)
+{
+    return ht_get(&commands, name, strlen(name));
+}
+
+static int cmp_name(const void *a, const void *b)
+{
+    return strcmp(*(const char **) a, *(const char **) b);
+}
+
+// every command name in strcmp order, valid until the next rehash
+const char **cmdcache_names(size_t *count)
+{
+    if (!sorted_valid) {
+        free(sorted);
+        sorted = memalloc(sizeof(char *) * (commands.count + 1));
+        num_sorted = 0;
+        for (size_t i = 0; i < commands.cap; i++) {
+            if (commands.slots[i].key != NULL) {
+                sorted[num_sorted++] = commands.slots[i].key;
+            }
+        }
+        qsort(sorted, num_sorted, sizeof(char *), cmp_name);
+        sorted_valid = true;
+    }
+    *count = num_sorted;
+    return sorted;
+}
+
+void cmdcache_print(void)
+{
+    size_t n;
+    const char **names = cmdcache_names(&n);
+    for (size_t i = 0; i < n; i++) {
+        out_printf("%s=%s\n", names[i], cmdcache_lookup(names[i]));
+    }
+}
@@ -1,19 +1,37 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <limits.h>
 #include <unistd.h>
 #include <stdbool.h>
 #include <errno.h>
+#include <signal.h>
+#include <spawn.h>
+#include <fcntl.h>
 #include <sys/wait.h>
+#include <sys/stat.h>
 
 #include "constants.h"
 #include "history.h"
 #include "90s.h"
 #include "job.h"
+#include "cmdcache.h"
+#include "runlog.h"
+#include "output.h"
+#include "parse.h"
+#include "commands.h"
+#include "prompt.h"
+#include "complete.h"
+#include "alias.h"
+#include "builtins.h"
+#include "frecency.h"
+#include "search.h"
+#include "vars.h"
+#include "script.h"
 
-int execute(char **args);
+extern char **environ;
 
-/* Builtin commands */
+/* Builtin commands, the table of them is generated from tools/builtins.def */
 int cd(char **args);
 int help(char **args);
 int quit(char **args);
@@ -22,40 +40,31 @@ int export(char **args);
 int source(char **args);
 int j(char **args);
 int bg(char **args);
+int fg(char **args);
+int jobs(char **args);
+int wait_jobs(char **args);
+int kill_jobs(char **args);
+int hash(char **args);
+int runlog(char **args);
+int set(char **args);
+int complete(char **args);
+int alias(char **args);
+int unalias(char **args);
+int echo(char **args);
+int test(char **args);
+int true_status(char **args);
+int false_status(char **args);
+int unset(char **args);
+int shift(char **args);
 
-char *builtin_cmds[] = {
-    "cd",
-    "help",
-    "exit",
-    "history",
-    "export",
-    "source",
-    "j",
-    "bg",
-};
-
-int (*builtin_func[]) (char **) = {
-    &cd,
-    &help,
-    &quit, /* Can't name it exit as it is taken */
-    &history,
-    &export,
-    &source,
-    &j,
-    &bg,
-};
+#define STATUS_SET 2 /* returned by builtins that set last_status themselves */
 
-char *shortcut_dirs[] = {
-    "90s",
-    "bin",
-    "localbin",
-};
+bool pipefail = false; /* pipeline fails when any stage fails */
 
-char *shortcut_expand_dirs[] = {
-    "~/.nky/git/90s",
-    "~/.local/bin",
-    "/usr/local/bin",
-};
+static void give_terminal(pid_t pgid);
+bool job_control = false; /* set by main for an interactive shell, off in forked stages */
+static void foreground(job *j);
+static void job_done(job *j);
 
 char *gethome(void)
 {
@@ -75,7 +84,7 @@ char *replace_home_dir(char *str)
     int home_len = strlen(home_path);
 
     // Allocate memory for the new path
-    char* new_path = memalloc(path_len + home_len + 1);
+    char* new_path = arena_alloc(path_len + home_len + 1);
 
     int i = 0, j = 0;
     while (str[i] != '\0') {
@@ -95,29 +104,28 @@ char *replace_home_dir(char *str)
 }
 
 // number of built in commands
-int num_builtins(void) {
-    return sizeof(builtin_cmds) / sizeof(char *);
-}
 
-// autojump
+/*
+ * j fragment... jumps to the most frecent directory matching the
+ * fragments in order, j alone lists the best ones
+ */
 int j(char **args)
 {
     if (args[1] == NULL) {
-        fprintf(stderr, "90s: not enough arguments\n");
+        frecency_print(args + 1, 20);
+        return 1;
+    }
+    char cwd[PATH_MAX];
+    const char *dir = frecency_best(args + 1, getcwd(cwd, sizeof(cwd)));
+    if (dir == NULL) {
+        fprintf(stderr, "90s: j: no directory matches\n");
         return -1;
     }
-    for (int i = 0; i < sizeof(shortcut_dirs) / sizeof(char *); i++) {
-        int len = strlen(shortcut_dirs[i]);
-        if (strncmp(args[1], shortcut_dirs[i], len) == 0) {
-            char **merged_cd = memalloc(sizeof(char *) * 3);
-            merged_cd[0] = "cd";
-            merged_cd[1] = shortcut_expand_dirs[i];
-            merged_cd[2] = NULL;
-            cd(merged_cd);
-            printf("jumped to %s\n", shortcut_expand_dirs[i]);
-            return 1;
-        }
+    char *merged_cd[] = { "cd", (char *) dir, NULL };
+    if (cd(merged_cd) == -1) {
+        return -1;
     }
+    out_printf("jumped to %s\n", dir);
     return 1;
 }
 
@@ -130,7 +138,9 @@ int cd(char **args) {
         char *home = gethome();
         if (chdir(home) != 0) {
             perror("90s");
+            return -1;
         }
+        prompt_invalidate_cwd();
     } else {
         while (args[1][i] != '\0') {
             if (args[1][i] == '~') {
@@ -141,7 +151,13 @@ int cd(char **args) {
         }
         if (chdir(args[1]) != 0) {
             perror("90s");
+            return -1;
         }
+        prompt_invalidate_cwd();
+    }
+    char cwd[PATH_MAX];
+    if (getcwd(cwd, sizeof(cwd)) != NULL) {
+        frecency_visit(cwd);
     }
     return 1;
 }
@@ -151,301 +167,1086 @@ int cd(char **args) {
  */
 int help(char **args)
 {
-    printf("90s %f\n", VERSION);
-    printf("Built in commands:\n");
+    out_printf("90s %f\n", VERSION);
+    out_printf("Built in commands:\n");
 
-    for (int i = 0; i < num_builtins(); i++) {
-        printf("  %s\n", builtin_cmds[i]);
+    for (int i = 0; i < builtin_count; i++) {
+        out_printf("  %s\n", builtin_list[i].name);
     }
 
-    printf("Use 'man' to read manual of programs\n");
-    printf("Licensed under GPL v3\n");
+    out_printf("Use 'man' to read manual of programs\n");
+    out_printf("Licensed under GPL v3\n");
     return 1;
 }
 
+// exit [status], without one the status of the last command is kept
 int quit(char **args)
 {
+    if (args[1] != NULL) {
+        last_status = atoi(args[1]) & 0xff;
+    }
 	/* Exit prompt loop */
     return 0;
 }
 
+/*
+ * history [-u] [-r] [-n count] [-f pattern]
+ * -u only the first occurrence of each command, -r newest first,
+ * -n only the last count commands, -f the count (20) best fuzzy
+ * matches of pattern, best last
+ */
 int history(char **args)
 {
-    char **history = get_all_history(true);
+    size_t last = 0;
+    bool unique = false, reverse = false;
+    const char *pattern = NULL;
 
-    for (int i = 0; history[i] != NULL; ++i) {
-        printf("%s\n", history[i]);
-        free(history[i]);
+    if (histfile_path == NULL) {
+        fprintf(stderr, "90s: history: only in an interactive shell\n");
+        return -1;
     }
-
-    free(history);
+    if (args[1] != NULL && strcmp(args[1], "--index") == 0) {
+        // convert to the indexed format, startup maps the file from now on
+        long lines = history_build_index();
+        if (lines < 0) {
+            perror("90s");
+            return -1;
+        }
+        out_printf("indexed %ld lines\n", lines);
+        return 1;
+    }
+    for (int i = 1; args[i] != NULL; i++) {
+        if (args[i][0] != '-') {
+            fprintf(stderr, "90s: history: invalid argument '%s'\n", args[i]);
+            return -1;
+        }
+        for (char *opt = args[i] + 1; *opt != '\0'; opt++) {
+            if (*opt == 'u') {
+                unique = true;
+            } else if (*opt == 'r') {
+                reverse = true;
+            } else if (*opt == 'n' && args[i + 1] != NULL && atol(args[i + 1]) > 0) {
+                last = atol(args[++i]);
+                break;
+            } else if (*opt == 'f' && args[i + 1] != NULL) {
+                pattern = args[++i];
+                break;
+            } else {
+                fprintf(stderr, "90s: history: usage: history [-u] [-r] [-n count] [-f pattern]\n");
+                return -1;
+            }
+        }
+    }
+    if (pattern != NULL) {
+        size_t max = last > 0 ? last : 20;
+        size_t *ids = arena_alloc(sizeof(size_t) * max);
+        for (size_t n = hist_fuzzy(pattern, strlen(pattern), ids, max); n-- > 0; ) {
+            size_t len;
+            const char *line = hist_entry(ids[n], &len);
+            out_write(line, len);
+            out_write("\n", 1);
+        }
+        return 1;
+    }
+    print_history(last, unique, reverse);
     return 1;
 }
 
+/*
+ * export NAME=VALUE puts a variable in the environment, export NAME
+ * moves a shell variable there
+ */
 int export(char **args)
 {
-	/* Skip the command */
-    args++;
-    while (*args != NULL) {
-        char *variable = strtok(*args, "=\n");
-        char *value = strtok(NULL, "=\n");
-        if (variable != NULL && value != NULL) {
-            if (setenv(variable, value, 1) != 0) {
-                fprintf(stderr, "90s: Error setting environment variable\n");
-                return 0;
-            }
+    for (args++; *args != NULL; args++) {
+        char *eq = strchr(*args, '=');
+        if (eq != NULL && var_assignment(*args)) {
+            *eq = '\0';
+            var_export(*args, eq + 1);
+            *eq = '=';
+        } else if (eq == NULL && var_name(*args, strlen(*args))) {
+            var_export(*args, NULL);
         } else {
             fprintf(stderr, "90s: Syntax error when setting environment variable\nUse \"export VARIABLE=VALUE\"\n");
-            return 0;
+            return -1;
         }
-        args++;
     }
     return 1;
 }
 
+// source file [args], which become $1 $2 ... while it runs
 int source(char **args)
 {
     if (args[1] == NULL) {
         fprintf(stderr, "90s: not enough arguments\n");
         return -1;
     }
-
-    FILE *file = fopen(args[1], "r");
-
-    if (file == NULL) {
-        fprintf(stderr, "90s: no such file or directory '%s'\n", args[1]);
-        return -1;
+    int count = 0;
+    while (args[count + 2] != NULL) {
+        count++;
     }
-
-    char line[RL_BUFSIZE];
-    int status;
-    while (fgets(line, sizeof(line), file) != NULL) {
-        // Remove newline character if present
-        size_t len = strlen(line);
-        if (len > 0 && line[len - 1] == '\n') {
-            line[len - 1] = '\0';
-        }
-
-        char **args = argsplit(line);
-        status = execute(args);
+    if (script_file(args[1], count > 0 ? args + 2 : NULL, count) == 0) {
+        return 0;
     }
+    return STATUS_SET;
+}
 
-    fclose(file);
-    return status; // Indicate success
+static job *find_job(const char *name, const char *spec)
+{
+    job_reap();
+    job *j = job_spec(spec);
+    if (j == NULL) {
+        fprintf(stderr, "90s: %s: %s: no such job\n", name, spec != NULL ? spec : "current");
+    }
+    return j;
 }
 
+/*
+ * Continue a stopped job in the background
+ */
 int bg(char **args)
 {
-    if (args[1] == NULL) {
-        fprintf(stderr, "90s: not enough arguments\n");
+    job *j = find_job("bg", args[1]);
+    if (j == NULL) {
         return -1;
     }
-    int job_index = atoi(args[1]);
-    if (job_index == 0) {
-        fprintf(stderr, "90s: invalid job index\n");
-        return -1;
+    if (j->state == JOB_STOPPED) {
+        j->state = JOB_RUNNING;
+        job_kill(j, SIGCONT);
     }
-    job *search = get_job(job_index - 1);
-    if (search == NULL) {
-        fprintf(stderr, "90s: no such job\n");
+    out_printf("[%d] %s &\n", j->id, j->command);
+    return 1;
+}
+
+/*
+ * Bring a job to the foreground, continuing it if it stopped
+ */
+int fg(char **args)
+{
+    job *j = find_job("fg", args[1]);
+    if (j == NULL) {
         return -1;
     }
-    printf("Job %i: %s\n", job_index, search->command);
-    return 1;
+    out_printf("%s\n", j->command);
+    out_flush();
+    if (job_control) {
+        give_terminal(j->pgid); // which also continues it
+    } else {
+        job_kill(j, SIGCONT);
+    }
+    foreground(j);
+    return STATUS_SET;
 }
 
-bool is_builtin(char *command)
+int jobs(char **args)
 {
-    for (int i = 0; i < num_builtins(); i++) {
-        if (strcmp(command, builtin_cmds[i]) == 0) {
-            return true;
+    job_reap();
+    for (int id = 1; id <= job_max(); id++) {
+        job *j = job_get(id);
+        if (j != NULL) {
+            job_print(j);
         }
     }
-    return false;
+    return 1;
 }
 
-int launch(char **args, int fd, int options)
+/*
+ * wait [%job|pid]..., with nothing waits for every running job. The
+ * status is the last one waited for, 127 when it is not a job.
+ */
+int wait_jobs(char **args)
 {
-    int is_bgj = (options & OPT_BGJ) ? 1 : 0;
-    int redirect_stdout = (options & OPT_STDOUT) ? 1 : 0;
-    int redirect_stdin = (options & OPT_STDIN) ? 1 : 0;
-    int redirect_stderr = (options & OPT_STDERR) ? 1 : 0;
+    job_reap();
+    last_status = 0;
+    if (args[1] == NULL) {
+        for (int id = 1; id <= job_max(); id++) {
+            job *j = job_get(id);
+            if (j != NULL && j->state != JOB_STOPPED && !job_wait(j)) {
+                job_done(j);
+            }
+        }
+        last_status = 0;
+        return STATUS_SET;
+    }
+    for (int i = 1; args[i] != NULL; i++) {
+        job *j = NULL;
+        if (args[i][0] == '%') {
+            j = job_spec(args[i]);
+        } else {
+            pid_t pid = atoi(args[i]);
+            for (int id = 1; id <= job_max() && j == NULL; id++) {
+                job *k = job_get(id);
+                for (int p = 0; k != NULL && p < k->num_pids; p++) {
+                    if (k->pids[p] == pid) {
+                        j = k;
+                    }
+                }
+            }
+        }
+        if (j == NULL) {
+            fprintf(stderr, "90s: wait: %s: no such job\n", args[i]);
+            last_status = 127;
+        } else if (j->state == JOB_STOPPED || job_wait(j)) {
+            last_status = 128 + SIGTSTP;
+        } else {
+            job_done(j);
+        }
+    }
+    return STATUS_SET;
+}
 
-    pid_t pid;
+static const struct {
+    const char *name;
+    int sig;
+} signals[] = {
+    { "HUP", SIGHUP }, { "INT", SIGINT }, { "QUIT", SIGQUIT }, { "KILL", SIGKILL },
+    { "USR1", SIGUSR1 }, { "USR2", SIGUSR2 }, { "PIPE", SIGPIPE }, { "ALRM", SIGALRM },
+    { "TERM", SIGTERM }, { "CHLD", SIGCHLD }, { "CONT", SIGCONT }, { "STOP", SIGSTOP },
+    { "TSTP", SIGTSTP }, { "TTIN", SIGTTIN }, { "TTOU", SIGTTOU }, { "WINCH", SIGWINCH },
+};
 
-    int status;
-    if ((pid = fork()) == 0) {
-        // Child process
-        if (fd > 2) {
-            // not stdin, stdout, or stderr
-            if (redirect_stdout) {
-                if (dup2(fd, STDOUT_FILENO) == -1) {
-                    perror("90s");
-                }
+static int signal_number(const char *name)
+{
+    char *end;
+    long sig = strtol(name, &end, 10);
+    if (end != name && *end == '\0') {
+        return sig >= 0 && sig < NSIG ? sig : -1;
+    }
+    if (strncmp(name, "SIG", 3) == 0) {
+        name += 3;
+    }
+    for (size_t i = 0; i < sizeof(signals) / sizeof(signals[0]); i++) {
+        if (strcmp(name, signals[i].name) == 0) {
+            return signals[i].sig;
+        }
+    }
+    return -1;
+}
+
+/*
+ * kill [-SIG|-s SIG] %job|pid..., a job gets the signal as a whole
+ * process group, a stopped one is continued so it sees it. kill -l lists
+ * the signal names.
+ */
+int kill_jobs(char **args)
+{
+    int sig = SIGTERM, i = 1;
+    if (args[1] != NULL && strcmp(args[1], "-l") == 0) {
+        for (size_t k = 0; k < sizeof(signals) / sizeof(signals[0]); k++) {
+            out_printf("%2d %s\n", signals[k].sig, signals[k].name);
+        }
+        return 1;
+    }
+    if (args[1] != NULL && strcmp(args[1], "-s") == 0 && args[2] != NULL) {
+        sig = signal_number(args[2]);
+        i = 3;
+    } else if (args[1] != NULL && args[1][0] == '-' && args[1][1] != '\0') {
+        sig = signal_number(args[1] + 1);
+        i = 2;
+    }
+    if (sig == -1 || args[i] == NULL) {
+        fprintf(stderr, "90s: kill: usage: kill [-SIG|-s SIG] %%job|pid...\n");
+        return -1;
+    }
+    int ret = 1;
+    for (; args[i] != NULL; i++) {
+        int err = 0;
+        if (args[i][0] == '%') {
+            job *j = find_job("kill", args[i]);
+            if (j == NULL) {
+                ret = -1;
+                continue;
             }
-            if (redirect_stdin) {
-                if (dup2(fd, STDIN_FILENO) == -1) {
-                    perror("90s");
-                }
+            if (job_kill(j, sig) == -1) {
+                err = errno;
+            } else if (j->state == JOB_STOPPED && (sig == SIGTERM || sig == SIGHUP)) {
+                job_kill(j, SIGCONT);
             }
-            if (redirect_stderr) {
-                if (dup2(fd, STDERR_FILENO) == -1) {
-                    perror("90s");
-                }
+        } else {
+            char *end;
+            long pid = strtol(args[i], &end, 10);
+            if (end == args[i] || *end != '\0') {
+                err = EINVAL;
+            } else if (kill(pid, sig) == -1) {
+                err = errno;
             }
-            close(fd); // close fd as it is duplicated already
         }
-        if (execvp(args[0], args) == -1) {
-            if (errno == ENOENT) {
-                fprintf(stderr, "90s: command not found: %s\n", args[0]);
+        if (err != 0) {
+            fprintf(stderr, "90s: kill: %s: %s\n", args[i], strerror(err));
+            ret = -1;
+        }
+    }
+    return ret;
+}
+
+/*
+ * List cached commands, or forget them and rescan PATH with -r/rehash
+ */
+int hash(char **args)
+{
+    if (strcmp(args[0], "rehash") == 0 || (args[1] != NULL && strcmp(args[1], "-r") == 0)) {
+        cmdcache_rehash();
+        return 1;
+    }
+    if (args[1] != NULL) {
+        int ret = 1;
+        for (int i = 1; args[i] != NULL; i++) {
+            const char *path = cmdcache_lookup(args[i]);
+            if (path == NULL) {
+                fprintf(stderr, "90s: hash: %s: not found\n", args[i]);
+                ret = -1;
+            } else {
+                out_printf("%s=%s\n", args[i], path);
             }
         }
-        exit(EXIT_FAILURE); // exit the child
-    } else if (pid < 0) {
-        perror("fork failed");
-    } else {
-        // Parent process
-        if (is_bgj) {
-            int job_index = add_job(pid, args[0], true);
-            printf("[Job: %i] [Process ID: %i] [Command: %s]\n", job_index + 1, pid, args[0]);
-            return 1;
-        } else {
-            do {
-                waitpid(pid, &status, WUNTRACED); // wait child to be exited to return to prompt
-            } while (!WIFEXITED(status) && !WIFSIGNALED(status));
+        return ret;
+    }
+    cmdcache_print();
+    return 1;
+}
+
+int runlog(char **args)
+{
+    return runlog_report(args);
+}
+
+int complete(char **args)
+{
+    return complete_spec(args);
+}
+
+int alias(char **args)
+{
+    return alias_define(args);
+}
+
+int unalias(char **args)
+{
+    return alias_remove(args);
+}
+
+/*
+ * set -o option to enable, set +o option to disable, set -o lists them
+ */
+int set(char **args)
+{
+    if (args[1] == NULL || args[2] == NULL) {
+        out_printf("pipefail\t%s\n", pipefail ? "on" : "off");
+        return 1;
+    }
+    bool enable = strcmp(args[1], "-o") == 0;
+    if ((!enable && strcmp(args[1], "+o") != 0) || strcmp(args[2], "pipefail") != 0) {
+        fprintf(stderr, "90s: set: usage: set [-o|+o] pipefail\n");
+        return -1;
+    }
+    pipefail = enable;
+    return 1;
+}
+
+// echo [-n] args
+int echo(char **args)
+{
+    bool newline = true;
+    args++;
+    if (*args != NULL && strcmp(*args, "-n") == 0) {
+        newline = false;
+        args++;
+    }
+    for (; *args != NULL; args++) {
+        out_write(*args, strlen(*args));
+        if (args[1] != NULL) {
+            out_write(" ", 1);
         }
     }
+    if (newline) {
+        out_write("\n", 1);
+    }
     return 1;
 }
-// execute built in commands or launch commands and wait it to terminate, return 1 to keep shell running
-int execute(char **args)
+
+// 0 when a unary test holds, 1 when it does not, 2 for an unknown operator
+static int test_unary(const char *op, const char *arg)
 {
-    if (args[0] == NULL) { // An empty command was entered.
+    struct stat st;
+    if (strcmp(op, "-z") == 0) {
+        return *arg != '\0';
+    } else if (strcmp(op, "-n") == 0) {
+        return *arg == '\0';
+    } else if (strcmp(op, "-L") == 0 || strcmp(op, "-h") == 0) {
+        return !(lstat(arg, &st) == 0 && S_ISLNK(st.st_mode));
+    } else if (strcmp(op, "-r") == 0 || strcmp(op, "-w") == 0 || strcmp(op, "-x") == 0) {
+        return access(arg, op[1] == 'r' ? R_OK : op[1] == 'w' ? W_OK : X_OK) != 0;
+    } else if (strlen(op) != 2 || strchr("efds", op[1]) == NULL || op[0] != '-') {
+        return 2;
+    } else if (stat(arg, &st) != 0) {
         return 1;
     }
-    
-    // prioritize builtin commands
-    for (int i = 0; i < num_builtins(); i++) {
-        if (strcmp(args[0], builtin_cmds[i]) == 0) {
-            return (*builtin_func[i])(args);
+    switch (op[1]) {
+    case 'f':
+        return !S_ISREG(st.st_mode);
+    case 'd':
+        return !S_ISDIR(st.st_mode);
+    case 's':
+        return st.st_size == 0;
+    }
+    return 0;
+}
+
+static int test_binary(const char *a, const char *op, const char *b)
+{
+    static const char *ops[] = { "-eq", "-ne", "-lt", "-le", "-gt", "-ge" };
+    if (strcmp(op, "=") == 0 || strcmp(op, "==") == 0) {
+        return strcmp(a, b) != 0;
+    } else if (strcmp(op, "!=") == 0) {
+        return strcmp(a, b) == 0;
+    }
+    for (int i = 0; i < 6; i++) {
+        if (strcmp(op, ops[i]) != 0) {
+            continue;
+        }
+        char *end_a, *end_b;
+        long x = strtol(a, &end_a, 10), y = strtol(b, &end_b, 10);
+        if (*a == '\0' || *end_a != '\0' || *b == '\0' || *end_b != '\0') {
+            return 2;
         }
+        bool holds[] = { x == y, x != y, x < y, x <= y, x > y, x >= y };
+        return !holds[i];
     }
-    int num_arg = 0;
+    return 2;
+}
 
-    while (args[num_arg] != NULL) {
-        if (strncmp(args[num_arg], "&", 1) == 0) {
-            args[num_arg] = NULL;
-            if (args[num_arg + 1] != NULL) {
-                // have commands after &
-                execute(&args[num_arg + 1]);
-            }
-            launch(args, STDOUT_FILENO, OPT_BGJ);
-            return 1;
+static int test_args(char **args, int n)
+{
+    if (n > 1 && strcmp(args[0], "!") == 0) {
+        int status = test_args(args + 1, n - 1);
+        return status == 2 ? 2 : !status;
+    }
+    switch (n) {
+    case 0:
+        return 1;
+    case 1:
+        return *args[0] == '\0';
+    case 2:
+        return test_unary(args[0], args[1]);
+    case 3:
+        return test_binary(args[0], args[1], args[2]);
+    }
+    return 2;
+}
+
+/*
+ * test expression or [ expression ]: -z -n = != for strings, -eq -ne
+ * -lt -le -gt -ge for integers, -e -f -d -s -r -w -x -L for files and !
+ * in front of any of them. The status is 2 for a bad expression.
+ */
+int test(char **args)
+{
+    int n = 0;
+    while (args[n + 1] != NULL) {
+        n++;
+    }
+    if (strcmp(args[0], "[") == 0) {
+        if (n == 0 || strcmp(args[n], "]") != 0) {
+            fprintf(stderr, "90s: [: missing ]\n");
+            last_status = 2;
+            return STATUS_SET;
         }
-        if (strncmp(args[num_arg], ">", 1) == 0) {
-            int fd = fileno(fopen(args[num_arg + 1], "w+"));
-            if (fd == -1) {
-                perror("90s");
-                return 1;
-            }
-            args[num_arg] = NULL;
-            int asdf = 0;
-            while (args[asdf] != NULL) {
-                fprintf(stderr, "args[%i]: %s\n", asdf, args[asdf]);
-                asdf++;
-            }
+        n--;
+    }
+    last_status = test_args(args + 1, n);
+    if (last_status == 2) {
+        fprintf(stderr, "90s: %s: bad expression\n", args[0]);
+    }
+    return STATUS_SET;
+}
+
+int true_status(char **args)
+{
+    return 1;
+}
+
+int false_status(char **args)
+{
+    return -1;
+}
+
+int unset(char **args)
+{
+    for (args++; *args != NULL; args++) {
+        var_unset(*args);
+    }
+    return 1;
+}
 
-            return launch(args, fd, OPT_FGJ | OPT_STDOUT);
+// shift [n] drops the first n positional parameters
+int shift(char **args)
+{
+    int n = args[1] != NULL ? atoi(args[1]) : 1;
+    if (!params_shift(n)) {
+        fprintf(stderr, "90s: shift: count out of range\n");
+        return -1;
+    }
+    return 1;
+}
+
+/*
+ * Start a program with posix_spawn, which does not copy the shell's page
+ * tables the way fork does, so its cost does not grow with the size of
+ * the shell. The executable comes from the PATH cache, redirections are
+ * file actions. pgid is the process group to join, 0 for a new one and
+ * -1 to stay in the shell's. Returns the pid or -1 when it could not be
+ * started.
+ */
+pid_t spawn(char **args, posix_spawn_file_actions_t *actions, pid_t pgid)
+{
+    posix_spawnattr_t attr;
+    sigset_t defaults;
+    pid_t pid;
+
+    posix_spawnattr_init(&attr);
+    // signals the shell catches or ignores behave normally in the child
+    sigemptyset(&defaults);
+    sigaddset(&defaults, SIGINT);
+    sigaddset(&defaults, SIGQUIT);
+    sigaddset(&defaults, SIGTERM);
+    sigaddset(&defaults, SIGPIPE);
+    sigaddset(&defaults, SIGTTOU);
+    sigaddset(&defaults, SIGTTIN);
+    sigaddset(&defaults, SIGTSTP);
+    posix_spawnattr_setsigdefault(&attr, &defaults);
+    short flags = POSIX_SPAWN_SETSIGDEF;
+    if (pgid != -1) {
+        posix_spawnattr_setpgroup(&attr, pgid);
+        flags |= POSIX_SPAWN_SETPGROUP;
+    }
+    posix_spawnattr_setflags(&attr, flags);
+
+    int err;
+    if (strchr(args[0], '/') != NULL) {
+        err = posix_spawn(&pid, args[0], actions, &attr, args, environ);
+    } else {
+        const char *path = cmdcache_lookup(args[0]);
+        if (path != NULL) {
+            err = posix_spawn(&pid, path, actions, &attr, args, environ);
+        } else {
+            // not cached, let PATH be searched in case it appeared just now
+            err = posix_spawnp(&pid, args[0], actions, &attr, args, environ);
         }
-        if (strncmp(args[num_arg], "<", 1) == 0) {
-            int fd = fileno(fopen(args[num_arg + 1], "r"));
-            if (fd == -1) {
-                perror("90s");
-                return 1;
-            }
-            args[num_arg] = NULL;
-            return launch(args, fd, OPT_FGJ | OPT_STDIN);
+    }
+    posix_spawnattr_destroy(&attr);
+    if (err != 0) {
+        if (err == ENOENT) {
+            fprintf(stderr, "90s: command not found: %s\n", args[0]);
+            last_status = 127;
+        } else {
+            fprintf(stderr, "90s: %s: %s\n", args[0], strerror(err));
+            last_status = 126;
         }
-        if (strncmp(args[num_arg], "2>", 2) == 0) {
-            int fd = fileno(fopen(args[num_arg + 1], "w+"));
-            if (fd == -1) {
-                perror("90s");
-                return 1;
-            }
-            args[num_arg] = NULL;
-            return launch(args, fd, OPT_FGJ | OPT_STDERR);
+        return -1;
+    }
+    return pid;
+}
+
+/*
+ * The standard descriptors of a command after its redirections: fd[k] is
+ * what descriptor k becomes, opened lists the files opened for them
+ */
+typedef struct stdfds {
+    int fd[3];
+    int *opened;
+    int num_opened;
+} stdfds;
+
+static void close_redirects(stdfds *fds)
+{
+    for (int i = 0; i < fds->num_opened; i++) {
+        close(fds->opened[i]);
+    }
+}
+
+/*
+ * Apply the redirections of cmd in order on top of in and out. Files are
+ * opened by the shell so errors name the file and builtins can use them.
+ * Every descriptor ends up either k itself or close-on-exec above 2, so
+ * they can be installed in any order.
+ */
+static int open_redirects(command *cmd, int in, int out, stdfds *fds)
+{
+    fds->fd[0] = in;
+    fds->fd[1] = out;
+    fds->fd[2] = STDERR_FILENO;
+    fds->opened = arena_alloc(sizeof(int) * (cmd->num_redirs + 3));
+    fds->num_opened = 0;
+    for (int i = 0; i < cmd->num_redirs; i++) {
+        redir *r = &cmd->redirs[i];
+        if (r->kind == REDIR_DUP) {
+            fds->fd[r->fd] = fds->fd[r->target];
+            continue;
         }
-        if (strncmp(args[num_arg], ">&", 2) == 0) {
-            int fd = fileno(fopen(args[num_arg + 1], "w+"));
-            if (fd == -1) {
-                perror("90s");
-                return 1;
-            }
-            args[num_arg] = NULL;
-            return launch(args, fd, OPT_FGJ | OPT_STDOUT | OPT_STDERR);
+        int flags = O_WRONLY | O_CREAT | O_TRUNC;
+        if (r->kind == REDIR_IN) {
+            flags = O_RDONLY;
+        } else if (r->kind == REDIR_APPEND) {
+            flags = O_WRONLY | O_CREAT | O_APPEND;
         }
-        if (strncmp(args[num_arg], ">>", 2) == 0) {
-            int fd = fileno(fopen(args[num_arg + 1], "a+"));
+        int fd = open(r->path, flags | O_CLOEXEC, 0644);
+        if (fd == -1) {
+            fprintf(stderr, "90s: %s: %s\n", r->path, strerror(errno));
+            close_redirects(fds);
+            return -1;
+        }
+        fds->opened[fds->num_opened++] = fd;
+        if (r->fd == -1) {
+            fds->fd[STDOUT_FILENO] = fds->fd[STDERR_FILENO] = fd;
+        } else {
+            fds->fd[r->fd] = fd;
+        }
+    }
+    for (int k = 0; k < 3; k++) {
+        if (fds->fd[k] != k && fds->fd[k] <= STDERR_FILENO) {
+            // copy of another standard descriptor, which may be replaced first
+            int fd = fcntl(fds->fd[k], F_DUPFD_CLOEXEC, 3);
             if (fd == -1) {
                 perror("90s");
-                return 1;
+                close_redirects(fds);
+                return -1;
             }
-            args[num_arg] = NULL;
-            return launch(args, fd, OPT_FGJ | OPT_STDOUT);
+            fds->opened[fds->num_opened++] = fd;
+            fds->fd[k] = fd;
         }
+    }
+    return 0;
+}
 
-        num_arg++; // count number of args
+static void add_actions(posix_spawn_file_actions_t *actions, stdfds *fds)
+{
+    for (int k = 0; k < 3; k++) {
+        if (fds->fd[k] != k) {
+            posix_spawn_file_actions_adddup2(actions, fds->fd[k], k);
+        }
     }
+}
 
-    return launch(args, STDOUT_FILENO, OPT_FGJ);
+// the words of a pipeline's commands, to show it in jobs
+static char *command_text(command *cmds, int n)
+{
+    size_t len = 1;
+    for (int i = 0; i < n; i++) {
+        for (int k = 0; k < cmds[i].argc; k++) {
+            len += strlen(cmds[i].argv[k]) + 1;
+        }
+        len += 2;
+    }
+    char *text = arena_alloc(len), *p = text;
+    for (int i = 0; i < n; i++) {
+        if (i > 0) {
+            p = stpcpy(p, "| ");
+        }
+        for (int k = 0; k < cmds[i].argc; k++) {
+            p = stpcpy(p, cmds[i].argv[k]);
+            *p++ = ' ';
+        }
+    }
+    if (p > text) {
+        p--;
+    }
+    *p = '\0';
+    return text;
 }
 
-// execute_pipe with as many pipes as needed
-int execute_pipe(char ***args)
+/*
+ * The status of a finished job becomes the command's, the last process's
+ * or with pipefail the last one that failed, then the job is gone
+ */
+static void job_done(job *j)
 {
-    int pipefd[2];
-    pid_t pid;
-    int in = 0;
-
-    int num_cmds = 0;
-    while (args[num_cmds] != NULL) {
-        int num_args = 0;
-        while (args[num_cmds][num_args] != NULL) {
-            num_args++;
-        }
-        num_cmds++;
-    }
-    
-    for (int i = 0; i < num_cmds - 1; i++) {
-        pipe(pipefd);
-        if ((pid = fork()) == 0) {
-            // then this (child)
-            dup2(in, STDIN_FILENO); // get input from previous command
-            if (i < num_cmds - 1) {
-                dup2(pipefd[1], STDOUT_FILENO); // make output go to pipe (next output)
+    int n = j->num_pids;
+    int *statuses = arena_alloc(sizeof(int) * n);
+    for (int i = 0; i < n; i++) {
+        statuses[i] = job_status(j, i);
+    }
+    last_status = statuses[n - 1];
+    if (pipefail) {
+        for (int i = n - 1; i >= 0; i--) {
+            if (statuses[i] != 0) {
+                last_status = statuses[i];
+                break;
             }
-            close(pipefd[0]); // close original input
-            execute(args[i]);
-            exit(EXIT_SUCCESS);
-        } else if (pid < 0) {
-            perror("fork failed");
-        }
-        // this will be executed first
-        close(pipefd[1]); // close output
-        in = pipefd[0]; // save the input for the next command
+        }
+    }
+    if (n > 1) {
+        runlog_pipestatus(statuses, n);
+    }
+    job_remove(j);
+}
+
+/*
+ * Wait for a job owning the terminal until it is done or stopped, a
+ * stopped one goes into the job table for fg and bg
+ */
+static void foreground(job *j)
+{
+    bool stopped = job_wait(j);
+    if (j->pgid != 0) {
+        give_terminal(getpgrp());
+    }
+    if (!stopped) {
+        job_done(j);
+        return;
+    }
+    if (j->id == 0) {
+        job_insert(j);
+    }
+    out_printf("\n");
+    job_print(j);
+    out_flush();
+    last_status = 128 + SIGTSTP;
+}
+
+// leave a started pipeline running as a job or wait for it
+static void run_job(pid_t pgid, pid_t *pids, int *statuses, int n, char *text, bool background)
+{
+    job *j = job_new(pgid, pids, statuses, n, text);
+    if (!background || j->live == 0) {
+        foreground(j);
+        return;
+    }
+    job_insert(j);
+    out_printf("[%d] %d\n", j->id, (int) pids[n - 1]);
+    out_flush();
+    last_status = 0;
+}
+
+// spawn a program as a job of its own
+int launch(command *cmd, stdfds *fds, bool background)
+{
+    posix_spawn_file_actions_t actions;
+    posix_spawn_file_actions_init(&actions);
+    add_actions(&actions, fds);
+    pid_t pid = spawn(cmd->argv, &actions, job_control ? 0 : -1);
+    posix_spawn_file_actions_destroy(&actions);
+    if (pid == -1) {
+        return 1;
+    }
+    if (!background) {
+        give_terminal(pid);
+    }
+    int status = 0;
+    run_job(job_control ? pid : -1, &pid, &status, 1, command_text(cmd, 1), background);
+    return 1;
+}
+
+// run a builtin in the shell with its output and errors going where fds say
+static int run_builtin(const builtin *b, char **args, stdfds *fds)
+{
+    int old = -1, saved_err = -1;
+    if (fds->fd[STDOUT_FILENO] != STDOUT_FILENO) {
+        old = out_redirect(fds->fd[STDOUT_FILENO]);
+    }
+    if (fds->fd[STDERR_FILENO] != STDERR_FILENO) {
+        fflush(stderr);
+        saved_err = fcntl(STDERR_FILENO, F_DUPFD_CLOEXEC, 3);
+        dup2(fds->fd[STDERR_FILENO], STDERR_FILENO);
+    }
+    int ret = b->func(args);
+    out_flush();
+    if (ret == STATUS_SET) {
+        ret = 1;
+    } else if (ret != 0) {
+        last_status = ret == -1 ? 1 : 0;
     }
+    if (old != -1) {
+        out_redirect(old);
+    }
+    if (saved_err != -1) {
+        fflush(stderr);
+        dup2(saved_err, STDERR_FILENO);
+        close(saved_err);
+    }
+    return ret;
+}
+
+// run a function in the shell with its standard descriptors where fds say
+static int run_function(scriptfn *fn, char **args, stdfds *fds)
+{
+    int saved[3] = { -1, -1, -1 };
+    out_flush();
+    fflush(stderr);
+    for (int k = 0; k < 3; k++) {
+        if (fds->fd[k] != k) {
+            saved[k] = fcntl(k, F_DUPFD_CLOEXEC, 3);
+            dup2(fds->fd[k], k);
+        }
+    }
+    int ret = script_call(fn, args);
+    out_flush();
+    fflush(stderr);
+    for (int k = 0; k < 3; k++) {
+        if (saved[k] != -1) {
+            dup2(saved[k], k);
+            close(saved[k]);
+        }
+    }
+    return ret;
+}
 
-    if ((pid = fork()) == 0) {
-        dup2(in, STDIN_FILENO); // get input from pipe
-        execute(args[num_cmds - 1]);
-        exit(EXIT_SUCCESS);
+static int leading_assignments(command *cmd)
+{
+    int n = 0;
+    while (n < cmd->argc && var_assignment(cmd->argv[n])) {
+        n++;
+    }
+    return n;
+}
+
+/*
+ * NAME=value words in front of a command go into its environment only,
+ * the values they replaced come back afterwards
+ */
+static char **push_assignments(char **words, int n)
+{
+    char **saved = arena_alloc(sizeof(char *) * n);
+    for (int i = 0; i < n; i++) {
+        char *eq = strchr(words[i], '=');
+        *eq = '\0';
+        const char *old = getenv(words[i]);
+        saved[i] = NULL;
+        if (old != NULL) {
+            saved[i] = arena_alloc(strlen(old) + 1);
+            strcpy(saved[i], old);
+        }
+        setenv(words[i], eq + 1, 1);
+        *eq = '=';
+    }
+    return saved;
+}
+
+static void pop_assignments(char **words, char **saved, int n)
+{
+    for (int i = n - 1; i >= 0; i--) {
+        char *eq = strchr(words[i], '=');
+        *eq = '\0';
+        if (saved[i] != NULL) {
+            setenv(words[i], saved[i], 1);
+        } else {
+            unsetenv(words[i]);
+        }
+        *eq = '=';
+    }
+}
+
+/*
+ * Run one command in the foreground or as a background job, return 0 to
+ * leave the shell. A command made only of NAME=value words sets shell
+ * variables. Builtins come first, then functions, then programs.
+ */
+static int execute(command *cmd, bool background)
+{
+    stdfds fds;
+    if (open_redirects(cmd, STDIN_FILENO, STDOUT_FILENO, &fds) == -1) {
+        last_status = 1;
+        return 1;
+    }
+    int assigns = leading_assignments(cmd);
+    command run = *cmd;
+    run.argv += assigns;
+    run.argc -= assigns;
+    char **saved = NULL;
+    if (assigns > 0 && run.argc == 0) {
+        for (int i = 0; i < assigns; i++) {
+            var_assign(cmd->argv[i]);
+        }
+        last_status = 0;
+    } else if (assigns > 0) {
+        saved = push_assignments(cmd->argv, assigns);
+    }
+
+    int ret = 1;
+    const builtin *b = run.argc > 0 ? builtin_find(run.argv[0]) : NULL;
+    scriptfn *fn = run.argc > 0 && b == NULL ? script_function(run.argv[0]) : NULL;
+    if (run.argc == 0) {
+        last_status = 0; // only redirections, the files were created
+    } else if (b != NULL) {
+        ret = run_builtin(b, run.argv, &fds);
+    } else if (fn != NULL) {
+        ret = run_function(fn, run.argv, &fds);
+    } else {
+        ret = launch(&run, &fds, background);
+    }
+    if (saved != NULL) {
+        pop_assignments(cmd->argv, saved, assigns);
+    }
+    close_redirects(&fds);
+    return ret;
+}
+
+/*
+ * Start one stage reading from in and writing to out inside process
+ * group pgid (0 makes the stage the group leader), spare is the read end
+ * of the stage's own output pipe which the stage must not keep. Programs
+ * are spawned, builtins and functions are forked.
+ */
+static pid_t start_stage(command *cmd, int in, int out, int spare, pid_t pgid)
+{
+    stdfds fds;
+    if (open_redirects(cmd, in, out, &fds) == -1) {
+        last_status = 1;
+        return -1;
+    }
+    int assigns = leading_assignments(cmd);
+    char **saved = assigns > 0 ? push_assignments(cmd->argv, assigns) : NULL;
+    char **args = cmd->argv + assigns;
+    pid_t pid;
+    const builtin *b = args[0] != NULL ? builtin_find(args[0]) : NULL;
+    scriptfn *fn = args[0] != NULL && b == NULL ? script_function(args[0]) : NULL;
+    if (args[0] != NULL && b == NULL && fn == NULL) {
+        posix_spawn_file_actions_t actions;
+        posix_spawn_file_actions_init(&actions);
+        add_actions(&actions, &fds);
+        // pipe descriptors are close-on-exec, nothing else to close
+        pid = spawn(args, &actions, pgid);
+        posix_spawn_file_actions_destroy(&actions);
+    } else if ((pid = fork()) == 0) {
+        setpgid(0, pgid);
+        signal(SIGTTOU, SIG_DFL);
+        signal(SIGTTIN, SIG_DFL);
+        signal(SIGTSTP, SIG_DFL);
+        signal(SIGPIPE, SIG_DFL);
+        signal(SIGCHLD, SIG_DFL);
+        if (spare != -1) {
+            close(spare);
+        }
+        for (int k = 0; k < 3; k++) {
+            if (fds.fd[k] != k) {
+                dup2(fds.fd[k], k);
+            }
+        }
+        job_control = false; // what the stage runs stays in its group
+        int status = 0;
+        if (b != NULL) {
+            int ret = b->func(args);
+            status = ret == -1 ? 1 : ret == STATUS_SET ? last_status : 0;
+        } else if (fn != NULL) {
+            script_call(fn, args);
+            status = last_status;
+        }
+        out_flush();
+        exit(status);
     } else if (pid < 0) {
         perror("fork failed");
+        pid = -1;
+    } else {
+        setpgid(pid, pgid == 0 ? pid : pgid); // also in parent so it is set before we use it
     }
+    if (saved != NULL) {
+        pop_assignments(cmd->argv, saved, assigns);
+    }
+    close_redirects(&fds);
+    return pid;
+}
+
+// hand the terminal to a process group, which also gets it back from the shell
+static void give_terminal(pid_t pgid)
+{
+    if (job_control && isatty(STDIN_FILENO)) {
+        tcsetpgrp(STDIN_FILENO, pgid);
+        killpg(pgid, SIGCONT); // in case it read the terminal before it owned it
+    }
+}
+
+/*
+ * Run a pipeline: every stage is spawned directly (builtins are forked
+ * once) into one process group which owns the terminal while it runs.
+ * In the foreground, builtins that only print run last in the shell
+ * itself, writing into their pipe once every reader is running. The stages then make up one
+ * job, waited for or left running in the background.
+ */
+static int execute_pipe(pipeline *pipe_line)
+{
+    int num_cmds = pipe_line->num_cmds;
+    bool background = pipe_line->background;
+    pid_t *pids = arena_alloc(sizeof(pid_t) * num_cmds);
+    int *statuses = arena_alloc(sizeof(int) * num_cmds);
+    int *outs = arena_alloc(sizeof(int) * num_cmds);
+    pid_t pgid = job_control ? 0 : -1;
+    int in = STDIN_FILENO;
 
-    close(in);
     for (int i = 0; i < num_cmds; i++) {
-        waitpid(pid, NULL, 0);
+        pids[i] = -1;
+        statuses[i] = 127;
     }
+    for (int i = 0; i < num_cmds; i++) {
+        command *cmd = &pipe_line->cmds[i];
+        int pipefd[2] = { -1, STDOUT_FILENO };
+        if (i < num_cmds - 1) {
+            if (pipe(pipefd) == -1) {
+                perror("90s");
+                break;
+            }
+            fcntl(pipefd[0], F_SETFD, FD_CLOEXEC);
+            fcntl(pipefd[1], F_SETFD, FD_CLOEXEC);
+        }
+        const builtin *b = cmd->argc > 0 ? builtin_find(cmd->argv[0]) : NULL;
+        if (b != NULL && (b->flags & BUILTIN_PRINTS) && cmd->num_redirs == 0 && !background) {
+            // in the shell once the readers run, a background job could block it
+            pids[i] = 0;
+            outs[i] = pipefd[1];
+            pipefd[1] = STDOUT_FILENO; // kept open until the builtin ran
+        } else {
+            pids[i] = start_stage(cmd, in, pipefd[1], pipefd[0], pgid);
+        }
+        if (pids[i] == -1) {
+            statuses[i] = last_status;
+        } else if (pids[i] > 0) {
+            if (pgid == 0) {
+                pgid = pids[i];
+                if (!background) {
+                    give_terminal(pgid);
+                }
+            }
+        }
+        if (in != STDIN_FILENO) {
+            close(in);
+        }
+        if (pipefd[1] != STDOUT_FILENO) {
+            close(pipefd[1]); // close output
+        }
+        in = pipefd[0]; // save the input for the next command
+    }
+    if (in != -1 && in != STDIN_FILENO) {
+        close(in);
+    }
+
+    for (int i = 0; i < num_cmds; i++) {
+        if (pids[i] == 0) {
+            stdfds fds = { { STDIN_FILENO, outs[i], STDERR_FILENO }, NULL, 0 };
+            command *cmd = &pipe_line->cmds[i];
+            run_builtin(builtin_find(cmd->argv[0]), cmd->argv, &fds);
+            statuses[i] = last_status;
+            if (outs[i] != STDOUT_FILENO) {
+                close(outs[i]);
+            }
+        }
+    }
+    run_job(pgid, pids, statuses, num_cmds, command_text(pipe_line->cmds, num_cmds), background);
     return 1;
 }
+
+// run one pipeline of a command list, 0 when the shell has to exit
+int execute_pipeline(pipeline *pipe_line)
+{
+    if (pipe_line->num_cmds == 1) {
+        return execute(&pipe_line->cmds[0], pipe_line->background);
+    }
+    return execute_pipe(pipe_line);
+}
+
+/*
+ * Run a parsed command line, compiled by the script engine like a file
+ * so if, while, for and functions work at the prompt too. Returns 0 to
+ * leave the shell.
+ */
+int execute_list(cmdlist *list)
+{
+    return script_execute(list);
+}
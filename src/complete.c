@@ -0,0 +1,649 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdbool.h>
+#include <limits.h>
+#include <time.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <signal.h>
+#include <spawn.h>
+#include <unistd.h>
+#include <sys/wait.h>
+
+#include "complete.h"
+#include "dircache.h"
+#include "fuzzy.h"
+#include "cmdcache.h"
+#include "script.h"
+#include "builtins.h"
+#include "history.h"
+#include "output.h"
+#include "runlog.h"
+#include "hash.h"
+#include "90s.h"
+
+extern char **environ;
+
+/*
+ * Candidates for the word under the cursor. Commands come from the sorted
+ * names of the PATH cache and the builtins, files from cached directory
+ * listings, arguments of commands with a completion spec from its word
+ * list. All are sorted so the matches are found with a binary search for
+ * the first name not below the prefix and a scan while it matches.
+ */
+#define COMPLETE_DIR "90s_completions" // spec files named after the command
+#define COMPLETE_TTL 60 // seconds a generator's output is reused
+#define COMPLETE_TIMEOUT 2000 // milliseconds a generator may take
+
+enum { SPEC_WORDS, SPEC_COMMAND, SPEC_FUNCTION, SPEC_NONE };
+
+/*
+ * complete -W words, -C generator or -F function for a command. A
+ * generator is run by sh with the command name as $0, a function is
+ * called in the shell with the words of the command up to the one being
+ * completed as $1..$n. Their output lines are the words.
+ */
+typedef struct compspec {
+    char *name;
+    int kind;
+    char *arg; /* the words, the generator or the function name */
+    long ttl;
+    char *storage; /* the words, split */
+    const char **words; /* sorted and unique */
+    int count;
+    struct timespec made; /* when the generator ran */
+    bool ready;
+} compspec;
+
+static htable specs; /* command -> compspec, SPEC_NONE when no spec file exists */
+static bool specs_ready = false;
+static const char **builtins = NULL; /* names of builtin_list, which is sorted */
+static int num_sorted_builtins = 0;
+
+static int cmp_name(const void *a, const void *b)
+{
+    return strcmp(*(const char **) a, *(const char **) b);
+}
+
+static void add(completion *c, const char *name, bool dir)
+{
+    if (c->count == c->cap) {
+        c->cap = c->cap == 0 ? 64 : c->cap * 2;
+        c->items = realloc(c->items, sizeof(direntry) * c->cap);
+        if (!c->items) {
+            fprintf(stderr, "90s: Error allocating memory\n");
+            exit(EXIT_FAILURE);
+        }
+    }
+    c->items[c->count].name = name;
+    c->items[c->count].dir = dir;
+    c->count++;
+}
+
+// first index in names[0, n) whose name is not below prefix
+static size_t lower_bound(const char **names, size_t n, const char *prefix, size_t len)
+{
+    size_t lo = 0, hi = n;
+    while (lo < hi) {
+        size_t mid = lo + (hi - lo) / 2;
+        if (strncmp(names[mid], prefix, len) < 0) {
+            lo = mid + 1;
+        } else {
+            hi = mid;
+        }
+    }
+    return lo;
+}
+
+static void match_commands(const char *word, size_t len, completion *c)
+{
+    if (builtins == NULL) {
+        num_sorted_builtins = builtin_count;
+        builtins = memalloc(sizeof(char *) * num_sorted_builtins);
+        for (int i = 0; i < builtin_count; i++) {
+            builtins[i] = builtin_list[i].name;
+        }
+    }
+    size_t n;
+    const char **names = cmdcache_names(&n);
+    size_t i = lower_bound(names, n, word, len);
+    size_t k = lower_bound(builtins, num_sorted_builtins, word, len);
+    // merge both runs of matches, a builtin shadows a program of its name
+    for (;;) {
+        bool more = i < n && strncmp(names[i], word, len) == 0;
+        bool more_builtins = k < (size_t) num_sorted_builtins && strncmp(builtins[k], word, len) == 0;
+        if (!more && !more_builtins) {
+            break;
+        }
+        int cmp = !more ? 1 : !more_builtins ? -1 : strcmp(names[i], builtins[k]);
+        if (cmp < 0) {
+            add(c, names[i++], false);
+        } else {
+            add(c, builtins[k++], false);
+            i += cmp == 0;
+        }
+    }
+}
+
+// listing of the directory part of word, dir_len is set to its length
+static const dirlist *word_dir(const char *word, size_t len, size_t *dir_len)
+{
+    *dir_len = len;
+    while (*dir_len > 0 && word[*dir_len - 1] != '/') {
+        (*dir_len)--;
+    }
+    char path[PATH_MAX];
+    int n;
+    const char *home = getenv("HOME");
+    if (*dir_len > 0 && word[0] == '/') {
+        n = snprintf(path, sizeof(path), "%.*s", (int) *dir_len, word);
+    } else if (*dir_len > 1 && word[0] == '~' && word[1] == '/' && home != NULL) {
+        n = snprintf(path, sizeof(path), "%s%.*s", home, (int) *dir_len - 1, word + 1);
+    } else {
+        char cwd[PATH_MAX];
+        if (getcwd(cwd, sizeof(cwd)) == NULL) {
+            return NULL;
+        }
+        n = snprintf(path, sizeof(path), "%s/%.*s", cwd, (int) *dir_len, word);
+    }
+    if (n <= 0 || (size_t) n >= sizeof(path)) {
+        return NULL;
+    }
+    return dircache_get(path);
+}
+
+static void match_files(const char *word, size_t len, completion *c)
+{
+    size_t dir_len;
+    const dirlist *list = word_dir(word, len, &dir_len);
+    if (list == NULL) {
+        return;
+    }
+    const char *base = word + dir_len;
+    size_t base_len = len - dir_len;
+    c->base = base_len;
+    // the entries are sorted by name, search them like the command names
+    size_t lo = 0, hi = list->count;
+    while (lo < hi) {
+        size_t mid = lo + (hi - lo) / 2;
+        if (strncmp(list->entries[mid].name, base, base_len) < 0) {
+            lo = mid + 1;
+        } else {
+            hi = mid;
+        }
+    }
+    for (size_t i = lo; i < (size_t) list->count; i++) {
+        direntry *e = &list->entries[i];
+        if (strncmp(e->name, base, base_len) != 0) {
+            break;
+        }
+        // hidden files only when asked for
+        if (e->name[0] != '.' || (base_len > 0 && base[0] == '.')) {
+            add(c, e->name, e->dir);
+        }
+    }
+}
+
+/*
+ * When nothing starts with the word, names fuzzy matching it are offered
+ * instead, best first. They replace the word rather than extend it.
+ */
+typedef struct scored {
+    direntry item;
+    int score;
+} scored;
+
+static scored *ranked = NULL;
+static int num_ranked = 0, cap_ranked = 0;
+
+static void add_fuzzy(const fuzzy *f, const char *name, bool dir)
+{
+    int score = fuzzy_score(f, name, strlen(name));
+    if (score < 0) {
+        return;
+    }
+    if (num_ranked == cap_ranked) {
+        cap_ranked = cap_ranked == 0 ? 64 : cap_ranked * 2;
+        ranked = realloc(ranked, sizeof(scored) * cap_ranked);
+        if (!ranked) {
+            fprintf(stderr, "90s: Error allocating memory\n");
+            exit(EXIT_FAILURE);
+        }
+    }
+    ranked[num_ranked].item.name = name;
+    ranked[num_ranked].item.dir = dir;
+    ranked[num_ranked].score = score;
+    num_ranked++;
+}
+
+static int cmp_scored(const void *a, const void *b)
+{
+    const scored *x = a, *y = b;
+    if (x->score != y->score) {
+        return x->score < y->score ? 1 : -1;
+    }
+    return strcmp(x->item.name, y->item.name);
+}
+
+static void fuzzy_candidates(const char *word, size_t len, bool command, compspec *spec, completion *c)
+{
+    fuzzy f;
+    num_ranked = 0;
+    if (command) {
+        fuzzy_init(&f, word, len);
+        size_t n;
+        const char **names = cmdcache_names(&n);
+        for (size_t i = 0; i < n; i++) {
+            if (builtin_find(names[i]) == NULL) {
+                add_fuzzy(&f, names[i], false);
+            }
+        }
+        for (int i = 0; i < num_sorted_builtins; i++) {
+            add_fuzzy(&f, builtins[i], false);
+        }
+    } else if (spec != NULL) {
+        fuzzy_init(&f, word, len);
+        for (int i = 0; i < spec->count; i++) {
+            add_fuzzy(&f, spec->words[i], false);
+        }
+    }
+    if (!command && num_ranked == 0) {
+        size_t dir_len;
+        const dirlist *list = word_dir(word, len, &dir_len);
+        fuzzy_init(&f, word + dir_len, len - dir_len);
+        c->base = len - dir_len;
+        for (int i = 0; list != NULL && i < list->count; i++) {
+            if (list->entries[i].name[0] != '.' || word[dir_len] == '.') {
+                add_fuzzy(&f, list->entries[i].name, list->entries[i].dir);
+            }
+        }
+    }
+    qsort(ranked, num_ranked, sizeof(scored), cmp_scored);
+    for (int i = 0; i < num_ranked; i++) {
+        add(c, ranked[i].item.name, ranked[i].item.dir);
+    }
+    c->fuzzy = c->count > 0;
+}
+
+// split text at blanks, or at newlines when lines is set, into sorted unique words
+static void set_words(compspec *spec, const char *text, size_t len, bool lines)
+{
+    free(spec->storage);
+    free(spec->words);
+    spec->storage = memalloc(len + 1);
+    memcpy(spec->storage, text, len);
+    spec->storage[len] = '\0';
+    int cap = 16;
+    spec->words = memalloc(sizeof(char *) * cap);
+    spec->count = 0;
+    const char *delim = lines ? "\n" : " \t\n";
+    for (char *w = strtok(spec->storage, delim); w != NULL; w = strtok(NULL, delim)) {
+        if (spec->count == cap) {
+            cap *= 2;
+            spec->words = realloc(spec->words, sizeof(char *) * cap);
+            if (!spec->words) {
+                fprintf(stderr, "90s: Error allocating memory\n");
+                exit(EXIT_FAILURE);
+            }
+        }
+        spec->words[spec->count++] = w;
+    }
+    qsort(spec->words, spec->count, sizeof(char *), cmp_name);
+    int unique = 0;
+    for (int i = 0; i < spec->count; i++) {
+        if (unique == 0 || strcmp(spec->words[unique - 1], spec->words[i]) != 0) {
+            spec->words[unique++] = spec->words[i];
+        }
+    }
+    spec->count = unique;
+}
+
+// run the generator and take its output, false when it failed
+static bool generate(compspec *spec)
+{
+    int fds[2];
+    if (pipe(fds) == -1) {
+        return false;
+    }
+    fcntl(fds[0], F_SETFD, FD_CLOEXEC);
+    fcntl(fds[1], F_SETFD, FD_CLOEXEC);
+    posix_spawn_file_actions_t actions;
+    posix_spawn_file_actions_init(&actions);
+    posix_spawn_file_actions_addopen(&actions, STDIN_FILENO, "/dev/null", O_RDONLY, 0);
+    posix_spawn_file_actions_adddup2(&actions, fds[1], STDOUT_FILENO);
+    posix_spawn_file_actions_addopen(&actions, STDERR_FILENO, "/dev/null", O_WRONLY, 0);
+    posix_spawnattr_t attr;
+    sigset_t defaults;
+    posix_spawnattr_init(&attr);
+    sigemptyset(&defaults);
+    sigaddset(&defaults, SIGPIPE);
+    posix_spawnattr_setsigdefault(&attr, &defaults);
+    posix_spawnattr_setpgroup(&attr, 0); // killed as a whole when it takes too long
+    posix_spawnattr_setflags(&attr, POSIX_SPAWN_SETSIGDEF | POSIX_SPAWN_SETPGROUP);
+    char *argv[] = { "sh", "-c", spec->arg, spec->name, NULL };
+    pid_t pid;
+    int err = posix_spawn(&pid, "/bin/sh", &actions, &attr, argv, environ);
+    posix_spawn_file_actions_destroy(&actions);
+    posix_spawnattr_destroy(&attr);
+    close(fds[1]);
+    if (err != 0) {
+        close(fds[0]);
+        return false;
+    }
+
+    char *out = NULL;
+    size_t len = 0, cap = 0;
+    bool done = false;
+    struct pollfd pfd = { fds[0], POLLIN, 0 };
+    struct timespec start, now;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    for (;;) {
+        // one deadline for the whole run, a steady trickle of output does not extend it
+        clock_gettime(CLOCK_MONOTONIC, &now);
+        long left = COMPLETE_TIMEOUT - ((now.tv_sec - start.tv_sec) * 1000 +
+                (now.tv_nsec - start.tv_nsec) / 1000000);
+        if (done || left <= 0) {
+            break;
+        }
+        int ready = poll(&pfd, 1, left);
+        if (ready == -1 && errno == EINTR) {
+            continue;
+        }
+        if (ready <= 0) {
+            break;
+        }
+        if (len + 4096 > cap) {
+            cap = cap * 2 + 4096;
+            out = realloc(out, cap);
+            if (!out) {
+                fprintf(stderr, "90s: Error allocating memory\n");
+                exit(EXIT_FAILURE);
+            }
+        }
+        ssize_t n = read(fds[0], out + len, cap - len);
+        if (n == -1 && errno == EINTR) {
+            continue;
+        }
+        done = n <= 0;
+        len += n > 0 ? n : 0;
+    }
+    close(fds[0]);
+    if (!done) {
+        kill(-pid, SIGKILL);
+    }
+    int status;
+    waitpid(pid, &status, 0);
+    bool ok = done && WIFEXITED(status) && WEXITSTATUS(status) == 0;
+    if (ok) {
+        set_words(spec, out != NULL ? out : "", len, true);
+    }
+    free(out);
+    return ok;
+}
+
+/*
+ * Call the function of a spec with its output going to a temporary file,
+ * every time since what it prints depends on the words. The status of
+ * the last command line is kept for $? and the prompt.
+ */
+static bool call_function(compspec *spec, char **words)
+{
+    scriptfn *fn = script_function(spec->arg);
+    FILE *tmp = fn != NULL ? tmpfile() : NULL;
+    int null = open("/dev/null", O_RDWR | O_CLOEXEC);
+    if (tmp == NULL || null == -1) {
+        if (tmp != NULL) {
+            fclose(tmp);
+        }
+        if (null != -1) {
+            close(null);
+        }
+        return false;
+    }
+    int to[3] = { null, fileno(tmp), null };
+    int saved[3];
+    out_flush();
+    fflush(stderr);
+    for (int k = 0; k < 3; k++) {
+        saved[k] = fcntl(k, F_DUPFD_CLOEXEC, 3);
+        dup2(to[k], k);
+    }
+    int status = last_status;
+    words[0] = spec->arg;
+    script_call(fn, words);
+    bool ok = last_status == 0;
+    last_status = status;
+    out_flush();
+    for (int k = 0; k < 3; k++) {
+        dup2(saved[k], k);
+        close(saved[k]);
+    }
+    close(null);
+
+    off_t len = lseek(fileno(tmp), 0, SEEK_END);
+    char *out = memalloc(len > 0 ? len : 1);
+    ok = ok && len >= 0 && pread(fileno(tmp), out, len, 0) == len;
+    if (ok) {
+        set_words(spec, out, len, true);
+    }
+    free(out);
+    fclose(tmp);
+    return ok;
+}
+
+static void drop_spec(compspec *spec)
+{
+    free(spec->name);
+    free(spec->arg);
+    free(spec->storage);
+    free(spec->words);
+    free(spec);
+}
+
+static compspec *new_spec(const char *name, int kind, const char *arg)
+{
+    if (!specs_ready) {
+        ht_init(&specs, 64);
+        specs_ready = true;
+    }
+    size_t len = strlen(name);
+    compspec *old = ht_get(&specs, name, len);
+    if (old != NULL) {
+        ht_del(&specs, name, len);
+        drop_spec(old);
+    }
+    compspec *spec = memalloc(sizeof(compspec));
+    spec->name = memalloc(len + 1);
+    memcpy(spec->name, name, len + 1);
+    spec->kind = kind;
+    spec->arg = NULL;
+    if (arg != NULL) {
+        spec->arg = memalloc(strlen(arg) + 1);
+        strcpy(spec->arg, arg);
+    }
+    spec->ttl = COMPLETE_TTL;
+    spec->storage = NULL;
+    spec->words = NULL;
+    spec->count = 0;
+    spec->ready = false;
+    ht_put(&specs, spec->name, len, spec);
+    return spec;
+}
+
+/*
+ * The spec of a command, spec files are sourced the first time the
+ * command's arguments are completed, so they cost nothing at startup.
+ * words[1] is the command, words[0] is left for the function name.
+ */
+static compspec *find_spec(const char *command, char **words)
+{
+    const char *slash = strrchr(command, '/');
+    const char *name = slash != NULL ? slash + 1 : command;
+    if (!specs_ready) {
+        ht_init(&specs, 64);
+        specs_ready = true;
+    }
+    if (*name == '\0' || *name == '.') {
+        return NULL; // no spec file for "dir/", hidden names or . itself
+    }
+    compspec *spec = ht_get(&specs, name, strlen(name));
+    if (spec == NULL) {
+        char file[PATH_MAX];
+        char *dir = config_path(COMPLETE_DIR);
+        snprintf(file, sizeof(file), "%s/%s", dir, name);
+        free(dir);
+        if (access(file, R_OK) == 0) {
+            script_file(file, NULL, 0);
+        }
+        spec = ht_get(&specs, name, strlen(name));
+        if (spec == NULL) {
+            spec = new_spec(name, SPEC_NONE, NULL); // not looked for again
+        }
+    }
+    if (spec->kind == SPEC_NONE) {
+        return NULL;
+    }
+    if (spec->kind == SPEC_WORDS && !spec->ready) {
+        set_words(spec, spec->arg, strlen(spec->arg), false);
+        spec->ready = true;
+    } else if (spec->kind == SPEC_COMMAND) {
+        struct timespec now;
+        clock_gettime(CLOCK_MONOTONIC, &now);
+        if (!spec->ready || now.tv_sec - spec->made.tv_sec >= spec->ttl) {
+            if (generate(spec)) {
+                spec->ready = true;
+            }
+            spec->made = now; // a failing generator is not run on every tab either
+        }
+    } else if (spec->kind == SPEC_FUNCTION) {
+        spec->ready = call_function(spec, words);
+        if (!spec->ready) {
+            set_words(spec, "", 0, true);
+        }
+    }
+    return spec;
+}
+
+static void match_words(compspec *spec, const char *word, size_t len, completion *c)
+{
+    size_t i = lower_bound(spec->words, spec->count, word, len);
+    for (; i < (size_t) spec->count && strncmp(spec->words[i], word, len) == 0; i++) {
+        add(c, spec->words[i], false);
+    }
+}
+
+/*
+ * Fill c with the names word can be completed to, command names when it
+ * is in command position and has no slash, the words of the spec of the
+ * command it is an argument of, files otherwise. Fuzzy matches of the
+ * same names when none starts with the word. words holds a free slot,
+ * the command and its arguments up to the word, NULL terminated.
+ */
+void complete_word(const char *word, size_t len, bool command, char **words, completion *c)
+{
+    c->count = 0;
+    c->base = len;
+    c->fuzzy = false;
+    compspec *spec = NULL;
+    command = command && memchr(word, '/', len) == NULL;
+    if (command) {
+        match_commands(word, len, c);
+    } else {
+        spec = words[1] != NULL ? find_spec(words[1], words) : NULL;
+        if (spec != NULL) {
+            match_words(spec, word, len, c);
+        }
+        if (c->count == 0) {
+            match_files(word, len, c);
+        }
+    }
+    if (c->count == 0 && len > 0) {
+        fuzzy_candidates(word, len, command, spec, c);
+    }
+    c->common = 0;
+    if (c->count > 0 && !c->fuzzy) {
+        c->common = strlen(c->items[0].name);
+        for (int i = 1; i < c->count; i++) {
+            size_t k = 0;
+            while (k < c->common && c->items[i].name[k] == c->items[0].name[k]) {
+                k++;
+            }
+            c->common = k;
+        }
+    }
+}
+
+static void print_spec(compspec *spec)
+{
+    out_printf("complete %s '", spec->kind == SPEC_WORDS ? "-W" : spec->kind == SPEC_COMMAND ? "-C" : "-F");
+    // single quotes inside the quoted argument are written as '\''
+    for (const char *p = spec->arg; *p != '\0'; p++) {
+        if (*p == '\'') {
+            out_printf("'\\''");
+        } else {
+            out_write(p, 1);
+        }
+    }
+    out_printf("'");
+    if (spec->kind == SPEC_COMMAND && spec->ttl != COMPLETE_TTL) {
+        out_printf(" -t %ld", spec->ttl);
+    }
+    out_printf(" %s\n", spec->name);
+}
+
+/*
+ * complete [-W words | -C generator [-t ttl] | -F function | -r] command...
+ * without arguments the specs are listed
+ */
+int complete_spec(char **args)
+{
+    int kind = SPEC_NONE;
+    const char *arg = NULL;
+    long ttl = COMPLETE_TTL;
+    bool remove = false;
+    int i = 1;
+    for (; args[i] != NULL && args[i][0] == '-'; i++) {
+        if (strcmp(args[i], "-r") == 0) {
+            remove = true;
+        } else if (strcmp(args[i], "-W") == 0 && args[i + 1] != NULL) {
+            kind = SPEC_WORDS;
+            arg = args[++i];
+        } else if (strcmp(args[i], "-C") == 0 && args[i + 1] != NULL) {
+            kind = SPEC_COMMAND;
+            arg = args[++i];
+        } else if (strcmp(args[i], "-F") == 0 && args[i + 1] != NULL) {
+            kind = SPEC_FUNCTION;
+            arg = args[++i];
+        } else if (strcmp(args[i], "-t") == 0 && args[i + 1] != NULL) {
+            ttl = atol(args[++i]);
+        } else {
+            fprintf(stderr, "90s: complete: usage: complete [-W words | -C generator [-t ttl] | -F function | -r] command...\n");
+            return -1;
+        }
+    }
+    if (args[i] == NULL) {
+        if (kind != SPEC_NONE || remove) {
+            fprintf(stderr, "90s: complete: no command given\n");
+            return -1;
+        }
+        for (size_t k = 0; specs_ready && k < specs.cap; k++) {
+            compspec *spec = specs.slots[k].val;
+            if (specs.slots[k].key != NULL && spec->kind != SPEC_NONE) {
+                print_spec(spec);
+            }
+        }
+        return 1;
+    }
+    if (!remove && kind == SPEC_NONE) {
+        fprintf(stderr, "90s: complete: -W, -C or -F is needed\n");
+        return -1;
+    }
+    for (; args[i] != NULL; i++) {
+        // removing leaves a marker so a spec file does not bring it back
+        compspec *spec = new_spec(args[i], remove ? SPEC_NONE : kind, arg);
+        spec->ttl = ttl;
+    }
+    return 1;
+}
@@ -0,0 +1,579 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdbool.h>
+#include <errno.h>
+#include <signal.h>
+#include <time.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <dirent.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+#include <sys/inotify.h>
+
+#include "dircache.h"
+#include "watch.h"
+#include "hash.h"
+#include "90s.h"
+
+/*
+ * Sorted listings of directories, read once and kept until inotify says
+ * an entry was added, removed or renamed. A directory that can not be
+ * watched is checked with one stat of its mtime per lookup instead.
+ *
+ * The highlighter only peeks: a listing that is missing or out of date is
+ * queued and read by dircache_work() between keystrokes, so drawing a
+ * line never does I/O. Unwatched listings are trusted until the next
+ * prompt. Directories on network and FUSE mounts are read by a forked
+ * helper whose output is collected through a pipe, a hung mount then
+ * only leaves those paths unknown.
+ */
+#define DIRCACHE_MAX 128 // listings kept before all are dropped
+#define DIRCACHE_BUDGET 8 // local directories read per dircache_work()
+#define DIRCACHE_TIMEOUT 5 // seconds a helper may take before it is given up
+#define DIR_EVENTS (IN_CREATE | IN_DELETE | IN_MOVED_FROM | IN_MOVED_TO | \
+        IN_DELETE_SELF | IN_MOVE_SELF | IN_ONLYDIR)
+
+typedef struct cachedir {
+    char *path;
+    dirlist list;
+    char *names;
+    int wd;
+    bool stale; /* listing out of date or never read */
+    bool loaded; /* list holds a listing, maybe a stale one */
+    bool missing; /* could not be read */
+    bool queued; /* waiting for dircache_work() or the helper */
+    int slow; /* on a network or FUSE mount, -1 when not known yet */
+    struct timespec mtime;
+} cachedir;
+
+typedef struct mount {
+    char *dir;
+    size_t len;
+    bool slow;
+} mount;
+
+static htable dirs; /* absolute path -> cachedir */
+static bool dirs_ready = false;
+static cachedir **queue = NULL;
+static int num_queued = 0, cap_queued = 0;
+static mount *mounts = NULL;
+static int num_mounts = 0;
+static bool mounts_stale = true;
+
+static pid_t helper = -1; // reading a directory on a slow mount
+static int helper_fd = -1;
+static char *helper_path = NULL;
+static char *reply = NULL;
+static size_t reply_len = 0, reply_cap = 0;
+static time_t helper_start;
+static pid_t orphan = -1; // a helper given up on, reaped once its mount answers
+
+static void on_change(void *data, const char *name, uint32_t mask)
+{
+    cachedir *c = data;
+    if (mask & (DIR_EVENTS | IN_IGNORED | IN_Q_OVERFLOW)) {
+        c->stale = true;
+    }
+    if (mask & IN_IGNORED) {
+        c->wd = -1;
+    }
+}
+
+static int cmp_entry(const void *a, const void *b)
+{
+    return strcmp(((const direntry *) a)->name, ((const direntry *) b)->name);
+}
+
+static bool load(cachedir *c)
+{
+    struct stat st;
+    int dfd = open(c->path, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    if (dfd == -1) {
+        return false;
+    }
+    DIR *dp = fdopendir(dfd);
+    if (dp == NULL || fstat(dfd, &st) == -1) {
+        if (dp != NULL) {
+            closedir(dp);
+        } else {
+            close(dfd);
+        }
+        return false;
+    }
+    c->mtime = st.st_mtim;
+    c->stale = false;
+    free(c->list.entries);
+    free(c->names);
+
+    // names go into one buffer, offsets are turned into pointers at the end
+    size_t len = 0, cap = 4096;
+    int count = 0, entries_cap = 64;
+    char *names = memalloc(cap);
+    size_t *offsets = memalloc(sizeof(size_t) * entries_cap);
+    bool *is_dir = memalloc(entries_cap);
+    struct dirent *ent;
+    while ((ent = readdir(dp)) != NULL) {
+        if (strcmp(ent->d_name, ".") == 0 || strcmp(ent->d_name, "..") == 0) {
+            continue;
+        }
+        size_t namelen = strlen(ent->d_name) + 1;
+        if (len + namelen > cap) {
+            cap = (len + namelen) * 2;
+            names = realloc(names, cap);
+        }
+        if (count == entries_cap) {
+            entries_cap *= 2;
+            offsets = realloc(offsets, sizeof(size_t) * entries_cap);
+            is_dir = realloc(is_dir, entries_cap);
+        }
+        if (!names || !offsets || !is_dir) {
+            fprintf(stderr, "90s: Error allocating memory\n");
+            exit(EXIT_FAILURE);
+        }
+        bool dir = ent->d_type == DT_DIR;
+        if (ent->d_type == DT_LNK || ent->d_type == DT_UNKNOWN) {
+            dir = fstatat(dfd, ent->d_name, &st, 0) == 0 && S_ISDIR(st.st_mode);
+        }
+        memcpy(names + len, ent->d_name, namelen);
+        offsets[count] = len;
+        is_dir[count] = dir;
+        count++;
+        len += namelen;
+    }
+    closedir(dp);
+
+    c->names = names;
+    c->list.entries = memalloc(sizeof(direntry) * (count + 1));
+    c->list.count = count;
+    for (int i = 0; i < count; i++) {
+        c->list.entries[i].name = names + offsets[i];
+        c->list.entries[i].dir = is_dir[i];
+    }
+    free(offsets);
+    free(is_dir);
+    qsort(c->list.entries, count, sizeof(direntry), cmp_entry);
+    return true;
+}
+
+static void drop(cachedir *c)
+{
+    watch_remove(c->wd, on_change, c);
+    free(c->list.entries);
+    free(c->names);
+    free(c->path);
+    free(c);
+}
+
+static void drop_all(void)
+{
+    for (size_t i = 0; i < dirs.cap; i++) {
+        if (dirs.slots[i].key != NULL) {
+            drop(dirs.slots[i].val);
+        }
+    }
+    ht_clear(&dirs);
+    num_queued = 0;
+}
+
+// the entry for an absolute path, a new one is stale and not read yet
+static cachedir *lookup(const char *path)
+{
+    if (!dirs_ready) {
+        ht_init(&dirs, 64);
+        dirs_ready = true;
+    }
+    size_t len = strlen(path);
+    cachedir *c = ht_get(&dirs, path, len);
+    if (c != NULL) {
+        return c;
+    }
+    if (dirs.count >= DIRCACHE_MAX) {
+        drop_all();
+    }
+    c = memalloc(sizeof(cachedir));
+    c->path = memalloc(len + 1);
+    memcpy(c->path, path, len + 1);
+    c->list.entries = NULL;
+    c->list.count = 0;
+    c->names = NULL;
+    c->wd = -1;
+    c->stale = true;
+    c->loaded = false;
+    c->missing = false;
+    c->queued = false;
+    c->slow = -1;
+    ht_put(&dirs, c->path, len, c);
+    return c;
+}
+
+static void forget(cachedir *c)
+{
+    free(c->list.entries);
+    free(c->names);
+    c->list.entries = NULL;
+    c->list.count = 0;
+    c->names = NULL;
+    c->loaded = false;
+    c->missing = true;
+}
+
+// read a stale listing again, an unwatched one only when its mtime moved
+static void refresh(cachedir *c)
+{
+    if (c->wd == -1 && c->slow != 1) {
+        // watched before reading, a change meanwhile makes it stale again
+        c->wd = watch_add(c->path, DIR_EVENTS, on_change, c);
+    }
+    if (c->loaded && c->wd == -1) {
+        struct stat st;
+        if (stat(c->path, &st) == 0 && st.st_mtim.tv_sec == c->mtime.tv_sec &&
+                st.st_mtim.tv_nsec == c->mtime.tv_nsec) {
+            c->stale = false;
+            return;
+        }
+    }
+    if (load(c)) {
+        c->loaded = true;
+        c->missing = false;
+    } else {
+        forget(c);
+        c->stale = false; // tried again after the next prompt
+    }
+}
+
+// listing of an absolute path, NULL when it can not be read
+const dirlist *dircache_get(const char *path)
+{
+    watch_poll();
+    cachedir *c = lookup(path);
+    if (c->wd == -1) {
+        c->stale = true;
+    }
+    if (c->stale) {
+        refresh(c);
+    }
+    return c->loaded ? &c->list : NULL;
+}
+
+/*
+ * Whether name exists in the directory at path, answered from the cache
+ * alone. When the listing is not known yet it is queued for
+ * dircache_work() and PATH_UNKNOWN returned, an out of date one answers
+ * until it was read again. An empty name, . and .. ask about the
+ * directory itself.
+ */
+int dircache_peek(const char *path, const char *name)
+{
+    cachedir *c = lookup(path);
+    if (c->stale && !c->queued) {
+        if (num_queued == cap_queued) {
+            cap_queued = cap_queued == 0 ? 16 : cap_queued * 2;
+            queue = realloc(queue, sizeof(cachedir *) * cap_queued);
+            if (!queue) {
+                fprintf(stderr, "90s: Error allocating memory\n");
+                exit(EXIT_FAILURE);
+            }
+        }
+        queue[num_queued++] = c;
+        c->queued = true;
+    }
+    if (!c->loaded) {
+        return c->missing ? PATH_MISSING : PATH_UNKNOWN;
+    }
+    if (*name == '\0' || strcmp(name, ".") == 0 || strcmp(name, "..") == 0) {
+        return PATH_DIR;
+    }
+    size_t lo = 0, hi = c->list.count;
+    while (lo < hi) {
+        size_t mid = lo + (hi - lo) / 2;
+        int cmp = strcmp(c->list.entries[mid].name, name);
+        if (cmp == 0) {
+            return c->list.entries[mid].dir ? PATH_DIR : PATH_FILE;
+        } else if (cmp < 0) {
+            lo = mid + 1;
+        } else {
+            hi = mid;
+        }
+    }
+    return PATH_MISSING;
+}
+
+// /proc/self/mountinfo escapes blanks in mount points as octal
+static char *unescape(const char *s, size_t len)
+{
+    char *out = memalloc(len + 1), *p = out;
+    for (size_t i = 0; i < len; i++) {
+        if (s[i] == '\\' && i + 3 < len && s[i + 1] >= '0' && s[i + 1] <= '3') {
+            *p++ = (s[i + 1] - '0') * 64 + (s[i + 2] - '0') * 8 + (s[i + 3] - '0');
+            i += 3;
+        } else {
+            *p++ = s[i];
+        }
+    }
+    *p = '\0';
+    return out;
+}
+
+static bool slow_type(const char *type)
+{
+    static const char *slow[] = { "nfs", "nfs4", "cifs", "smb3", "smbfs", "9p", "afs",
+        "ceph", "glusterfs", "lustre", "sshfs", "davfs", "fuse" };
+    if (strncmp(type, "fuse.", 5) == 0) {
+        return true;
+    }
+    for (size_t i = 0; i < sizeof(slow) / sizeof(char *); i++) {
+        if (strcmp(type, slow[i]) == 0) {
+            return true;
+        }
+    }
+    return false;
+}
+
+static void read_mounts(void)
+{
+    for (int i = 0; i < num_mounts; i++) {
+        free(mounts[i].dir);
+    }
+    num_mounts = 0;
+    mounts_stale = false;
+    FILE *f = fopen("/proc/self/mountinfo", "re");
+    if (f == NULL) {
+        return;
+    }
+    char line[4096];
+    int cap = num_mounts;
+    while (fgets(line, sizeof(line), f) != NULL) {
+        // id parent major:minor root mount-point options... - type source
+        char *field = line;
+        for (int k = 0; k < 4 && field != NULL; k++) {
+            field = strchr(field, ' ');
+            field = field != NULL ? field + 1 : NULL;
+        }
+        char *end = field != NULL ? strchr(field, ' ') : NULL;
+        char *type = end != NULL ? strstr(end, " - ") : NULL;
+        if (type == NULL) {
+            continue;
+        }
+        type += 3;
+        type[strcspn(type, " ")] = '\0';
+        if (num_mounts == cap) {
+            cap = cap == 0 ? 64 : cap * 2;
+            mounts = realloc(mounts, sizeof(mount) * cap);
+            if (!mounts) {
+                fprintf(stderr, "90s: Error allocating memory\n");
+                exit(EXIT_FAILURE);
+            }
+        }
+        mount *m = &mounts[num_mounts++];
+        m->dir = unescape(field, end - field);
+        m->len = strlen(m->dir);
+        m->slow = slow_type(type);
+    }
+    fclose(f);
+}
+
+// whether the deepest mount holding path is a network or FUSE one
+static bool on_slow_mount(const char *path)
+{
+    if (mounts_stale) {
+        read_mounts();
+    }
+    size_t best = 0;
+    bool slow = false;
+    for (int i = 0; i < num_mounts; i++) {
+        mount *m = &mounts[i];
+        if (m->len >= best && strncmp(path, m->dir, m->len) == 0 &&
+                (m->len == 1 || path[m->len] == '/' || path[m->len] == '\0')) {
+            best = m->len;
+            slow = m->slow;
+        }
+    }
+    return slow;
+}
+
+/*
+ * Read a directory in a child, which writes one record per entry: 'd'
+ * or 'f' then the name and a NUL, in the sorted order of the listing
+ */
+static bool helper_run(cachedir *c)
+{
+    int fds[2];
+    if (pipe(fds) == -1) {
+        return false;
+    }
+    pid_t pid = fork();
+    if (pid == 0) {
+        close(fds[0]);
+        FILE *out = fdopen(fds[1], "w");
+        if (out == NULL || !load(c)) {
+            _exit(1);
+        }
+        for (int i = 0; i < c->list.count; i++) {
+            fputc(c->list.entries[i].dir ? 'd' : 'f', out);
+            fwrite(c->list.entries[i].name, 1, strlen(c->list.entries[i].name) + 1, out);
+        }
+        _exit(fclose(out) == 0 ? 0 : 1);
+    }
+    close(fds[1]);
+    if (pid == -1) {
+        close(fds[0]);
+        return false;
+    }
+    fcntl(fds[0], F_SETFL, O_NONBLOCK);
+    fcntl(fds[0], F_SETFD, FD_CLOEXEC);
+    helper = pid;
+    helper_fd = fds[0];
+    helper_start = time(NULL);
+    free(helper_path);
+    helper_path = memalloc(strlen(c->path) + 1);
+    strcpy(helper_path, c->path);
+    reply_len = 0;
+    return true;
+}
+
+static void helper_stop(void)
+{
+    close(helper_fd);
+    helper = -1;
+    helper_fd = -1;
+}
+
+static void reap_orphan(void)
+{
+    if (orphan != -1 && waitpid(orphan, NULL, WNOHANG) != 0) {
+        orphan = -1;
+    }
+    if (helper != -1 && time(NULL) - helper_start > DIRCACHE_TIMEOUT) {
+        kill(helper, SIGKILL);
+        orphan = helper; // stuck in the mount until it answers
+        cachedir *c = ht_get(&dirs, helper_path, strlen(helper_path));
+        if (c != NULL) {
+            c->queued = false;
+            c->stale = false; // tried again after the next prompt
+        }
+        helper_stop();
+    }
+}
+
+// descriptor to wait on while a slow directory is being read, -1 when none
+int dircache_fd(void)
+{
+    return helper_fd;
+}
+
+// take the listing the helper sent, true once it arrived
+bool dircache_collect(void)
+{
+    for (;;) {
+        if (reply_len == reply_cap) {
+            reply_cap = reply_cap == 0 ? 4096 : reply_cap * 2;
+            reply = realloc(reply, reply_cap);
+            if (!reply) {
+                fprintf(stderr, "90s: Error allocating memory\n");
+                exit(EXIT_FAILURE);
+            }
+        }
+        ssize_t n = read(helper_fd, reply + reply_len, reply_cap - reply_len);
+        if (n == -1 && errno == EINTR) {
+            continue;
+        }
+        if (n == -1) {
+            return false; // more to come
+        }
+        if (n == 0) {
+            break;
+        }
+        reply_len += n;
+    }
+    int status;
+    waitpid(helper, &status, 0);
+    helper_stop();
+    cachedir *c = ht_get(&dirs, helper_path, strlen(helper_path));
+    if (c == NULL) {
+        return false; // dropped meanwhile
+    }
+    c->queued = false;
+    c->stale = false;
+    if (!WIFEXITED(status) || WEXITSTATUS(status) != 0) {
+        forget(c);
+        return true;
+    }
+    int count = 0;
+    for (size_t i = 0; i < reply_len; i++) {
+        count += reply[i] == '\0';
+    }
+    free(c->list.entries);
+    free(c->names);
+    c->names = memalloc(reply_len + 1);
+    memcpy(c->names, reply, reply_len);
+    c->list.entries = memalloc(sizeof(direntry) * (count + 1));
+    c->list.count = count;
+    size_t off = 0;
+    for (int i = 0; i < count; i++) {
+        c->list.entries[i].dir = c->names[off] == 'd';
+        c->list.entries[i].name = c->names + off + 1;
+        off += strlen(c->names + off) + 1;
+    }
+    c->loaded = true;
+    c->missing = false;
+    return true;
+}
+
+// true while queued directories can be read
+bool dircache_busy(void)
+{
+    for (int i = 0; i < num_queued; i++) {
+        if (queue[i]->slow != 1 || (helper == -1 && orphan == -1)) {
+            return true;
+        }
+    }
+    return false;
+}
+
+/*
+ * Read some of the queued directories, slow ones go to the helper one at
+ * a time. True when a listing changed and the line should be drawn again.
+ */
+bool dircache_work(void)
+{
+    reap_orphan();
+    bool changed = false;
+    int budget = DIRCACHE_BUDGET, kept = 0;
+    for (int i = 0; i < num_queued; i++) {
+        cachedir *c = queue[i];
+        if (budget == 0) {
+            queue[kept++] = c;
+            continue;
+        }
+        if (c->slow == -1) {
+            c->slow = on_slow_mount(c->path);
+        }
+        if (c->slow == 1) {
+            if (helper != -1 || orphan != -1 || !helper_run(c)) {
+                queue[kept++] = c;
+            }
+            continue; // still queued until the helper is done
+        }
+        refresh(c);
+        c->queued = false;
+        changed = true;
+        budget--;
+    }
+    num_queued = kept;
+    return changed;
+}
+
+// a new prompt: unwatched listings and the mount table are checked again
+void dircache_expire(void)
+{
+    mounts_stale = true;
+    reap_orphan();
+    for (size_t i = 0; dirs_ready && i < dirs.cap; i++) {
+        cachedir *c = dirs.slots[i].val;
+        if (dirs.slots[i].key != NULL && c->wd == -1) {
+            c->stale = true;
+        }
+    }
+}
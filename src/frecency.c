@@ -0,0 +1,303 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <string.h>
+#include <strings.h>
+#include <time.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+#include <sys/uio.h>
+#include <sys/file.h>
+
+#include "frecency.h"
+#include "fuzzy.h"
+#include "history.h"
+#include "hash.h"
+#include "output.h"
+#include "constants.h"
+#include "90s.h"
+
+/*
+ * Directories cd went to, ranked by how often and how recently and by
+ * how well they fuzzy match what was typed for j. Every
+ * visit appends "count<TAB>time<TAB>path" to a file shared by all shells,
+ * which is read once and folded into a table the first time it is
+ * needed. When it holds many more lines than directories it is written
+ * back with one line each, and once the counts add up to too much they
+ * are scaled down so old favourites fade out. Appends hold a shared lock
+ * on the file and the rewrite an exclusive one, it reads what other
+ * shells appended since and then truncates the same file, so every
+ * shell keeps appending to the file that is read next.
+ */
+#define FRECENCY_MAX 10000.0 // counts are aged when their sum passes this
+
+typedef struct dirvisit {
+    char *path;
+    double count;
+    time_t last;
+} dirvisit;
+
+static dirvisit **visits = NULL;
+static int num_visits = 0;
+static int cap_visits = 0;
+static htable by_path;
+static double total = 0;
+static char *dirfile_path = NULL;
+static int dirfile_fd = -1;
+static off_t dirfile_read = 0; /* bytes of the file folded into the table */
+static bool loaded = false;
+
+static void add_visit(const char *path, size_t len, double count, time_t when)
+{
+    dirvisit *v = ht_get(&by_path, path, len);
+    if (v == NULL) {
+        if (num_visits == cap_visits) {
+            cap_visits = cap_visits == 0 ? 256 : cap_visits * 2;
+            visits = realloc(visits, sizeof(dirvisit *) * cap_visits);
+            if (!visits) {
+                fprintf(stderr, "90s: Error allocating memory\n");
+                exit(EXIT_FAILURE);
+            }
+        }
+        v = memalloc(sizeof(dirvisit));
+        v->path = memalloc(len + 1);
+        memcpy(v->path, path, len);
+        v->path[len] = '\0';
+        v->count = 0;
+        v->last = 0;
+        visits[num_visits++] = v;
+        ht_put(&by_path, v->path, len, v);
+    }
+    v->count += count;
+    if (when > v->last) {
+        v->last = when;
+    }
+    total += count;
+}
+
+// fold the lines of the file from dirfile_read up to size into the table
+static long read_visits(off_t size)
+{
+    if (size <= dirfile_read) {
+        return 0;
+    }
+    char *map = mmap(NULL, size, PROT_READ, MAP_PRIVATE, dirfile_fd, 0);
+    if (map == MAP_FAILED) {
+        return 0;
+    }
+    long lines = 0;
+    char *end = map + size;
+    char *p = map + dirfile_read;
+    while (p < end) {
+        char *nl = memchr(p, '\n', end - p);
+        if (nl == NULL) {
+            break; // a line still being written by another shell
+        }
+        char *rest;
+        double count = strtod(p, &rest);
+        if (*rest == '\t') {
+            time_t when = strtol(rest + 1, &rest, 10);
+            if (*rest == '\t' && rest + 1 < nl) {
+                add_visit(rest + 1, nl - rest - 1, count, when);
+                lines++;
+            }
+        }
+        p = nl + 1;
+    }
+    dirfile_read = p - map;
+    munmap(map, size);
+    return lines;
+}
+
+// one line per directory, counts scaled down when they add up to too much
+static void rewrite(void)
+{
+    if (flock(dirfile_fd, LOCK_EX) == -1) {
+        return;
+    }
+    struct stat st;
+    if (fstat(dirfile_fd, &st) == 0) {
+        read_visits(st.st_size); // visits other shells made since load
+    }
+    char *text = NULL;
+    size_t len = 0;
+    FILE *out = open_memstream(&text, &len);
+    if (out == NULL) {
+        flock(dirfile_fd, LOCK_UN);
+        return;
+    }
+    double scale = total > FRECENCY_MAX ? 0.9 * FRECENCY_MAX / total : 1;
+    int kept = 0;
+    total = 0;
+    for (int i = 0; i < num_visits; i++) {
+        dirvisit *v = visits[i];
+        v->count *= scale;
+        if (v->count < 1) {
+            ht_del(&by_path, v->path, strlen(v->path));
+            free(v->path);
+            free(v);
+            continue;
+        }
+        fprintf(out, "%g\t%ld\t%s\n", v->count, (long) v->last, v->path);
+        total += v->count;
+        visits[kept++] = v;
+    }
+    num_visits = kept;
+    if (fclose(out) == 0 && ftruncate(dirfile_fd, 0) == 0) {
+        // O_APPEND writes at the new end, which is the start
+        if (write(dirfile_fd, text, len) == (ssize_t) len) {
+            dirfile_read = len;
+        } else {
+            perror("90s");
+        }
+    }
+    free(text);
+    flock(dirfile_fd, LOCK_UN);
+}
+
+static void load(void)
+{
+    loaded = true;
+    ht_init(&by_path, 256);
+    dirfile_path = config_path(DIRFILE);
+    dirfile_fd = open(dirfile_path, O_RDWR | O_APPEND | O_CREAT | O_CLOEXEC, 0600);
+    struct stat st;
+    if (dirfile_fd == -1 || fstat(dirfile_fd, &st) == -1 || st.st_size == 0) {
+        return;
+    }
+    long lines = read_visits(st.st_size);
+    if (lines > 2 * num_visits + 1000 || total > FRECENCY_MAX) {
+        rewrite();
+    }
+}
+
+void frecency_visit(const char *path)
+{
+    if (!loaded) {
+        load();
+    }
+    time_t now = time(NULL);
+    add_visit(path, strlen(path), 1, now);
+    if (dirfile_fd != -1) {
+        char line[64];
+        int n = snprintf(line, sizeof(line), "1\t%ld\t", (long) now);
+        // one write, so lines of concurrent shells never interleave
+        struct iovec iov[3] = { { line, n }, { (char *) path, strlen(path) }, { "\n", 1 } };
+        flock(dirfile_fd, LOCK_SH); // not while another shell rewrites the file
+        if (writev(dirfile_fd, iov, 3) == -1) {
+            perror("90s");
+        }
+        flock(dirfile_fd, LOCK_UN);
+    }
+}
+
+// recent visits weigh more, like z and zoxide
+static double score(dirvisit *v, time_t now)
+{
+    time_t age = now - v->last;
+    if (age < 3600) {
+        return v->count * 4;
+    } else if (age < 86400) {
+        return v->count * 2;
+    } else if (age < 604800) {
+        return v->count / 2;
+    }
+    return v->count / 4;
+}
+
+/*
+ * How well the path matches, 0 when it does not: every fragment has to
+ * fuzzy match the path, the last one counts double when it matches the
+ * last component, where what one types for j usually is
+ */
+static int match_quality(const char *path, fuzzy *fragments, int num_fragments)
+{
+    size_t len = strlen(path);
+    const char *base = strrchr(path, '/');
+    base = base != NULL && base[1] != '\0' ? base + 1 : path;
+    int quality = 0;
+    for (int i = 0; i < num_fragments; i++) {
+        int score = -1;
+        if (i == num_fragments - 1) {
+            score = fuzzy_score(&fragments[i], base, len - (base - path));
+            score = score >= 0 ? score * 2 : -1;
+        }
+        if (score < 0) {
+            score = fuzzy_score(&fragments[i], path, len);
+        }
+        if (score < 0) {
+            return 0;
+        }
+        quality += score;
+    }
+    return quality > 0 ? quality : 1;
+}
+
+typedef struct rank {
+    double score;
+    int index;
+} rank;
+
+static int cmp_rank(const void *a, const void *b)
+{
+    const rank *x = a, *y = b;
+    return x->score < y->score ? 1 : x->score > y->score ? -1 : 0;
+}
+
+// the matching directories best first, in memory from the arena
+static rank *ranked(char **fragments, int *count)
+{
+    if (!loaded) {
+        load();
+    }
+    int num_fragments = 0;
+    while (fragments[num_fragments] != NULL) {
+        num_fragments++;
+    }
+    fuzzy *patterns = arena_alloc(sizeof(fuzzy) * (num_fragments + 1));
+    for (int i = 0; i < num_fragments; i++) {
+        fuzzy_init(&patterns[i], fragments[i], strlen(fragments[i]));
+    }
+    time_t now = time(NULL);
+    rank *ranks = arena_alloc(sizeof(rank) * (num_visits + 1));
+    int n = 0;
+    for (int i = 0; i < num_visits; i++) {
+        int quality = num_fragments > 0 ? match_quality(visits[i]->path, patterns, num_fragments) : 1;
+        if (quality > 0) {
+            ranks[n].score = score(visits[i], now) * quality;
+            ranks[n].index = i;
+            n++;
+        }
+    }
+    qsort(ranks, n, sizeof(rank), cmp_rank);
+    *count = n;
+    return ranks;
+}
+
+// the best directory for the fragments that still exists and is not skip
+const char *frecency_best(char **fragments, const char *skip)
+{
+    int n;
+    rank *ranks = ranked(fragments, &n);
+    for (int i = 0; i < n; i++) {
+        dirvisit *v = visits[ranks[i].index];
+        struct stat st;
+        if ((skip == NULL || strcmp(v->path, skip) != 0) &&
+                stat(v->path, &st) == 0 && S_ISDIR(st.st_mode)) {
+            return v->path;
+        }
+    }
+    return NULL;
+}
+
+void frecency_print(char **fragments, int limit)
+{
+    int n;
+    rank *ranks = ranked(fragments, &n);
+    // best last, next to the prompt
+    for (int i = (n < limit ? n : limit) - 1; i >= 0; i--) {
+        out_printf("%-10.1f%s\n", ranks[i].score, visits[ranks[i].index]->path);
+    }
+}
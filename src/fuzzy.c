@@ -0,0 +1,150 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+#include <stdbool.h>
+#if defined(__AVX2__) || defined(__SSE2__)
+#include <immintrin.h>
+#endif
+
+#include "fuzzy.h"
+
+/*
+ * fzf style fuzzy matching: the pattern has to appear in the text as a
+ * subsequence, matches that are consecutive, start words or start the
+ * text score higher and gaps cost. Ignores case unless the pattern has
+ * an upper case letter.
+ *
+ * Most candidates do not match at all, so the time goes into finding the
+ * next occurrence of each pattern byte. That scan compares 32 (AVX2) or
+ * 16 (SSE2) text bytes against both cases of the byte at once, other
+ * machines use the byte loop. Building with -mavx2 selects the wider one.
+ */
+#define SCORE_MATCH 16
+#define SCORE_GAP_START -3
+#define SCORE_GAP_EXTENSION -1
+#define BONUS_BOUNDARY 8 /* after a separator or at the start */
+#define BONUS_CAMEL 7 /* lower to upper case change */
+#define BONUS_CONSECUTIVE 4
+
+void fuzzy_init(fuzzy *f, const char *pattern, size_t len)
+{
+    bool exact_case = false;
+    f->len = len < FUZZY_MAX ? len : FUZZY_MAX;
+    for (size_t i = 0; i < f->len; i++) {
+        exact_case |= isupper((unsigned char) pattern[i]) != 0;
+    }
+    for (size_t i = 0; i < f->len; i++) {
+        unsigned char c = pattern[i];
+        f->lower[i] = exact_case ? c : tolower(c);
+        f->upper[i] = exact_case ? c : toupper(c);
+    }
+}
+
+// first index from pos on holding a or b, len when there is none
+static size_t find2(const char *s, size_t pos, size_t len, char a, char b)
+{
+#if defined(__AVX2__)
+    __m256i va = _mm256_set1_epi8(a), vb = _mm256_set1_epi8(b);
+    for (; pos + 32 <= len; pos += 32) {
+        __m256i block = _mm256_loadu_si256((const __m256i *) (s + pos));
+        unsigned mask = _mm256_movemask_epi8(_mm256_or_si256(
+                    _mm256_cmpeq_epi8(block, va), _mm256_cmpeq_epi8(block, vb)));
+        if (mask != 0) {
+            return pos + __builtin_ctz(mask);
+        }
+    }
+#elif defined(__SSE2__)
+    __m128i va = _mm_set1_epi8(a), vb = _mm_set1_epi8(b);
+    for (; pos + 16 <= len; pos += 16) {
+        __m128i block = _mm_loadu_si128((const __m128i *) (s + pos));
+        unsigned mask = _mm_movemask_epi8(_mm_or_si128(
+                    _mm_cmpeq_epi8(block, va), _mm_cmpeq_epi8(block, vb)));
+        if (mask != 0) {
+            return pos + __builtin_ctz(mask);
+        }
+    }
+#endif
+    for (; pos < len; pos++) {
+        if (s[pos] == a || s[pos] == b) {
+            return pos;
+        }
+    }
+    return len;
+}
+
+static bool same(const fuzzy *f, size_t i, char c)
+{
+    return c == f->lower[i] || c == f->upper[i];
+}
+
+static int bonus_at(const char *text, size_t i)
+{
+    if (i == 0) {
+        return BONUS_BOUNDARY;
+    }
+    unsigned char prev = text[i - 1], c = text[i];
+    if (strchr("/ -_.:=,;\t", prev) != NULL && prev != '\0') {
+        return BONUS_BOUNDARY;
+    }
+    if (islower(prev) && isupper(c)) {
+        return BONUS_CAMEL;
+    }
+    return 0;
+}
+
+/*
+ * Score of the text for the pattern, -1 when it does not match. The
+ * window scored is the shortest one ending where the leftmost full match
+ * ends, found by walking back from there.
+ */
+int fuzzy_score(const fuzzy *f, const char *text, size_t len)
+{
+    if (f->len == 0) {
+        return 0;
+    }
+    size_t pos = 0;
+    for (size_t i = 0; i < f->len; i++) {
+        pos = find2(text, pos, len, f->lower[i], f->upper[i]);
+        if (pos == len) {
+            return -1;
+        }
+        pos++;
+    }
+    size_t end = pos, start = end;
+    for (size_t i = f->len; i-- > 0; ) {
+        while (!same(f, i, text[--start])) {
+        }
+    }
+
+    int score = 0, consecutive_bonus = 0;
+    bool in_gap = false, prev_matched = false;
+    size_t k = 0;
+    for (size_t i = start; i < end; i++) {
+        if (k < f->len && same(f, k, text[i])) {
+            int bonus = bonus_at(text, i);
+            if (prev_matched) {
+                // a run keeps the bonus of where it started
+                if (bonus > consecutive_bonus) {
+                    consecutive_bonus = bonus;
+                }
+                if (consecutive_bonus < BONUS_CONSECUTIVE) {
+                    consecutive_bonus = BONUS_CONSECUTIVE;
+                }
+                bonus = consecutive_bonus;
+            } else {
+                consecutive_bonus = bonus;
+            }
+            score += SCORE_MATCH + (k == 0 ? bonus * 2 : bonus);
+            k++;
+            in_gap = false;
+            prev_matched = true;
+        } else {
+            score += in_gap ? SCORE_GAP_EXTENSION : SCORE_GAP_START;
+            in_gap = true;
+            prev_matched = false;
+            consecutive_bonus = 0;
+        }
+    }
+    return score;
+}
@@ -0,0 +1,723 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+#include <limits.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+#include <sys/inotify.h>
+
+#include "gitstat.h"
+#include "watch.h"
+#include "hash.h"
+#include "90s.h"
+
+/*
+ * Git state for the prompt read straight from .git: HEAD, the branch and
+ * its upstream from the loose refs, packed-refs and config, and whether
+ * the work tree differs from the index by comparing the stat data the
+ * index records against lstat of each tracked file. Work tree
+ * directories are watched with inotify, so after the first pass only
+ * directories something happened in are looked at again and a clean
+ * repository costs a handful of small reads per prompt. The stat pass is
+ * done in slices while the line editor is idle. Staged changes are
+ * noticed through the index's cache tree, which git invalidates when the
+ * index stops matching the last written tree. Objects are compressed,
+ * so ahead/behind counts are left to git itself.
+ */
+#define TREE_EVENTS (IN_ATTRIB | IN_MODIFY | IN_CLOSE_WRITE | IN_CREATE | IN_DELETE | \
+        IN_MOVED_FROM | IN_MOVED_TO | IN_DELETE_SELF | IN_MOVE_SELF | IN_ONLYDIR)
+#define GITDIR_EVENTS (IN_CLOSE_WRITE | IN_MOVED_TO | IN_CREATE | IN_DELETE)
+
+typedef struct gitentry {
+    uint32_t ctime_s, ctime_ns, mtime_s, mtime_ns, ino, mode, size;
+    uint32_t path; /* offset in paths */
+    uint32_t name; /* offset of the last component */
+    bool checked;
+    bool dirty;
+} gitentry;
+
+typedef struct tdir {
+    struct gitrepo *repo;
+    char *path; /* relative to the work tree, "" for its root */
+    int wd;
+    int *entries;
+    int num_entries;
+    bool queued;
+    bool used;
+} tdir;
+
+struct gitrepo {
+    char *root;
+    char *gitdir;
+    char *common; /* refs, packed-refs and config, shared by worktrees */
+    char branch[256]; /* empty when detached */
+    char oid[65];
+    char upstream[65];
+    char range[140]; /* oid...upstream the counts belong to */
+    long ahead, behind;
+    char *paths;
+    gitentry *entries;
+    int num_entries;
+    htable dirs; /* path -> tdir */
+    tdir **queue;
+    int queue_len;
+    int dirty; /* checked entries that differ */
+    int unchecked;
+    int conflicts;
+    bool staged;
+    bool sha256; /* longer object ids */
+    bool unknown; /* index format we can not read */
+    bool head_changed;
+    bool index_changed;
+    int unwatched; /* directories inotify refused */
+};
+
+static htable repos; /* work tree root -> gitrepo */
+static bool repos_ready = false;
+
+static char *dupstr(const char *s)
+{
+    char *copy = memalloc(strlen(s) + 1);
+    strcpy(copy, s);
+    return copy;
+}
+
+// read a small file, without the trailing newline
+static int read_file(const char *path, char *buf, size_t size)
+{
+    int fd = open(path, O_RDONLY | O_CLOEXEC);
+    if (fd == -1) {
+        return -1;
+    }
+    ssize_t n = read(fd, buf, size - 1);
+    close(fd);
+    if (n < 0) {
+        return -1;
+    }
+    while (n > 0 && (buf[n - 1] == '\n' || buf[n - 1] == '\r')) {
+        n--;
+    }
+    buf[n] = '\0';
+    return n;
+}
+
+// dir/name into a PATH_MAX buffer, false when it does not fit
+static bool join(char *out, const char *dir, const char *name)
+{
+    size_t dir_len = strlen(dir), name_len = strlen(name);
+    if (dir_len + 1 + name_len >= PATH_MAX) {
+        return false;
+    }
+    memcpy(out, dir, dir_len);
+    out[dir_len] = '/';
+    memcpy(out + dir_len + 1, name, name_len + 1);
+    return true;
+}
+
+static bool is_oid(const char *s)
+{
+    size_t n = strspn(s, "0123456789abcdef");
+    return (n == 40 || n == 64) && (s[n] == '\0' || s[n] == '\n' || s[n] == ' ');
+}
+
+static void copy_oid(char *oid, const char *s)
+{
+    size_t n = strspn(s, "0123456789abcdef");
+    memcpy(oid, s, n);
+    oid[n] = '\0';
+}
+
+static void queue_dir(tdir *d)
+{
+    if (!d->queued) {
+        d->queued = true;
+        d->repo->queue[d->repo->queue_len++] = d;
+    }
+}
+
+static void on_gitdir(void *data, const char *name, uint32_t mask)
+{
+    gitrepo *r = data;
+    if (name == NULL || strcmp(name, "index") == 0) {
+        r->index_changed = true;
+    }
+    if (name == NULL || strcmp(name, "HEAD") == 0 || strcmp(name, "packed-refs") == 0 ||
+            strcmp(name, "config") == 0) {
+        r->head_changed = true;
+    }
+}
+
+static void on_tree(void *data, const char *name, uint32_t mask)
+{
+    tdir *d = data;
+    if (mask & (IN_IGNORED | IN_DELETE_SELF | IN_MOVE_SELF)) {
+        if (d->wd != -1 && !(mask & IN_IGNORED)) {
+            watch_remove(d->wd, on_tree, d);
+        }
+        d->wd = -1; // watched again once it is scanned
+    } else if (name != NULL && (mask & IN_ISDIR) && (mask & (IN_CREATE | IN_MOVED_TO))) {
+        // a tracked directory that was gone may be back
+        char path[PATH_MAX];
+        int len = snprintf(path, sizeof(path), "%s%s%s", d->path, d->path[0] ? "/" : "", name);
+        tdir *child = ht_get(&d->repo->dirs, path, len);
+        if (child != NULL && child->wd == -1) {
+            queue_dir(child);
+        }
+    }
+    queue_dir(d);
+}
+
+static uint32_t be32(const unsigned char *p)
+{
+    return (uint32_t) p[0] << 24 | (uint32_t) p[1] << 16 | (uint32_t) p[2] << 8 | p[3];
+}
+
+static tdir *dir_of(gitrepo *r, const char *path, size_t len)
+{
+    tdir *d = ht_get(&r->dirs, path, len);
+    if (d == NULL) {
+        d = memalloc(sizeof(tdir));
+        d->repo = r;
+        d->path = memalloc(len + 1);
+        memcpy(d->path, path, len);
+        d->path[len] = '\0';
+        d->wd = -1;
+        d->entries = NULL;
+        d->num_entries = 0;
+        d->queued = false;
+        d->used = false;
+        ht_put(&r->dirs, d->path, len, d);
+    }
+    if (!d->used) {
+        d->used = true;
+        d->num_entries = 0;
+    }
+    return d;
+}
+
+static void dir_add(tdir *d, int entry)
+{
+    int n = d->num_entries;
+    if ((n & (n - 1)) == 0) {
+        d->entries = realloc(d->entries, sizeof(int) * (n == 0 ? 1 : n * 2));
+        if (!d->entries) {
+            fprintf(stderr, "90s: Error allocating memory\n");
+            exit(EXIT_FAILURE);
+        }
+    }
+    d->entries[d->num_entries++] = entry;
+}
+
+static bool same_index_stat(gitentry *a, gitentry *b)
+{
+    return a->ctime_s == b->ctime_s && a->ctime_ns == b->ctime_ns && a->mtime_s == b->mtime_s &&
+        a->mtime_ns == b->mtime_ns && a->ino == b->ino && a->mode == b->mode && a->size == b->size;
+}
+
+/*
+ * Read the index. Entries whose recorded stat data did not change keep
+ * what the last pass found, only the others are queued to be checked.
+ */
+static void load_index(gitrepo *r)
+{
+    char path[PATH_MAX];
+    snprintf(path, sizeof(path), "%s/index", r->gitdir);
+    gitentry *old = r->entries;
+    char *old_paths = r->paths;
+    int old_count = r->num_entries;
+    r->entries = NULL;
+    r->paths = NULL;
+    r->num_entries = 0;
+    r->dirty = r->unchecked = r->conflicts = 0;
+    r->staged = false;
+    r->unknown = false;
+    for (size_t i = 0; i < r->dirs.cap; i++) {
+        if (r->dirs.slots[i].key != NULL) {
+            ((tdir *) r->dirs.slots[i].val)->used = false;
+        }
+    }
+
+    int fd = open(path, O_RDONLY | O_CLOEXEC);
+    struct stat st;
+    unsigned char *map = MAP_FAILED;
+    if (fd != -1 && fstat(fd, &st) == 0 && st.st_size >= 32) {
+        map = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    }
+    if (fd != -1) {
+        close(fd);
+    }
+    size_t size = map != MAP_FAILED ? st.st_size - 20 : 0; // trailing checksum
+    uint32_t version = size > 0 ? be32(map + 4) : 0;
+    if (size > 0 && (memcmp(map, "DIRC", 4) != 0 || version < 2 || version > 4)) {
+        r->unknown = true;
+        size = 0;
+    }
+    uint32_t count = size > 0 ? be32(map + 8) : 0;
+    r->entries = memalloc(sizeof(gitentry) * (count + 1));
+    size_t paths_cap = size + 1, paths_len = 0;
+    r->paths = memalloc(paths_cap);
+    size_t off = 12, oid_len = r->sha256 ? 32 : 20;
+    for (uint32_t i = 0; i < count && !r->unknown; i++) {
+        if (off + 62 > size) {
+            r->unknown = true;
+            break;
+        }
+        const unsigned char *p = map + off;
+        gitentry *e = &r->entries[r->num_entries];
+        e->ctime_s = be32(p);
+        e->ctime_ns = be32(p + 4);
+        e->mtime_s = be32(p + 8);
+        e->mtime_ns = be32(p + 12);
+        e->ino = be32(p + 20);
+        e->mode = be32(p + 24);
+        e->size = be32(p + 36);
+        size_t flags_at = 40 + oid_len;
+        unsigned flags = p[flags_at] << 8 | p[flags_at + 1];
+        unsigned extended = 0;
+        size_t name_at = flags_at + 2;
+        if (version >= 3 && (flags & 0x4000)) {
+            extended = p[name_at] << 8 | p[name_at + 1];
+            name_at += 2;
+        }
+        const char *name = (const char *) p + name_at;
+        size_t room = size - off - name_at;
+        size_t name_len = strnlen(name, room);
+        if (name_len == room) {
+            r->unknown = true;
+            break;
+        }
+        if (version == 4) {
+            // a varint of bytes to drop from the previous path, then the rest
+            const unsigned char *v = (const unsigned char *) name;
+            size_t strip = *v & 127;
+            while (*v++ & 128) {
+                strip = ((strip + 1) << 7) | (*v & 127);
+            }
+            const char *rest = (const char *) v;
+            size_t rest_len = strlen(rest);
+            size_t prev_len = r->num_entries > 0 ? strlen(r->paths + r->entries[r->num_entries - 1].path) : 0;
+            if (strip > prev_len) {
+                r->unknown = true;
+                break;
+            }
+            size_t keep = prev_len - strip;
+            if (paths_len + keep + rest_len + 1 > paths_cap) {
+                paths_cap = (paths_len + keep + rest_len + 1) * 2;
+                r->paths = realloc(r->paths, paths_cap);
+                if (!r->paths) {
+                    fprintf(stderr, "90s: Error allocating memory\n");
+                    exit(EXIT_FAILURE);
+                }
+            }
+            if (keep > 0) {
+                memmove(r->paths + paths_len, r->paths + r->entries[r->num_entries - 1].path, keep);
+            }
+            memcpy(r->paths + paths_len + keep, rest, rest_len + 1);
+            e->path = paths_len;
+            paths_len += keep + rest_len + 1;
+            off += name_at + (rest - name) + rest_len + 1;
+        } else {
+            memcpy(r->paths + paths_len, name, name_len + 1);
+            e->path = paths_len;
+            paths_len += name_len + 1;
+            off += (name_at + name_len + 8) & ~(size_t) 7;
+        }
+        if ((flags >> 12) & 3) {
+            r->conflicts++; // unmerged
+            continue;
+        }
+        if ((extended & 0x4000) || (e->mode & 0170000) == 0160000) {
+            continue; // skip-worktree or submodule, nothing to look at
+        }
+        if (extended & 0x2000) {
+            r->staged = true; // intent to add
+        }
+        const char *full = r->paths + e->path;
+        const char *slash = strrchr(full, '/');
+        e->name = slash != NULL ? slash + 1 - r->paths : e->path;
+        e->checked = false;
+        e->dirty = false;
+        r->num_entries++;
+        dir_add(dir_of(r, full, slash != NULL ? (size_t) (slash - full) : 0), r->num_entries - 1);
+    }
+    // extensions, only the root of the cache tree is of interest
+    while (!r->unknown && off + 8 <= size) {
+        uint32_t len = be32(map + off + 4);
+        if (memcmp(map + off, "link", 4) == 0) {
+            r->unknown = true; // split index, entries live elsewhere
+        } else if (memcmp(map + off, "TREE", 4) == 0 && len > 2 && map[off + 8] == '\0') {
+            r->staged |= map[off + 9] == '-'; // root entry count -1, invalidated
+        }
+        off += 8 + len;
+    }
+    if (map != MAP_FAILED) {
+        munmap(map, st.st_size);
+    }
+
+    // carry over what is known for entries whose stat data is unchanged
+    int j = 0;
+    for (int i = 0; i < r->num_entries; i++) {
+        gitentry *e = &r->entries[i];
+        int cmp = 1;
+        while (j < old_count && (cmp = strcmp(old_paths + old[j].path, r->paths + e->path)) < 0) {
+            j++;
+        }
+        if (j < old_count && cmp == 0 && old[j].checked && same_index_stat(&old[j], e)) {
+            e->checked = true;
+            e->dirty = old[j].dirty;
+            r->dirty += e->dirty;
+        } else {
+            r->unchecked++;
+        }
+    }
+    free(old);
+    free(old_paths);
+
+    // directories that no longer hold tracked files are forgotten
+    free(r->queue);
+    r->queue = memalloc(sizeof(tdir *) * (r->dirs.count + 1));
+    int gone = 0;
+    for (size_t i = 0; i < r->dirs.cap; i++) {
+        tdir *d = r->dirs.slots[i].val;
+        if (r->dirs.slots[i].key != NULL && !d->used) {
+            r->queue[gone++] = d;
+        }
+    }
+    for (int i = 0; i < gone; i++) {
+        tdir *d = r->queue[i];
+        ht_del(&r->dirs, d->path, strlen(d->path));
+        watch_remove(d->wd, on_tree, d);
+        free(d->entries);
+        free(d->path);
+        free(d);
+    }
+    r->queue_len = 0;
+    r->unwatched = 0;
+    for (size_t i = 0; i < r->dirs.cap; i++) {
+        if (r->dirs.slots[i].key == NULL) {
+            continue;
+        }
+        tdir *d = r->dirs.slots[i].val;
+        d->queued = false;
+        bool stale = d->wd == -1;
+        for (int k = 0; k < d->num_entries && !stale; k++) {
+            stale = !r->entries[d->entries[k]].checked;
+        }
+        if (stale) {
+            queue_dir(d);
+        }
+    }
+}
+
+// refs/heads/x from the loose ref file or packed-refs
+static bool resolve(gitrepo *r, const char *ref, char *oid)
+{
+    char path[PATH_MAX], buf[128];
+    snprintf(path, sizeof(path), "%s/%s", r->common, ref);
+    if (read_file(path, buf, sizeof(buf)) > 0 && is_oid(buf)) {
+        copy_oid(oid, buf);
+        return true;
+    }
+    snprintf(path, sizeof(path), "%s/packed-refs", r->common);
+    FILE *packed = fopen(path, "r");
+    if (packed == NULL) {
+        return false;
+    }
+    char line[PATH_MAX + 80];
+    size_t ref_len = strlen(ref);
+    bool found = false;
+    while (!found && fgets(line, sizeof(line), packed) != NULL) {
+        char *space = strchr(line, ' ');
+        if (space != NULL && is_oid(line) && strncmp(space + 1, ref, ref_len) == 0 &&
+                (space[1 + ref_len] == '\n' || space[1 + ref_len] == '\0')) {
+            copy_oid(oid, line);
+            found = true;
+        }
+    }
+    fclose(packed);
+    return found;
+}
+
+static char *trim(char *s)
+{
+    while (*s == ' ' || *s == '\t') {
+        s++;
+    }
+    char *end = s + strlen(s);
+    while (end > s && (end[-1] == ' ' || end[-1] == '\t' || end[-1] == '\n' || end[-1] == '\r')) {
+        end--;
+    }
+    *end = '\0';
+    return s;
+}
+
+// the upstream of the branch as a ref name, from [branch "name"] in config
+static bool upstream_ref(gitrepo *r, char *ref, size_t size)
+{
+    char path[PATH_MAX], line[1024], remote[256] = "", merge[512] = "";
+    snprintf(path, sizeof(path), "%s/config", r->common);
+    FILE *config = fopen(path, "r");
+    if (config == NULL) {
+        return false;
+    }
+    char section[300] = "";
+    if (r->branch[0] != '\0') {
+        snprintf(section, sizeof(section), "[branch \"%s\"]", r->branch);
+    }
+    bool in_branch = false;
+    r->sha256 = false;
+    while (fgets(line, sizeof(line), config) != NULL) {
+        char *s = trim(line);
+        if (*s == '[') {
+            in_branch = section[0] != '\0' && strcmp(s, section) == 0;
+            continue;
+        }
+        char *eq = strchr(s, '=');
+        if (eq == NULL) {
+            continue;
+        }
+        *eq = '\0';
+        char *key = trim(s), *value = trim(eq + 1);
+        if (in_branch && strcmp(key, "remote") == 0) {
+            snprintf(remote, sizeof(remote), "%s", value);
+        } else if (in_branch && strcmp(key, "merge") == 0) {
+            snprintf(merge, sizeof(merge), "%s", value);
+        } else if (strcmp(key, "objectformat") == 0 && strcmp(value, "sha256") == 0) {
+            r->sha256 = true;
+        }
+    }
+    fclose(config);
+    if (remote[0] == '\0' || strncmp(merge, "refs/heads/", 11) != 0) {
+        return false;
+    }
+    if (strcmp(remote, ".") == 0) {
+        snprintf(ref, size, "%s", merge);
+    } else {
+        snprintf(ref, size, "refs/remotes/%s/%s", remote, merge + 11);
+    }
+    return true;
+}
+
+static void read_head(gitrepo *r)
+{
+    char path[PATH_MAX], buf[PATH_MAX], ref[PATH_MAX];
+    r->branch[0] = r->oid[0] = r->upstream[0] = '\0';
+    snprintf(path, sizeof(path), "%s/HEAD", r->gitdir);
+    if (read_file(path, buf, sizeof(buf)) <= 0) {
+        return;
+    }
+    if (strncmp(buf, "ref: ", 5) != 0) {
+        if (is_oid(buf)) {
+            copy_oid(r->oid, buf); // detached
+        }
+    } else {
+        const char *head = buf + 5;
+        snprintf(r->branch, sizeof(r->branch), "%.255s",
+                strncmp(head, "refs/heads/", 11) == 0 ? head + 11 : head);
+        resolve(r, head, r->oid); // fails on a branch without commits yet
+    }
+    if (upstream_ref(r, ref, sizeof(ref))) {
+        resolve(r, ref, r->upstream);
+    }
+}
+
+static gitrepo *repo_new(const char *root, const char *dotgit, struct stat *st)
+{
+    char gitdir[PATH_MAX], common[PATH_MAX], buf[PATH_MAX];
+    if (S_ISDIR(st->st_mode)) {
+        snprintf(gitdir, sizeof(gitdir), "%s", dotgit);
+    } else {
+        // worktrees and submodules point to their git directory
+        if (read_file(dotgit, buf, sizeof(buf)) <= 8 || strncmp(buf, "gitdir: ", 8) != 0) {
+            return NULL;
+        }
+        if (buf[8] == '/') {
+            snprintf(gitdir, sizeof(gitdir), "%s", buf + 8);
+        } else if (!join(gitdir, root, buf + 8)) {
+            return NULL;
+        }
+    }
+    if (!join(common, gitdir, "commondir")) {
+        return NULL;
+    }
+    if (read_file(common, buf, sizeof(buf)) > 0) {
+        if (buf[0] == '/') {
+            snprintf(common, sizeof(common), "%s", buf);
+        } else if (!join(common, gitdir, buf)) {
+            return NULL;
+        }
+    } else {
+        snprintf(common, sizeof(common), "%s", gitdir);
+    }
+    if (!join(buf, gitdir, "HEAD") || access(buf, F_OK) != 0) {
+        return NULL;
+    }
+
+    gitrepo *r = memalloc(sizeof(gitrepo));
+    memset(r, 0, sizeof(gitrepo));
+    r->root = dupstr(root);
+    r->gitdir = dupstr(gitdir);
+    r->common = dupstr(common);
+    ht_init(&r->dirs, 64);
+    r->head_changed = true;
+    r->index_changed = true;
+    watch_add(r->gitdir, GITDIR_EVENTS, on_gitdir, r);
+    if (strcmp(r->common, r->gitdir) != 0) {
+        watch_add(r->common, GITDIR_EVENTS, on_gitdir, r);
+    }
+    ht_put(&repos, r->root, strlen(r->root), r);
+    return r;
+}
+
+// the repository whose work tree holds dir, NULL when there is none
+gitrepo *git_open(const char *dir)
+{
+    char path[PATH_MAX], dotgit[PATH_MAX];
+    struct stat st;
+    if (!repos_ready) {
+        ht_init(&repos, 16);
+        repos_ready = true;
+    }
+    snprintf(path, sizeof(path), "%s", dir);
+    for (;;) {
+        size_t len = strlen(path);
+        if (join(dotgit, strcmp(path, "/") == 0 ? "" : path, ".git") && stat(dotgit, &st) == 0) {
+            gitrepo *r = ht_get(&repos, path, len);
+            return r != NULL ? r : repo_new(path, dotgit, &st);
+        }
+        char *slash = strrchr(path, '/');
+        if (slash == NULL || len <= 1) {
+            return NULL;
+        }
+        slash[slash == path ? 1 : 0] = '\0';
+    }
+}
+
+// apply what inotify reported, head is read again anyway when asked
+void git_update(gitrepo *r, bool head)
+{
+    if (head || r->head_changed) {
+        r->head_changed = false;
+        read_head(r);
+    }
+    if (r->index_changed) {
+        r->index_changed = false;
+        load_index(r);
+    }
+    if (r->unwatched > 0) {
+        // no events from these, look at them every time
+        for (size_t i = 0; i < r->dirs.cap; i++) {
+            if (r->dirs.slots[i].key != NULL && ((tdir *) r->dirs.slots[i].val)->wd == -1) {
+                queue_dir(r->dirs.slots[i].val);
+            }
+        }
+        r->unwatched = 0;
+    }
+}
+
+bool git_busy(gitrepo *r)
+{
+    return r->queue_len > 0;
+}
+
+static bool same_stat(gitentry *e, struct stat *st)
+{
+    if ((uint32_t) st->st_mtim.tv_sec != e->mtime_s || (uint32_t) st->st_ctim.tv_sec != e->ctime_s ||
+            (uint32_t) st->st_size != e->size || (uint32_t) st->st_ino != e->ino) {
+        return false;
+    }
+    // nanoseconds are 0 when git was built without them
+    if ((e->mtime_ns != 0 && (uint32_t) st->st_mtim.tv_nsec != e->mtime_ns) ||
+            (e->ctime_ns != 0 && (uint32_t) st->st_ctim.tv_nsec != e->ctime_ns)) {
+        return false;
+    }
+    if ((e->mode & 0170000) == 0120000) {
+        return S_ISLNK(st->st_mode);
+    }
+    return S_ISREG(st->st_mode) && (e->mode & 0100) == (st->st_mode & 0100);
+}
+
+// stat the tracked files of one directory, returns the syscalls spent
+static int scan_dir(gitrepo *r, tdir *d)
+{
+    char path[PATH_MAX];
+    snprintf(path, sizeof(path), "%s/%s", r->root, d->path);
+    if (d->wd == -1) {
+        // watch first, so a change during the scan is not missed
+        d->wd = watch_add(path, TREE_EVENTS, on_tree, d);
+        if (d->wd == -1) {
+            r->unwatched++;
+        }
+    }
+    int dfd = open(path, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    for (int i = 0; i < d->num_entries; i++) {
+        gitentry *e = &r->entries[d->entries[i]];
+        struct stat st;
+        bool dirty = dfd == -1 || fstatat(dfd, r->paths + e->name, &st, AT_SYMLINK_NOFOLLOW) == -1 ||
+            !same_stat(e, &st);
+        if (e->checked) {
+            r->dirty -= e->dirty;
+        } else {
+            r->unchecked--;
+        }
+        e->checked = true;
+        e->dirty = dirty;
+        r->dirty += dirty;
+    }
+    if (dfd != -1) {
+        close(dfd);
+    }
+    return d->num_entries + 2;
+}
+
+// check queued directories until about budget syscalls were made
+void git_work(gitrepo *r, int budget)
+{
+    while (budget > 0 && r->queue_len > 0) {
+        tdir *d = r->queue[--r->queue_len];
+        d->queued = false;
+        budget -= scan_dir(r, d);
+    }
+}
+
+// "oid...upstream" when the branch and its upstream differ and nobody counted yet
+const char *git_range(gitrepo *r)
+{
+    static char range[140];
+    if (r->oid[0] == '\0' || r->upstream[0] == '\0' || strcmp(r->oid, r->upstream) == 0) {
+        return NULL;
+    }
+    snprintf(range, sizeof(range), "%s...%s", r->oid, r->upstream);
+    return strcmp(range, r->range) == 0 ? NULL : range;
+}
+
+void git_counts(gitrepo *r, const char *range, long ahead, long behind)
+{
+    snprintf(r->range, sizeof(r->range), "%s", range);
+    r->ahead = ahead;
+    r->behind = behind;
+}
+
+// "branch* +ahead -behind", * once the work tree or index is known to differ, ? when unreadable
+void git_segment(gitrepo *r, char *buf, size_t size)
+{
+    char short_oid[8];
+    snprintf(short_oid, sizeof(short_oid), "%.7s", r->oid);
+    const char *name = r->branch[0] != '\0' ? r->branch : short_oid;
+    bool dirty = r->dirty > 0 || r->conflicts > 0 || r->staged;
+    int n = snprintf(buf, size, "%s%s", name, dirty ? "*" : r->unknown ? "?" : "");
+    char range[140];
+    snprintf(range, sizeof(range), "%s...%s", r->oid, r->upstream);
+    if (r->upstream[0] != '\0' && strcmp(range, r->range) == 0) {
+        if (r->ahead > 0) {
+            n += snprintf(buf + n, size - n, " +%ld", r->ahead);
+        }
+        if (r->behind > 0) {
+            snprintf(buf + n, size - n, " -%ld", r->behind);
+        }
+    }
+}
@@ -0,0 +1,132 @@
+#include <stdlib.h>
+#include <string.h>
+
+#include "hash.h"
+#include "90s.h"
+
+/* FNV-1a */
+unsigned long strhash(const char *s, size_t len)
+{
+    unsigned long h = 2166136261UL;
+    for (size_t i = 0; i < len; i++) {
+        h ^= (unsigned char) s[i];
+        h *= 16777619UL;
+    }
+    return h;
+}
+
+void ht_init(htable *t, size_t cap)
+{
+    size_t size = 16;
+    while (size < cap * 2) {
+        size <<= 1;
+    }
+    t->slots = memalloc(sizeof(hentry) * size);
+    memset(t->slots, 0, sizeof(hentry) * size);
+    t->cap = size;
+    t->count = 0;
+}
+
+void ht_free(htable *t)
+{
+    free(t->slots);
+    t->slots = NULL;
+    t->cap = 0;
+    t->count = 0;
+}
+
+void ht_clear(htable *t)
+{
+    memset(t->slots, 0, sizeof(hentry) * t->cap);
+    t->count = 0;
+}
+
+static hentry *probe(htable *t, const char *key, size_t len, unsigned long hash)
+{
+    size_t mask = t->cap - 1;
+    size_t i = hash & mask;
+    while (t->slots[i].key != NULL) {
+        hentry *e = &t->slots[i];
+        if (e->hash == hash && e->len == len && memcmp(e->key, key, len) == 0) {
+            return e;
+        }
+        i = (i + 1) & mask;
+    }
+    return &t->slots[i]; /* empty slot */
+}
+
+static void grow(htable *t)
+{
+    hentry *old = t->slots;
+    size_t oldcap = t->cap;
+    t->cap <<= 1;
+    t->slots = memalloc(sizeof(hentry) * t->cap);
+    memset(t->slots, 0, sizeof(hentry) * t->cap);
+    for (size_t i = 0; i < oldcap; i++) {
+        if (old[i].key != NULL) {
+            *probe(t, old[i].key, old[i].len, old[i].hash) = old[i];
+        }
+    }
+    free(old);
+}
+
+hentry *ht_find(htable *t, const char *key, size_t len)
+{
+    if (t->count == 0) {
+        return NULL;
+    }
+    hentry *e = probe(t, key, len, strhash(key, len));
+    return e->key != NULL ? e : NULL;
+}
+
+void *ht_get(htable *t, const char *key, size_t len)
+{
+    hentry *e = ht_find(t, key, len);
+    return e != NULL ? e->val : NULL;
+}
+
+// insert or replace, return true if key was not present before
+bool ht_put(htable *t, const char *key, size_t len, void *val)
+{
+    if ((t->count + 1) * 2 > t->cap) {
+        grow(t);
+    }
+    unsigned long hash = strhash(key, len);
+    hentry *e = probe(t, key, len, hash);
+    bool fresh = e->key == NULL;
+    if (fresh) {
+        e->key = key;
+        e->len = len;
+        e->hash = hash;
+        t->count++;
+    }
+    e->val = val;
+    return fresh;
+}
+
+// backward shift deletion so probing never needs tombstones
+bool ht_del(htable *t, const char *key, size_t len)
+{
+    hentry *e = ht_find(t, key, len);
+    if (e == NULL) {
+        return false;
+    }
+    size_t mask = t->cap - 1;
+    size_t i = e - t->slots;
+    size_t j = i;
+    while (1) {
+        j = (j + 1) & mask;
+        if (t->slots[j].key == NULL) {
+            break;
+        }
+        size_t home = t->slots[j].hash & mask;
+        /* move j back into the hole at i unless its home lies cyclically in (i, j] */
+        if ((j > i && (home <= i || home > j)) || (j < i && (home <= i && home > j))) {
+            t->slots[i] = t->slots[j];
+            i = j;
+        }
+    }
+    memset(&t->slots[i], 0, sizeof(hentry));
+    t->count--;
+    return true;
+}
@@ -3,27 +3,296 @@
 #include <stdbool.h>
 #include <string.h>
 #include <unistd.h>
+#include <fcntl.h>
 #include <limits.h>
+#include <stdint.h>
+#include <sys/stat.h>
+#include <sys/uio.h>
+#include <sys/mman.h>
 
 #include "history.h"
 #include "90s.h"
 #include "constants.h"
+#include "hash.h"
+#include "output.h"
 
-FILE *history_file;
+/*
+ * History is read once at startup into memory, lines live back to back in
+ * one arena and a ring of offsets indexes the newest HIST_SIZE of them.
+ * Entries are numbered with absolute ids, the oldest kept one is
+ * hist_first() and hist_end() is one past the newest.
+ * New commands are appended to the file through a descriptor held open
+ * with O_APPEND, so nothing is ever re-read while the shell runs.
+ *
+ * When an index file exists next to the history (history --index creates
+ * it) the history file is mmap'd instead of read, the index holds the
+ * offset of every line so entry i is found without parsing anything.
+ * Lines appended since the index was last written, by this or any other
+ * shell, are indexed at the next startup, so startup cost does not depend
+ * on the size of the history. Lines from the map are not NUL terminated,
+ * lines of the current session live in the ring as usual.
+ */
+typedef struct histindex {
+    char magic[8];
+    uint64_t logsize; /* bytes of the history file covered by the index */
+    uint64_t count; /* number of line offsets following the header */
+} histindex;
+
+#define HISTINDEX_MAGIC "90sHIDX1"
+
+typedef struct histent {
+    size_t off;
+    size_t len;
+} histent;
+
+static char *arena = NULL;
+static size_t arena_len = 0, arena_cap = 0;
+static histent *ring = NULL;
+static size_t ring_cap = 0;
+static size_t first = 0, end = 0;
+static const char *map_log = NULL;
+static const uint64_t *map_offsets = NULL;
+static size_t map_count = 0, map_logsize = 0;
+static size_t live = 0; /* arena bytes still referenced by the ring */
+/* ids below disk_ids are exactly the history file up to disk_bytes */
+static size_t disk_ids = 0;
+static off_t disk_bytes = 0;
+
+static int history_fd = -1;
 char *histfile_path;
+static char *histindex_path;
 int cmd_count = 0;
 
-FILE *open_history_file(char *mode)
+static void arena_reserve(size_t size)
+{
+    if (size > arena_cap) {
+        arena_cap = size * 2;
+        arena = realloc(arena, arena_cap);
+        if (!arena) {
+            fprintf(stderr, "90s: Error allocating memory\n");
+            exit(EXIT_FAILURE);
+        }
+    }
+}
+
+// first id kept in the ring, mapped entries come before it
+static size_t ring_first(void)
+{
+    return first > map_count ? first : map_count;
+}
+
+// ring slots count from the first id after the mapped entries
+static histent *slot(size_t id)
+{
+    return &ring[(id - map_count) % ring_cap];
+}
+
+// move live lines to the front of the arena once most of it is dead
+static void compact(void)
+{
+    if (live * 2 > arena_len) {
+        return;
+    }
+    size_t pos = 0;
+    for (size_t id = ring_first(); id < end; id++) {
+        histent *e = slot(id);
+        memmove(arena + pos, arena + e->off, e->len + 1);
+        e->off = pos;
+        pos += e->len + 1;
+    }
+    arena_len = pos;
+}
+
+// add a line already stored in the arena at off
+static void push(size_t off, size_t len)
+{
+    if (end - ring_first() == ring_cap) {
+        if (ring_cap < HIST_SIZE) {
+            // still growing, slots stay in id order until the ring first wraps
+            ring_cap = ring_cap == 0 ? 1024 : ring_cap * 2;
+            if (ring_cap > HIST_SIZE) {
+                ring_cap = HIST_SIZE;
+            }
+            ring = realloc(ring, sizeof(histent) * ring_cap);
+            if (!ring) {
+                fprintf(stderr, "90s: Error allocating memory\n");
+                exit(EXIT_FAILURE);
+            }
+        } else {
+            // forget the oldest, mapped entries go first once the ring wraps
+            first = ring_first();
+            live -= slot(first)->len + 1;
+            first++;
+        }
+    }
+    slot(end)->off = off;
+    slot(end)->len = len;
+    end++;
+    live += len + 1;
+}
+
+static void load_history(void)
 {
-    history_file = fopen(histfile_path, mode);
-    if (history_file == NULL) {
+    int fd = open(histfile_path, O_RDONLY);
+    struct stat st;
+    if (fd == -1 || fstat(fd, &st) == -1) {
         fprintf(stderr, "90s: Error opening history file\n");
         exit(EXIT_FAILURE);
     }
-    return history_file;
+    arena_reserve(st.st_size + 1);
+    size_t size = 0;
+    ssize_t n;
+    while ((n = read(fd, arena + size, arena_cap - size - 1)) > 0) {
+        size += n;
+        if (size + 1 == arena_cap) {
+            arena_reserve(arena_cap + 1);
+        }
+    }
+    close(fd);
+    disk_bytes = size;
+    if (size > 0 && arena[size - 1] != '\n') {
+        arena[size++] = '\n'; // unterminated last line
+        disk_bytes = -1;
+    }
+    arena_len = size;
+
+    // split in place, each newline becomes the terminator of its line
+    size_t start = 0;
+    char *nl;
+    while (start < size && (nl = memchr(arena + start, '\n', size - start)) != NULL) {
+        size_t len = nl - (arena + start);
+        *nl = '\0';
+        push(start, len);
+        start += len + 1;
+    }
+    if (first == 0 && disk_bytes != -1) {
+        disk_ids = end;
+    }
+    compact();
 }
 
-void check_history_file(void)
+/*
+ * Append offsets of complete lines in the history file from byte from
+ * onwards to the index, then commit them by rewriting the header
+ */
+static bool index_tail(int idxfd, int logfd, histindex *hdr)
+{
+    char buf[65536];
+    uint64_t offsets[1024];
+    int num_offsets = 0;
+    uint64_t pos = hdr->logsize;
+    uint64_t line_start = hdr->logsize;
+    off_t write_at = sizeof(histindex) + hdr->count * sizeof(uint64_t);
+    ssize_t n;
+
+    while ((n = pread(logfd, buf, sizeof(buf), pos)) > 0) {
+        for (ssize_t i = 0; i < n; i++) {
+            if (buf[i] != '\n') {
+                continue;
+            }
+            offsets[num_offsets++] = line_start;
+            line_start = pos + i + 1;
+            if (num_offsets == 1024) {
+                if (pwrite(idxfd, offsets, sizeof(offsets), write_at) != sizeof(offsets)) {
+                    return false;
+                }
+                write_at += sizeof(offsets);
+                hdr->count += num_offsets;
+                num_offsets = 0;
+            }
+        }
+        pos += n;
+    }
+    size_t rest = num_offsets * sizeof(uint64_t);
+    if (num_offsets > 0 && pwrite(idxfd, offsets, rest, write_at) != (ssize_t) rest) {
+        return false;
+    }
+    hdr->count += num_offsets;
+    hdr->logsize = line_start; // a trailing partial line is picked up next time
+    return pwrite(idxfd, hdr, sizeof(histindex), 0) == sizeof(histindex);
+}
+
+// bring the index up to date with the history file and map both
+static bool load_index(void)
+{
+    int idxfd = open(histindex_path, O_RDWR | O_CLOEXEC);
+    if (idxfd == -1) {
+        return false;
+    }
+    int logfd = open(histfile_path, O_RDONLY | O_CLOEXEC);
+    struct stat st;
+    histindex hdr;
+    if (logfd == -1 || fstat(logfd, &st) == -1) {
+        close(idxfd);
+        if (logfd != -1) {
+            close(logfd);
+        }
+        return false;
+    }
+    if (pread(idxfd, &hdr, sizeof(hdr), 0) != sizeof(hdr) ||
+            memcmp(hdr.magic, HISTINDEX_MAGIC, 8) != 0 || hdr.logsize > (uint64_t) st.st_size) {
+        // history file was replaced or truncated, index it again from the start
+        memcpy(hdr.magic, HISTINDEX_MAGIC, 8);
+        hdr.logsize = 0;
+        hdr.count = 0;
+    }
+    if (hdr.logsize < (uint64_t) st.st_size) {
+        if (!index_tail(idxfd, logfd, &hdr)) {
+            fprintf(stderr, "90s: Error updating history index\n");
+        }
+    }
+    size_t map_idxsize = sizeof(histindex) + hdr.count * sizeof(uint64_t);
+    if (ftruncate(idxfd, map_idxsize) == -1) {
+        perror("90s");
+    }
+    if (hdr.count > 0) {
+        void *idx = mmap(NULL, map_idxsize, PROT_READ, MAP_SHARED, idxfd, 0);
+        void *log = mmap(NULL, hdr.logsize, PROT_READ, MAP_SHARED, logfd, 0);
+        if (idx == MAP_FAILED || log == MAP_FAILED) {
+            close(idxfd);
+            close(logfd);
+            return false;
+        }
+        map_offsets = (const uint64_t *) ((char *) idx + sizeof(histindex));
+        map_log = log;
+        map_count = hdr.count;
+        map_logsize = hdr.logsize;
+        disk_ids = map_count;
+        disk_bytes = map_logsize;
+    }
+    close(idxfd);
+    close(logfd);
+    first = 0;
+    end = map_count;
+    return true;
+}
+
+// write a fresh index for the whole history file, used from next startup
+long history_build_index(void)
+{
+    int idxfd = open(histindex_path, O_RDWR | O_CREAT | O_TRUNC | O_CLOEXEC, 0600);
+    int logfd = open(histfile_path, O_RDONLY | O_CLOEXEC);
+    if (idxfd == -1 || logfd == -1) {
+        if (idxfd != -1) {
+            close(idxfd);
+        }
+        if (logfd != -1) {
+            close(logfd);
+        }
+        return -1;
+    }
+    histindex hdr;
+    memcpy(hdr.magic, HISTINDEX_MAGIC, 8);
+    hdr.logsize = 0;
+    hdr.count = 0;
+    bool ok = index_tail(idxfd, logfd, &hdr);
+    close(idxfd);
+    close(logfd);
+    return ok ? (long) hdr.count : -1;
+}
+
+// path of a file in XDG_CONFIG_HOME, or HOME when it is not set
+char *config_path(const char *name)
 {
     char *env_home;
     env_home = getenv("XDG_CONFIG_HOME");
@@ -35,31 +304,73 @@ void check_history_file(void)
         fprintf(stderr, "90s: HOME AND XDG_CONFIG_HOME environment variable is missing\n");
         exit(EXIT_FAILURE);
     }
-    int env_home_len = strlen(env_home);
-    int histfilename_len = strlen(HISTFILE);
-    int path_len = env_home_len + histfilename_len + 2; // 2 for slash and null byte
-    histfile_path = memalloc(sizeof(char) * path_len);
-    histfile_path[0] = '\0'; // initialise string
-    // concatenate home and history file name to a path
-    strcat(histfile_path, env_home);
-    strcat(histfile_path, "/");
-    strcat(histfile_path, HISTFILE);
-    histfile_path[path_len - 1] = '\0';
-    if (access(histfile_path, F_OK) != 0) { // check for file existence
-        history_file = open_history_file("w"); // read and write, if doesn't exist, create
-        fclose(history_file);
+    char *path = memalloc(strlen(env_home) + strlen(name) + 2); // 2 for slash and null byte
+    sprintf(path, "%s/%s", env_home, name);
+    return path;
+}
+
+void check_history_file(void)
+{
+    histfile_path = config_path(HISTFILE);
+    histindex_path = config_path(HISTINDEX);
+    // append only, if doesn't exist, create
+    history_fd = open(histfile_path, O_WRONLY | O_APPEND | O_CREAT | O_CLOEXEC, 0600);
+    if (history_fd == -1) {
+        fprintf(stderr, "90s: Error opening history file\n");
+        exit(EXIT_FAILURE);
+    }
+    if (!load_index()) {
+        load_history();
     }
 }
 
 void save_command_history(char *args)
 {
-    history_file = open_history_file("a+");
-	fwrite(args, sizeof(char), strlen(args), history_file);
-	fputc('\n', history_file); // put new line feed to split commands
-    fclose(history_file);
+    size_t len = strlen(args);
+    // line and newline in one write so concurrent shells never interleave
+    struct iovec iov[2] = { { args, len }, { "\n", 1 } };
+    if (writev(history_fd, iov, 2) == -1) {
+        perror("90s");
+    }
+    if (end - ring_first() == HIST_SIZE) {
+        compact();
+    }
+    arena_reserve(arena_len + len + 1);
+    memcpy(arena + arena_len, args, len + 1);
+    push(arena_len, len);
+    arena_len += len + 1;
+}
+
+size_t hist_first(void)
+{
+    return first;
+}
+
+size_t hist_end(void)
+{
+    return end;
+}
+
+/*
+ * Line with absolute id, not NUL terminated when it comes from the map,
+ * valid until the next command is saved
+ */
+const char *hist_entry(size_t id, size_t *len)
+{
+    if (id < first || id >= end) {
+        return NULL;
+    }
+    if (id < map_count) {
+        size_t next = id + 1 < map_count ? map_offsets[id + 1] : map_logsize;
+        *len = next - map_offsets[id] - 1; // without the newline
+        return map_log + map_offsets[id];
+    }
+    histent *e = slot(id);
+    *len = e->len;
+    return arena + e->off;
 }
 
-char *read_command(int direction)
+const char *read_command(int direction, size_t *len)
 {
 	/* Up */
     if (direction == 1) {
@@ -71,67 +382,54 @@ char *read_command(int direction)
             cmd_count--;
         }
     }
-    char **history = get_all_history(false);
-    int num_history = 0;
-    while (*history != NULL) {
-        num_history++;
-        history++;
-    }
-    if (cmd_count > num_history) {
+    size_t num_history = end - first;
+    if ((size_t) cmd_count > num_history) {
         cmd_count = num_history;
         return NULL;
     }
-    history -= num_history;
-    return history[num_history - cmd_count];
+    if (cmd_count == 0) {
+        return NULL;
+    }
+    return hist_entry(end - cmd_count, len);
 }
 
-int is_duplicate(char **history, int line_count, char *line)
+/*
+ * Stream the last entries (all when last is 0) oldest first or newest
+ * first, duplicates are dropped through a hash set of lines already
+ * printed so listing stays linear. A plain listing sends the part that
+ * is identical to the history file straight from the file.
+ */
+void print_history(size_t last, bool unique, bool reverse)
 {
-    for (int i = 0; i < line_count; ++i) {
-        if (strcmp(history[i], line) == 0) {
-            return 1;
+    size_t from = first;
+    if (last > 0 && last < end - first) {
+        from = end - last;
+    }
+    size_t id = from;
+    if (!unique && !reverse && from < disk_ids && (from == 0 || map_count > 0)) {
+        int fd = open(histfile_path, O_RDONLY | O_CLOEXEC);
+        if (fd != -1) {
+            off_t off = from == 0 ? 0 : (off_t) map_offsets[from];
+            out_file(fd, off, disk_bytes - off);
+            close(fd);
+            id = disk_ids;
         }
     }
-    return 0;
-}
-
-char **get_all_history(bool check)
-{
-    history_file = open_history_file("r");
-    char **history = memalloc(MAX_HISTORY * sizeof(char *));
-    char buffer[RL_BUFSIZE];
-    int line_count = 0;
-
-    while (fgets(buffer, sizeof(buffer), history_file) != NULL) {
-        buffer[strcspn(buffer, "\n")] = '\0';
-        if (check) {
-            if (!is_duplicate(history, line_count, buffer)) {
-                history[line_count] = strdup(buffer);
-                if (history[line_count] == NULL) {
-                    fprintf(stderr, "Error allocating memory\n");
-                    exit(EXIT_FAILURE);
-                }
-                line_count++;
-                if (line_count >= MAX_HISTORY) {
-                    fprintf(stderr, "Maximum number of lines reached.\n");
-                    exit(EXIT_FAILURE);
-                }
-            }
-        } else {
-            history[line_count] = strdup(buffer);
-            if (history[line_count] == NULL) {
-                fprintf(stderr, "Error allocating memory\n");
-                exit(EXIT_FAILURE);
-            }
-            line_count++;
-            if (line_count >= MAX_HISTORY) {
-                fprintf(stderr, "Maximum number of lines reached.\n");
-                exit(EXIT_FAILURE);
-            }
+    htable seen;
+    if (unique) {
+        ht_init(&seen, 256); // grows with the distinct lines actually printed
+    }
+    for (size_t i = id - from; i < end - from; i++) {
+        id = reverse ? end - 1 - i : from + i;
+        size_t len = 0;
+        const char *line = hist_entry(id, &len);
+        if (line == NULL || (unique && !ht_put(&seen, line, len, NULL))) {
+            continue;
         }
+        out_write(line, len);
+        out_write("\n", 1);
+    }
+    if (unique) {
+        ht_free(&seen);
     }
-
-    fclose(history_file);
-    history[line_count] = NULL;
-    return history;
 }
@@ -1,63 +1,369 @@
-#include <unistd.h>
-#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
 #include <string.h>
+#include <stdbool.h>
+#include <errno.h>
+#include <signal.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/wait.h>
+#include <sys/resource.h>
 
+#include "job.h"
+#include "hash.h"
+#include "runlog.h"
+#include "output.h"
 #include "90s.h"
 
-typedef struct job {
-    pid_t pid;
-    char *command;
-    bool status;
-    struct job *next;
-} job;
+/*
+ * Jobs live in a table indexed by job id, their processes are found by
+ * pid through a hash table. SIGCHLD only writes a byte into a pipe which
+ * the line editor polls, the children are reaped from the main loop
+ * where it is safe to touch the table. Jobs that stopped or finished are
+ * queued and reported before the next prompt, finished ones are dropped
+ * then.
+ */
+static job **table = NULL; // table[id], slot 0 unused
+static int cap_table = 0;
+static int max_id = 0; // highest id in use
+static int current = 0; // the job %+ and a bare fg/bg mean
+static htable by_pid;
+static int *pending = NULL; // ids of jobs with a state to report
+static int num_pending = 0;
+static int cap_pending = 0;
+static int notify[2] = { -1, -1 };
+
+static void on_child(int sig)
+{
+    int saved = errno;
+    ssize_t n = write(notify[1], "", 1); // a full pipe already wakes the loop
+    (void) n;
+    errno = saved;
+}
+
+void job_init(void)
+{
+    if (pipe(notify) == -1) {
+        perror("90s");
+        exit(EXIT_FAILURE);
+    }
+    for (int k = 0; k < 2; k++) {
+        fcntl(notify[k], F_SETFL, O_NONBLOCK);
+        fcntl(notify[k], F_SETFD, FD_CLOEXEC);
+    }
+    ht_init(&by_pid, 64);
+
+    struct sigaction sa;
+    memset(&sa, 0, sizeof(sa));
+    sa.sa_handler = on_child;
+    sigemptyset(&sa.sa_mask);
+    sa.sa_flags = SA_RESTART; // stops are wanted too, no SA_NOCLDSTOP
+    sigaction(SIGCHLD, &sa, NULL);
+}
+
+// readable when a child changed state and job_reap has something to do
+int job_fd(void)
+{
+    return notify[0];
+}
 
-job *jobs = NULL;
+static int exit_code(int status)
+{
+    if (WIFSIGNALED(status)) {
+        return 128 + WTERMSIG(status);
+    }
+    return WEXITSTATUS(status);
+}
 
-int num_jobs(void)
+/*
+ * A job for the processes of one pipeline, not in the table yet. pids
+ * that are 0 or -1 did not start (builtins run in the shell, programs
+ * not found) and statuses holds their exit status.
+ */
+job *job_new(pid_t pgid, pid_t *pids, int *statuses, int n, const char *command)
 {
-    job *current = jobs;
-    int count = 0;
-    while (current != NULL) {
-        count++;
-        current = current->next;
+    job *j = memalloc(sizeof(job));
+    j->id = 0;
+    j->pgid = pgid;
+    j->pids = memalloc(sizeof(pid_t) * n);
+    j->statuses = memalloc(sizeof(int) * n);
+    j->num_pids = n;
+    j->live = 0;
+    for (int i = 0; i < n; i++) {
+        j->pids[i] = pids[i] > 0 ? pids[i] : -1;
+        if (pids[i] > 0) {
+            j->statuses[i] = -1;
+            j->live++;
+        } else {
+            j->statuses[i] = (statuses[i] & 0xff) << 8; // as if it exited with it
+        }
     }
-    return count;
+    j->state = j->live > 0 ? JOB_RUNNING : JOB_DONE;
+    j->changed = false;
+    j->command = memalloc(strlen(command) + 1);
+    strcpy(j->command, command);
+    return j;
 }
 
-int add_job(pid_t pid, char *command, bool status)
+// put a job in the table, its id is one past the highest in use
+int job_insert(job *j)
 {
-    job *current = jobs;
-    job *new_job = memalloc(sizeof(job));
-    new_job->pid = pid;
-    char *buf = memalloc(strlen(command) + 1);
-    strcpy(buf, command);
-    new_job->command = buf;
-    new_job->status = status;
-    new_job->next = NULL;
-    if (current == NULL) {
-        jobs = new_job;
-        return 0;
+    if (max_id + 1 >= cap_table) {
+        cap_table = cap_table == 0 ? 64 : cap_table * 2;
+        table = realloc(table, sizeof(job *) * cap_table);
+        if (!table) {
+            fprintf(stderr, "90s: Error allocating memory\n");
+            exit(EXIT_FAILURE);
+        }
+    }
+    j->id = ++max_id;
+    table[j->id] = j;
+    for (int i = 0; i < j->num_pids; i++) {
+        if (j->statuses[i] == -1) {
+            ht_put(&by_pid, (const char *) &j->pids[i], sizeof(pid_t), j);
+        }
+    }
+    current = j->id;
+    return j->id;
+}
+
+void job_free(job *j)
+{
+    free(j->pids);
+    free(j->statuses);
+    free(j->command);
+    free(j);
+}
+
+void job_remove(job *j)
+{
+    if (j->id != 0) {
+        for (int i = 0; i < j->num_pids; i++) {
+            if (j->statuses[i] == -1) {
+                ht_del(&by_pid, (const char *) &j->pids[i], sizeof(pid_t));
+            }
+        }
+        table[j->id] = NULL;
+        while (max_id > 0 && table[max_id] == NULL) {
+            max_id--;
+        }
+        if (current == j->id) {
+            current = max_id;
+        }
+    }
+    job_free(j);
+}
+
+job *job_get(int id)
+{
+    return id > 0 && id <= max_id ? table[id] : NULL;
+}
+
+int job_max(void)
+{
+    return max_id;
+}
+
+// %n, %+ or %% (also no spec at all) for the current job, %prefix of its command
+job *job_spec(const char *spec)
+{
+    if (spec == NULL || strcmp(spec, "%") == 0 || strcmp(spec, "%%") == 0 ||
+            strcmp(spec, "%+") == 0) {
+        return job_get(current);
+    }
+    if (*spec == '%') {
+        spec++;
+    }
+    char *end;
+    long id = strtol(spec, &end, 10);
+    if (end != spec && *end == '\0') {
+        return id > 0 && id <= max_id ? table[id] : NULL;
     }
-    int index = 1;
-    while (current->next != NULL) {
-        current = current->next;
-        index++;
+    size_t len = strlen(spec);
+    for (int i = max_id; i > 0; i--) {
+        if (table[i] != NULL && strncmp(table[i]->command, spec, len) == 0) {
+            return table[i];
+        }
     }
-    current->next = new_job;
-    return index;
+    return NULL;
 }
 
-job *get_job(int index)
+static void set_state(job *j, job_state state)
 {
-    job *current = jobs;
-    if (index == 0) {
-        return current;
+    if (j->state == state) {
+        return;
     }
-    if (index > num_jobs()) {
-        return NULL;
+    j->state = state;
+    if (state == JOB_STOPPED) {
+        current = j->id;
     }
-    for (int i = 0; i < index; i++) {
-        current = current->next;
+    if (j->id == 0 || j->changed || state == JOB_RUNNING) {
+        return;
+    }
+    j->changed = true;
+    if (num_pending == cap_pending) {
+        cap_pending = cap_pending == 0 ? 16 : cap_pending * 2;
+        pending = realloc(pending, sizeof(int) * cap_pending);
+        if (!pending) {
+            fprintf(stderr, "90s: Error allocating memory\n");
+            exit(EXIT_FAILURE);
+        }
+    }
+    pending[num_pending++] = j->id;
+}
+
+static void finished(job *j, int i, int status)
+{
+    if (j->id != 0) {
+        ht_del(&by_pid, (const char *) &j->pids[i], sizeof(pid_t));
+    }
+    j->statuses[i] = status;
+    if (--j->live == 0) {
+        set_state(j, JOB_DONE);
+    }
+}
+
+/*
+ * Wait for a job's processes while it runs in the foreground (or for
+ * wait), true when it stopped before all of them were done
+ */
+bool job_wait(job *j)
+{
+    j->state = JOB_RUNNING;
+    for (int i = 0; i < j->num_pids; i++) {
+        while (j->statuses[i] == -1) {
+            int status;
+            struct rusage usage;
+            if (wait4(j->pids[i], &status, WUNTRACED, &usage) == -1) {
+                if (errno != EINTR) {
+                    finished(j, i, 0); // not our child anymore
+                }
+                continue;
+            }
+            if (WIFSTOPPED(status)) {
+                set_state(j, JOB_STOPPED);
+                return true;
+            }
+            runlog_wait_status(status, &usage);
+            finished(j, i, status);
+        }
+    }
+    j->state = JOB_DONE;
+    return false;
+}
+
+/*
+ * Signal a job, its process group or without job control (no group of
+ * its own) each of its processes still running
+ */
+int job_kill(job *j, int sig)
+{
+    if (j->pgid > 0) {
+        return killpg(j->pgid, sig);
+    }
+    int ret = 0;
+    for (int i = 0; i < j->num_pids; i++) {
+        if (j->statuses[i] == -1 && kill(j->pids[i], sig) == -1) {
+            ret = -1;
+        }
+    }
+    return ret;
+}
+
+// exit status of process i of a job, 128 plus the signal when killed
+int job_status(job *j, int i)
+{
+    return j->statuses[i] == -1 ? 0 : exit_code(j->statuses[i]);
+}
+
+static bool update(job *j, int i)
+{
+    int status;
+    if (waitpid(j->pids[i], &status, WNOHANG | WUNTRACED | WCONTINUED) <= 0) {
+        return false;
+    }
+    if (WIFSTOPPED(status)) {
+        set_state(j, JOB_STOPPED);
+    } else if (WIFCONTINUED(status)) {
+        set_state(j, JOB_RUNNING);
+    } else {
+        finished(j, i, status);
+    }
+    return true;
+}
+
+/*
+ * Reap every child of a job that changed state. The next waitable child
+ * is peeked with WNOWAIT so children of the prompt and completion
+ * helpers are left to them, only when one of those is first in line are
+ * the jobs asked one by one.
+ */
+void job_reap(void)
+{
+    char buf[64];
+    while (read(notify[0], buf, sizeof(buf)) > 0) {
+        ;
+    }
+    for (;;) {
+        siginfo_t info;
+        info.si_pid = 0;
+        if (waitid(P_ALL, 0, &info, WEXITED | WSTOPPED | WCONTINUED | WNOHANG | WNOWAIT) == -1 ||
+                info.si_pid == 0) {
+            return;
+        }
+        pid_t pid = info.si_pid;
+        job *j = ht_get(&by_pid, (const char *) &pid, sizeof(pid_t));
+        int i = 0;
+        while (j != NULL && i < j->num_pids && j->pids[i] != pid) {
+            i++;
+        }
+        if (j == NULL || !update(j, i)) {
+            break;
+        }
+    }
+    for (int id = 1; id <= max_id; id++) {
+        job *j = table[id];
+        for (int i = 0; j != NULL && i < j->num_pids; i++) {
+            if (j->statuses[i] == -1) {
+                update(j, i);
+            }
+        }
+    }
+}
+
+// one line for jobs and notifications, a job reported done is dropped
+void job_print(job *j)
+{
+    char state[32];
+    int last = j->statuses[j->num_pids - 1];
+    if (j->state == JOB_RUNNING) {
+        strcpy(state, "Running");
+    } else if (j->state == JOB_STOPPED) {
+        strcpy(state, "Stopped");
+    } else if (WIFSIGNALED(last)) {
+        snprintf(state, sizeof(state), "%s", strsignal(WTERMSIG(last)));
+    } else if (WEXITSTATUS(last) != 0) {
+        snprintf(state, sizeof(state), "Exit %d", WEXITSTATUS(last));
+    } else {
+        strcpy(state, "Done");
+    }
+    out_printf("[%d]%c  %-22s  %s\n", j->id, j->id == current ? '+' : ' ', state, j->command);
+    j->changed = false;
+    if (j->state == JOB_DONE) {
+        job_remove(j);
+    }
+}
+
+// report jobs that stopped or finished since the last prompt
+void job_notify(void)
+{
+    job_reap();
+    for (int k = 0; k < num_pending; k++) {
+        job *j = job_get(pending[k]);
+        if (j != NULL && j->changed) {
+            job_print(j);
+        }
     }
-    return current;
+    num_pending = 0;
+    out_flush();
 }
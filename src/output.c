@@ -0,0 +1,146 @@
+#define _GNU_SOURCE /* splice, copy_file_range */
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdarg.h>
+#include <stdbool.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <sys/sendfile.h>
+
+#include "output.h"
+
+/*
+ * Output of builtins goes straight to a descriptor instead of stdio, so a
+ * builtin can write into a pipe or redirected file from the shell process
+ * itself. Small writes are collected in a buffer, file contents are moved
+ * by the kernel without passing through user space.
+ */
+int out_fd = STDOUT_FILENO;
+
+static char buffer[65536];
+static size_t buffered = 0;
+static bool broken = false; /* reader went away, drop the rest */
+
+static void write_all(const char *buf, size_t n)
+{
+    while (n > 0 && !broken) {
+        ssize_t written = write(out_fd, buf, n);
+        if (written == -1) {
+            if (errno == EINTR) {
+                continue;
+            }
+            if (errno != EPIPE) {
+                perror("90s");
+            }
+            broken = true;
+            return;
+        }
+        buf += written;
+        n -= written;
+    }
+}
+
+void out_flush(void)
+{
+    write_all(buffer, buffered);
+    buffered = 0;
+}
+
+void out_write(const void *buf, size_t n)
+{
+    if (buffered + n > sizeof(buffer)) {
+        out_flush();
+        if (n > sizeof(buffer)) {
+            write_all(buf, n);
+            return;
+        }
+    }
+    memcpy(buffer + buffered, buf, n);
+    buffered += n;
+}
+
+void out_printf(const char *fmt, ...)
+{
+    char small[512];
+    va_list ap;
+    va_start(ap, fmt);
+    int n = vsnprintf(small, sizeof(small), fmt, ap);
+    va_end(ap);
+    if (n < 0) {
+        return;
+    }
+    if ((size_t) n < sizeof(small)) {
+        out_write(small, n);
+        return;
+    }
+    char *large = malloc(n + 1);
+    if (large == NULL) {
+        return;
+    }
+    va_start(ap, fmt);
+    vsnprintf(large, n + 1, fmt, ap);
+    va_end(ap);
+    out_write(large, n);
+    free(large);
+}
+
+/*
+ * Copy len bytes of fd from off to the output: splice into a pipe,
+ * copy_file_range into a regular file, sendfile to anything else, and a
+ * plain read/write loop when the kernel refuses all of them
+ */
+void out_file(int fd, off_t off, size_t len)
+{
+    struct stat st;
+    out_flush();
+    if (broken || fstat(out_fd, &st) == -1) {
+        return;
+    }
+    while (len > 0) {
+        ssize_t n;
+        if (S_ISFIFO(st.st_mode)) {
+            n = splice(fd, &off, out_fd, NULL, len, SPLICE_F_MOVE);
+        } else if (S_ISREG(st.st_mode)) {
+            n = copy_file_range(fd, &off, out_fd, NULL, len, 0);
+        } else {
+            n = sendfile(out_fd, fd, &off, len);
+        }
+        if (n == 0) {
+            return;
+        }
+        if (n == -1) {
+            if (errno == EINTR) {
+                continue;
+            }
+            if (errno == EPIPE) {
+                broken = true;
+                return;
+            }
+            break; // not supported here, copy it ourselves
+        }
+        len -= n;
+    }
+    while (len > 0 && !broken) {
+        size_t chunk = len < sizeof(buffer) ? len : sizeof(buffer);
+        ssize_t n = pread(fd, buffer, chunk, off);
+        if (n <= 0) {
+            break;
+        }
+        write_all(buffer, n);
+        off += n;
+        len -= n;
+    }
+}
+
+// send builtin output to fd from now on, returns the previous descriptor
+int out_redirect(int fd)
+{
+    out_flush();
+    int old = out_fd;
+    out_fd = fd;
+    broken = false;
+    return old;
+}
@@ -0,0 +1,471 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "parse.h"
+#include "alias.h"
+#include "vars.h"
+#include "constants.h"
+#include "90s.h"
+
+/*
+ * One pass over the line builds the whole command list: words are unquoted
+ * into a single buffer as they are read and operators close the command,
+ * pipeline or list element they end. The executor and the highlighter
+ * both work from the result, nothing scans the line again. Everything is
+ * allocated from the line arena. An unquoted command word naming an alias
+ * is replaced by the alias value, which is parsed in its place. Keywords
+ * such as if and done stay plain words for the script compiler, $
+ * references are marked and expanded only when the command runs.
+ */
+typedef struct parser {
+    const char *s;
+    size_t len;
+    size_t pos;
+    cmdlist *list;
+    char *out; /* next free byte of list->words */
+    redir *pending; /* redirection waiting for its file name */
+    span **spans;
+    int *num_spans;
+    bool quoted; /* the last word had quotes or backslashes */
+    bool alias_next; /* an alias value ended in a blank, the next word may be one too */
+    bool command_next; /* a keyword like if or do or NAME=value was read, a command follows */
+} parser;
+
+// arrays double whenever their length reaches a power of two
+static void *append(void *array, int len, size_t size)
+{
+    if ((len & (len - 1)) == 0) {
+        array = arena_grow(array, len * size, (len == 0 ? 1 : len * 2) * size);
+    }
+    return array;
+}
+
+static pipeline *cur_pipe(parser *p)
+{
+    return &p->list->pipes[p->list->num_pipes - 1];
+}
+
+static command *cur_cmd(parser *p)
+{
+    pipeline *pipe = cur_pipe(p);
+    return &pipe->cmds[pipe->num_cmds - 1];
+}
+
+static bool is_empty(command *cmd)
+{
+    return cmd->argc == 0 && cmd->num_redirs == 0;
+}
+
+static void new_command(pipeline *pipe)
+{
+    pipe->cmds = append(pipe->cmds, pipe->num_cmds, sizeof(command));
+    command *cmd = &pipe->cmds[pipe->num_cmds++];
+    cmd->cap = TOK_BUFSIZE;
+    cmd->argv = arena_alloc(sizeof(char *) * cmd->cap);
+    cmd->argv[0] = NULL;
+    cmd->argc = 0;
+    cmd->redirs = NULL;
+    cmd->num_redirs = 0;
+}
+
+static void new_pipeline(cmdlist *list)
+{
+    list->pipes = append(list->pipes, list->num_pipes, sizeof(pipeline));
+    pipeline *pipe = &list->pipes[list->num_pipes++];
+    pipe->cmds = NULL;
+    pipe->num_cmds = 0;
+    pipe->background = false;
+    pipe->next = NEXT_ALWAYS;
+    new_command(pipe);
+}
+
+void command_insert(command *cmd, int pos, char *arg)
+{
+    if (cmd->argc + 2 > cmd->cap) {
+        cmd->argv = arena_grow(cmd->argv, sizeof(char *) * cmd->cap, sizeof(char *) * cmd->cap * 2);
+        cmd->cap *= 2;
+    }
+    memmove(&cmd->argv[pos + 1], &cmd->argv[pos], sizeof(char *) * (cmd->argc - pos + 1));
+    cmd->argv[pos] = arg;
+    cmd->argc++;
+}
+
+static void add_span(parser *p, size_t start, int kind, const char *word)
+{
+    if (p->spans == NULL) {
+        return;
+    }
+    *p->spans = append(*p->spans, *p->num_spans, sizeof(span));
+    span *sp = &(*p->spans)[(*p->num_spans)++];
+    sp->start = start;
+    sp->end = p->pos;
+    sp->kind = kind;
+    sp->word = word;
+}
+
+static void fail(parser *p, const char *error)
+{
+    if (p->list->error == NULL) {
+        p->list->error = error;
+    }
+}
+
+static bool is_blank(char c)
+{
+    return c == ' ' || c == '\t' || c == '\r' || c == '\a';
+}
+
+static bool is_special(char c)
+{
+    return c == '|' || c == '&' || c == ';' || c == '<' || c == '>' || c == '\n';
+}
+
+static bool is_name_char(char c)
+{
+    return (c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z') || (c >= '0' && c <= '9') || c == '_';
+}
+
+// the marker bytes never come from the line itself
+static void put(parser *p, char c)
+{
+    if (c != EXPAND_MARK && c != EXPAND_END && c != EXPAND_QUOTED) {
+        *p->out++ = c;
+    }
+}
+
+/*
+ * A $ was read: copy what it references between markers, $name, ${...},
+ * $((...)) or one of $? $$ $# $@ $* $0-$9. Any other $ is literal.
+ */
+static void read_expansion(parser *p, bool quoted)
+{
+    const char *s = p->s;
+    size_t end = p->pos;
+    if (end < p->len && s[end] == '{') {
+        while (end < p->len && s[end] != '}') {
+            end++;
+        }
+        if (end == p->len) {
+            fail(p, "unterminated ${");
+            return;
+        }
+        end++;
+    } else if (end + 1 < p->len && s[end] == '(' && s[end + 1] == '(') {
+        int depth = 0;
+        do {
+            depth += s[end] == '(' ? 1 : s[end] == ')' ? -1 : 0;
+            end++;
+        } while (end < p->len && depth > 0);
+        if (depth > 0) {
+            fail(p, "unterminated $((");
+            return;
+        }
+    } else if (end < p->len && is_name_char(s[end]) && !(s[end] >= '0' && s[end] <= '9')) {
+        while (end < p->len && is_name_char(s[end])) {
+            end++;
+        }
+    } else if (end < p->len && strchr("?$#@*0123456789", s[end]) != NULL) {
+        end++;
+    } else {
+        *p->out++ = '$';
+        return;
+    }
+    *p->out++ = quoted ? EXPAND_QUOTED : EXPAND_MARK;
+    while (p->pos < end) {
+        put(p, s[p->pos++]);
+    }
+    *p->out++ = EXPAND_END;
+}
+
+// read a word, removing quotes and backslashes and marking $ references
+static char *read_word(parser *p)
+{
+    const char *s = p->s;
+    char *word = p->out;
+    p->quoted = false;
+    while (p->pos < p->len && !is_blank(s[p->pos]) && !is_special(s[p->pos])) {
+        char c = s[p->pos++];
+        if (c == '\\' || c == '\'' || c == '"') {
+            p->quoted = true;
+        }
+        if (c == '\\') {
+            if (p->pos < p->len && s[p->pos] == '\n') {
+                p->pos++; // line continuation
+            } else if (p->pos < p->len) {
+                put(p, s[p->pos++]);
+            }
+        } else if (c == '$') {
+            read_expansion(p, false);
+        } else if (c == '\'' || c == '"') {
+            while (p->pos < p->len && s[p->pos] != c) {
+                if (c == '"' && s[p->pos] == '\\' && p->pos + 1 < p->len &&
+                        strchr("\"\\$`", s[p->pos + 1]) != NULL) {
+                    p->pos++;
+                } else if (c == '"' && s[p->pos] == '$') {
+                    p->pos++;
+                    read_expansion(p, true);
+                    continue;
+                }
+                put(p, s[p->pos++]);
+            }
+            if (p->pos == p->len) {
+                fail(p, "unterminated quote");
+            } else {
+                p->pos++;
+            }
+        } else {
+            put(p, c);
+        }
+    }
+    *p->out++ = '\0';
+    return word;
+}
+
+static void add_redirect(parser *p, int fd, int kind)
+{
+    command *cmd = cur_cmd(p);
+    cmd->redirs = append(cmd->redirs, cmd->num_redirs, sizeof(redir));
+    redir *r = &cmd->redirs[cmd->num_redirs++];
+    r->fd = fd;
+    r->kind = kind;
+    r->path = NULL;
+    r->target = -1;
+    p->pending = r;
+}
+
+static const char *near(const char *op)
+{
+    switch (op[0]) {
+    case '|':
+        return op[1] == '|' ? "syntax error near '||'" : "syntax error near '|'";
+    case '&':
+        return op[1] == '&' ? "syntax error near '&&'" : "syntax error near '&'";
+    default:
+        return "syntax error near ';'";
+    }
+}
+
+// an operator ended the current pipeline
+static void end_pipeline(parser *p, const char *op, int next, bool background)
+{
+    cmdlist *list = p->list;
+    pipeline *pipe = cur_pipe(p);
+    if (p->pending != NULL) {
+        fail(p, "missing file name for redirection");
+    }
+    if (is_empty(cur_cmd(p))) {
+        bool after_op = list->num_pipes > 1 && list->pipes[list->num_pipes - 2].next != NEXT_ALWAYS;
+        if (pipe->num_cmds > 1 || next != NEXT_ALWAYS || background || after_op) {
+            fail(p, near(op));
+        }
+        return; // empty statement, keep filling this one
+    }
+    pipe->next = next;
+    pipe->background = background;
+    new_pipeline(list);
+}
+
+static void read_redirect(parser *p, size_t start)
+{
+    const char *s = p->s;
+    int fd = -1;
+    if (s[p->pos] >= '0' && s[p->pos] <= '2') {
+        fd = s[p->pos++] - '0';
+    }
+    if (s[p->pos++] == '<') {
+        add_redirect(p, fd == -1 ? STDIN_FILENO : fd, REDIR_IN);
+    } else if (p->pos < p->len && s[p->pos] == '>') {
+        p->pos++;
+        add_redirect(p, fd == -1 ? STDOUT_FILENO : fd, REDIR_APPEND);
+    } else if (p->pos < p->len && s[p->pos] == '&') {
+        p->pos++;
+        if (p->pos < p->len && s[p->pos] >= '0' && s[p->pos] <= '2' &&
+                (p->pos + 1 == p->len || is_blank(s[p->pos + 1]) || is_special(s[p->pos + 1]))) {
+            // n>&m makes n a copy of m
+            add_redirect(p, fd == -1 ? STDOUT_FILENO : fd, REDIR_DUP);
+            p->pending->target = s[p->pos++] - '0';
+            p->pending = NULL;
+        } else if (fd == -1) {
+            add_redirect(p, -1, REDIR_OUT);
+        } else {
+            fail(p, "bad file descriptor in redirection");
+        }
+    } else {
+        add_redirect(p, fd == -1 ? STDOUT_FILENO : fd, REDIR_OUT);
+    }
+    add_span(p, start, SPAN_OPERATOR, NULL);
+}
+
+static void parse_text(parser *p);
+
+// keywords the script compiler knows, those before a command come first
+static const char *keywords[] = {
+    "if", "then", "elif", "else", "while", "until", "do", "!", "{",
+    "fi", "done", "}", "for", "in", "function", "break", "continue", "return", NULL
+};
+#define LEADING_KEYWORDS 9
+
+static int keyword_index(const char *word)
+{
+    for (int i = 0; keywords[i] != NULL; i++) {
+        if (strcmp(word, keywords[i]) == 0) {
+            return i;
+        }
+    }
+    return -1;
+}
+
+bool is_keyword(const char *word)
+{
+    return keyword_index(word) != -1;
+}
+
+/*
+ * Parse an alias value where its name was read. The word span of the
+ * name tells the highlighter which command the value runs, the alias is
+ * not expanded again while its own value is parsed.
+ */
+static void expand_alias(parser *p, aliasdef *a, size_t start)
+{
+    int pipe_index = p->list->num_pipes - 1;
+    int cmd_index = cur_pipe(p)->num_cmds - 1;
+    int arg_index = cur_cmd(p)->argc;
+    add_span(p, start, arg_index == 0 ? SPAN_COMMAND : SPAN_ARG, a->name);
+
+    size_t len = strlen(a->value);
+    parser inner = *p;
+    inner.s = a->value;
+    inner.len = len;
+    inner.pos = 0;
+    inner.out = arena_alloc(len + len / 2 + 1);
+    inner.spans = NULL;
+    a->active = true;
+    parse_text(&inner);
+    a->active = false;
+    p->pending = inner.pending;
+    p->alias_next = len > 0 && is_blank(a->value[len - 1]);
+
+    if (p->spans != NULL) {
+        command *cmd = &p->list->pipes[pipe_index].cmds[cmd_index];
+        (*p->spans)[*p->num_spans - 1].word = cmd->argc > arg_index ? cmd->argv[arg_index] : "";
+    }
+}
+
+static void parse_text(parser *p)
+{
+    while (p->pos < p->len) {
+        char c = p->s[p->pos];
+        size_t start = p->pos;
+        if (is_blank(c)) {
+            p->pos++;
+        } else if (c == '#') {
+            while (p->pos < p->len && p->s[p->pos] != '\n') {
+                p->pos++; // comment to the end of the line
+            }
+        } else if (c == '\\' && p->pos + 1 < p->len && p->s[p->pos + 1] == '\n') {
+            p->pos += 2; // line continuation
+        } else if (c == '\n' && p->pending == NULL && is_empty(cur_cmd(p))) {
+            p->pos++; // a blank line, or the next line goes on after | && ||
+        } else if (c == ';' || c == '\n') {
+            p->pos++;
+            add_span(p, start, SPAN_OPERATOR, NULL);
+            end_pipeline(p, ";", NEXT_ALWAYS, false);
+        } else if (c == '|') {
+            p->pos++;
+            bool or = p->pos < p->len && p->s[p->pos] == '|';
+            p->pos += or;
+            add_span(p, start, SPAN_OPERATOR, NULL);
+            if (or) {
+                end_pipeline(p, "||", NEXT_OR, false);
+            } else {
+                if (p->pending != NULL) {
+                    fail(p, "missing file name for redirection");
+                }
+                if (is_empty(cur_cmd(p))) {
+                    fail(p, near("|"));
+                }
+                new_command(cur_pipe(p));
+            }
+        } else if (c == '&' && p->pos + 1 < p->len && p->s[p->pos + 1] == '>') {
+            // &> file sends both stdout and stderr to it
+            p->pos += 2;
+            bool append = p->pos < p->len && p->s[p->pos] == '>';
+            p->pos += append;
+            add_redirect(p, -1, append ? REDIR_APPEND : REDIR_OUT);
+            add_span(p, start, SPAN_OPERATOR, NULL);
+        } else if (c == '&') {
+            p->pos++;
+            bool and = p->pos < p->len && p->s[p->pos] == '&';
+            p->pos += and;
+            add_span(p, start, SPAN_OPERATOR, NULL);
+            end_pipeline(p, and ? "&&" : "&", and ? NEXT_AND : NEXT_ALWAYS, !and);
+        } else if (c == '<' || c == '>' || (c >= '0' && c <= '2' && p->pos + 1 < p->len &&
+                    (p->s[p->pos + 1] == '<' || p->s[p->pos + 1] == '>'))) {
+            if (p->pending != NULL) {
+                fail(p, "missing file name for redirection");
+            }
+            read_redirect(p, start);
+        } else {
+            char *word = read_word(p);
+            if (p->pending != NULL) {
+                p->pending->path = word;
+                p->pending = NULL;
+                add_span(p, start, SPAN_REDIRECT, word);
+            } else {
+                command *cmd = cur_cmd(p);
+                bool command_pos = cmd->argc == 0 || p->command_next;
+                aliasdef *a = NULL;
+                if ((command_pos || p->alias_next) && !p->quoted) {
+                    a = alias_find(word);
+                }
+                p->alias_next = false;
+                p->command_next = false;
+                if (a != NULL && !a->active) {
+                    expand_alias(p, a, start);
+                } else {
+                    int k = command_pos && !p->quoted ? keyword_index(word) : -1;
+                    p->command_next = (k != -1 && k < LEADING_KEYWORDS) ||
+                        (command_pos && var_assignment(word));
+                    add_span(p, start, command_pos ? SPAN_COMMAND : SPAN_ARG, word);
+                    command_insert(cmd, cmd->argc, word);
+                }
+            }
+        }
+    }
+}
+
+/*
+ * Parse len bytes of line into a list of pipelines. When spans is not
+ * NULL it receives every token with its kind.
+ * A list with error set must not be run.
+ */
+cmdlist *parse(const char *line, size_t len, span **spans, int *num_spans)
+{
+    cmdlist *list = arena_alloc(sizeof(cmdlist));
+    list->pipes = NULL;
+    list->num_pipes = 0;
+    list->words = arena_alloc(len + len / 2 + 1); // a $ reference grows by one byte at most
+    list->error = NULL;
+    new_pipeline(list);
+
+    parser p = { line, len, 0, list, list->words, NULL, spans, num_spans, false, false, false };
+    if (spans != NULL) {
+        *spans = NULL;
+        *num_spans = 0;
+    }
+    parse_text(&p);
+
+    if (p.pending != NULL) {
+        fail(&p, "missing file name for redirection");
+    }
+    if (is_empty(cur_cmd(&p))) {
+        if (cur_pipe(&p)->num_cmds > 1 || (list->num_pipes > 1 &&
+                    list->pipes[list->num_pipes - 2].next != NEXT_ALWAYS)) {
+            fail(&p, "unexpected end of line");
+        }
+        list->num_pipes--; // nothing after the last ; or &
+    }
+    return list;
+}
@@ -0,0 +1,262 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <string.h>
+#include <limits.h>
+#include <time.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <spawn.h>
+#include <unistd.h>
+#include <sys/wait.h>
+
+#include "prompt.h"
+#include "cmdcache.h"
+#include "gitstat.h"
+#include "watch.h"
+
+extern char **environ;
+
+/*
+ * The prompt is made of segments. Fast ones are cached and rebuilt only
+ * when they can have changed: the directory when cd ran, the status and
+ * duration when a command finished. The git segment is read from .git
+ * directly (gitstat.c), the work tree is checked in slices while the
+ * line is edited. Only ahead/behind counts need git itself, they are
+ * asked from a helper process when the branch or its upstream moved and
+ * the prompt is repainted when the answer differs.
+ */
+#define PROMPT_SLOW 2.0 // show the duration of commands taking longer
+#define PROMPT_BUDGET 256 // syscalls spent on the work tree between keystrokes
+
+static char dir[PATH_MAX]; /* working directory */
+static char shown_dir[PATH_MAX]; /* with HOME as ~ */
+static bool dir_valid = false;
+static int prev_status = 0;
+static double prev_duration = 0;
+
+static gitrepo *repo = NULL; /* holding the working directory */
+static char git[512] = "";
+
+static pid_t helper = -1;
+static int helper_fd = -1;
+static gitrepo *helper_repo;
+static char helper_range[140];
+static char reply[256];
+static size_t reply_len = 0;
+
+static char timestr[16]; /* when the prompt was shown */
+static char prompt[PATH_MAX + 512];
+static int prompt_len = 0;
+
+static void refresh_dir(void)
+{
+    if (getcwd(dir, sizeof(dir)) == NULL) {
+        strcpy(dir, "?");
+    }
+    char *home = getenv("HOME");
+    size_t home_len = home != NULL ? strlen(home) : 0;
+    if (home_len > 0 && strncmp(dir, home, home_len) == 0 &&
+            (dir[home_len] == '/' || dir[home_len] == '\0')) {
+        snprintf(shown_dir, sizeof(shown_dir), "~%s", dir + home_len);
+    } else {
+        strcpy(shown_dir, dir);
+    }
+    dir_valid = true;
+    repo = git_open(dir);
+}
+
+static void build(void)
+{
+    /* Blue time string, pink directory, yellow git, red status, teal arrow */
+    int n = snprintf(prompt, sizeof(prompt), "\033[34m%s\033[m \033[35m[%s] ", timestr, shown_dir);
+    if (repo != NULL) {
+        git_segment(repo, git, sizeof(git));
+        n += snprintf(prompt + n, sizeof(prompt) - n, "\033[33m(%s) ", git);
+    }
+    if (prev_status != 0) {
+        n += snprintf(prompt + n, sizeof(prompt) - n, "\033[31m%d ", prev_status);
+    }
+    if (prev_duration >= PROMPT_SLOW) {
+        n += snprintf(prompt + n, sizeof(prompt) - n, "\033[33m%.1fs ", prev_duration);
+    }
+    n += snprintf(prompt + n, sizeof(prompt) - n, "\033[36m>\033[m ");
+    prompt_len = n;
+}
+
+static void helper_stop(void)
+{
+    if (helper == -1) {
+        return;
+    }
+    kill(helper, SIGKILL);
+    waitpid(helper, NULL, 0);
+    close(helper_fd);
+    helper = -1;
+    helper_fd = -1;
+}
+
+// ask git for the ahead/behind counts when they are unknown, without waiting
+void prompt_async(void)
+{
+    const char *range = repo != NULL ? git_range(repo) : NULL;
+    if (range == NULL || (helper != -1 && helper_repo == repo && strcmp(helper_range, range) == 0)) {
+        return;
+    }
+    helper_stop();
+    const char *path = cmdcache_lookup("git");
+    if (path == NULL) {
+        return;
+    }
+    int fds[2];
+    if (pipe(fds) == -1) {
+        return;
+    }
+    fcntl(fds[0], F_SETFD, FD_CLOEXEC);
+    fcntl(fds[1], F_SETFD, FD_CLOEXEC);
+    fcntl(fds[0], F_SETFL, O_NONBLOCK);
+
+    posix_spawn_file_actions_t actions;
+    posix_spawn_file_actions_init(&actions);
+    posix_spawn_file_actions_addopen(&actions, STDIN_FILENO, "/dev/null", O_RDONLY, 0);
+    posix_spawn_file_actions_adddup2(&actions, fds[1], STDOUT_FILENO);
+    posix_spawn_file_actions_addopen(&actions, STDERR_FILENO, "/dev/null", O_WRONLY, 0);
+    posix_spawnattr_t attr;
+    sigset_t defaults;
+    posix_spawnattr_init(&attr);
+    sigemptyset(&defaults);
+    sigaddset(&defaults, SIGINT);
+    sigaddset(&defaults, SIGQUIT);
+    sigaddset(&defaults, SIGTERM);
+    sigaddset(&defaults, SIGPIPE);
+    posix_spawnattr_setsigdefault(&attr, &defaults);
+    posix_spawnattr_setpgroup(&attr, 0); // keystrokes like Ctrl-C are not for it
+    posix_spawnattr_setflags(&attr, POSIX_SPAWN_SETSIGDEF | POSIX_SPAWN_SETPGROUP);
+
+    snprintf(helper_range, sizeof(helper_range), "%s", range);
+    char *argv[] = { "git", "--no-optional-locks", "rev-list", "--left-right", "--count",
+        helper_range, NULL };
+    int err = posix_spawn(&helper, path, &actions, &attr, argv, environ);
+    posix_spawn_file_actions_destroy(&actions);
+    posix_spawnattr_destroy(&attr);
+    close(fds[1]);
+    if (err != 0) {
+        close(fds[0]);
+        helper = -1;
+        return;
+    }
+    helper_fd = fds[0];
+    helper_repo = repo;
+    reply_len = 0;
+}
+
+// descriptor to wait on for a slow segment, -1 when none is coming
+int prompt_fd(void)
+{
+    return helper_fd;
+}
+
+static bool rebuild(void)
+{
+    char old[sizeof(prompt)];
+    int old_len = prompt_len;
+    memcpy(old, prompt, prompt_len);
+    build();
+    return prompt_len != old_len || memcmp(old, prompt, prompt_len) != 0;
+}
+
+// take what the helper sent, true when the prompt changed and needs a repaint
+bool prompt_collect(void)
+{
+    for (;;) {
+        ssize_t n = read(helper_fd, reply + reply_len, sizeof(reply) - 1 - reply_len);
+        if (n == -1 && errno == EINTR) {
+            continue;
+        }
+        if (n == -1) {
+            return false; // more to come
+        }
+        if (n == 0) {
+            break;
+        }
+        reply_len += n;
+        if (reply_len == sizeof(reply) - 1) {
+            break; // two numbers never get this long
+        }
+    }
+    int status;
+    close(helper_fd);
+    kill(helper, SIGKILL);
+    waitpid(helper, &status, 0);
+    helper = -1;
+    helper_fd = -1;
+
+    long ahead, behind;
+    reply[reply_len] = '\0';
+    if (!WIFEXITED(status) || WEXITSTATUS(status) != 0 ||
+            sscanf(reply, "%ld %ld", &ahead, &behind) != 2) {
+        ahead = behind = 0; // unknown upstream commits, like a fetch not done yet
+    }
+    git_counts(helper_repo, helper_range, ahead, behind);
+    return rebuild();
+}
+
+// true while there is work left for prompt_work()
+bool prompt_busy(void)
+{
+    return repo != NULL && git_busy(repo);
+}
+
+// catch up with filesystem changes a bit at a time, true when the prompt changed
+bool prompt_work(void)
+{
+    watch_poll();
+    if (repo == NULL) {
+        return false;
+    }
+    git_update(repo, false);
+    git_work(repo, PROMPT_BUDGET);
+    return rebuild();
+}
+
+// working directory as of the last prompt_refresh()
+const char *prompt_cwd(void)
+{
+    return dir;
+}
+
+void prompt_invalidate_cwd(void)
+{
+    dir_valid = false;
+}
+
+void prompt_finished(int status, double duration)
+{
+    prev_status = status;
+    prev_duration = duration;
+}
+
+// bring the segments up to date, prompt_async() asks git for what is left
+void prompt_refresh(void)
+{
+    time_t t = time(NULL);
+    struct tm now;
+    localtime_r(&t, &now);
+    strftime(timestr, sizeof(timestr), "[%H:%M:%S]", &now);
+    if (!dir_valid) {
+        refresh_dir();
+    }
+    watch_poll();
+    if (repo != NULL) {
+        git_update(repo, true);
+        git_work(repo, PROMPT_BUDGET);
+    }
+    build();
+}
+
+const char *prompt_text(int *len)
+{
+    *len = prompt_len;
+    return prompt;
+}
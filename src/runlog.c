@@ -0,0 +1,286 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <string.h>
+#include <limits.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/time.h>
+#include <sys/wait.h>
+
+#include "runlog.h"
+#include "history.h"
+#include "hash.h"
+#include "output.h"
+#include "constants.h"
+#include "90s.h"
+
+/*
+ * Every foreground command line is logged with its duration, exit status,
+ * cwd and resource usage as one JSON object per line, appended through a
+ * descriptor held open like the history file
+ */
+int last_status = 0;
+int last_signal = 0;
+struct rusage last_usage;
+
+static int runlog_fd = -1;
+static char *runlog_path;
+static int *pipestatus = NULL;
+static int num_pipestatus = 0;
+
+typedef struct cmdstat {
+    char *cmd;
+    long count;
+    double total;
+    double max;
+} cmdstat;
+
+void runlog_open(void)
+{
+    runlog_path = config_path(RUNLOG);
+    runlog_fd = open(runlog_path, O_WRONLY | O_APPEND | O_CREAT | O_CLOEXEC, 0600);
+    if (runlog_fd == -1) {
+        fprintf(stderr, "90s: Error opening run log\n");
+    }
+}
+
+// last_status is kept, $? on this line is the status of the previous one
+void runlog_begin(runrec *rec)
+{
+    last_signal = 0;
+    memset(&last_usage, 0, sizeof(last_usage));
+    num_pipestatus = 0;
+    rec->when = time(NULL);
+    clock_gettime(CLOCK_MONOTONIC, &rec->start);
+}
+
+// fold the wait status and rusage of a reaped child into the current record
+void runlog_wait_status(int status, struct rusage *usage)
+{
+    if (WIFEXITED(status)) {
+        last_status = WEXITSTATUS(status);
+        last_signal = 0;
+    } else if (WIFSIGNALED(status)) {
+        last_signal = WTERMSIG(status);
+        last_status = 128 + last_signal;
+    }
+    if (usage != NULL) {
+        timeradd(&last_usage.ru_utime, &usage->ru_utime, &last_usage.ru_utime);
+        timeradd(&last_usage.ru_stime, &usage->ru_stime, &last_usage.ru_stime);
+        if (usage->ru_maxrss > last_usage.ru_maxrss) {
+            last_usage.ru_maxrss = usage->ru_maxrss;
+        }
+    }
+}
+
+// status of every stage when the command line was a pipeline
+void runlog_pipestatus(int *statuses, int n)
+{
+    pipestatus = realloc(pipestatus, sizeof(int) * n);
+    if (!pipestatus) {
+        fprintf(stderr, "90s: Error allocating memory\n");
+        exit(EXIT_FAILURE);
+    }
+    memcpy(pipestatus, statuses, sizeof(int) * n);
+    num_pipestatus = n;
+}
+
+double runlog_duration(runrec *rec)
+{
+    return (rec->end.tv_sec - rec->start.tv_sec) + (rec->end.tv_nsec - rec->start.tv_nsec) / 1e9;
+}
+
+static void json_string(FILE *out, const char *s)
+{
+    fputc('"', out);
+    for (; *s != '\0'; s++) {
+        unsigned char c = *s;
+        if (c == '"' || c == '\\') {
+            fprintf(out, "\\%c", c);
+        } else if (c < 0x20) {
+            fprintf(out, "\\u%04x", c);
+        } else {
+            fputc(c, out);
+        }
+    }
+    fputc('"', out);
+}
+
+void runlog_end(runrec *rec, const char *command)
+{
+    clock_gettime(CLOCK_MONOTONIC, &rec->end);
+    if (runlog_fd == -1) {
+        return;
+    }
+    char cwd[PATH_MAX];
+    if (getcwd(cwd, sizeof(cwd)) == NULL) {
+        strcpy(cwd, "?");
+    }
+    char *record;
+    size_t size;
+    FILE *out = open_memstream(&record, &size);
+    if (out == NULL) {
+        return;
+    }
+    fprintf(out, "{\"time\":%ld,\"dur\":%.6f,\"status\":%d,\"signal\":%d,"
+            "\"utime\":%.6f,\"stime\":%.6f,\"maxrss\":%ld,\"cwd\":",
+            (long) rec->when, runlog_duration(rec), last_status, last_signal,
+            last_usage.ru_utime.tv_sec + last_usage.ru_utime.tv_usec / 1e6,
+            last_usage.ru_stime.tv_sec + last_usage.ru_stime.tv_usec / 1e6,
+            last_usage.ru_maxrss);
+    json_string(out, cwd);
+    fputs(",\"cmd\":", out);
+    json_string(out, command);
+    if (num_pipestatus > 1) {
+        fputs(",\"pipestatus\":[", out);
+        for (int i = 0; i < num_pipestatus; i++) {
+            fprintf(out, i == 0 ? "%d" : ",%d", pipestatus[i]);
+        }
+        fputc(']', out);
+    }
+    fputs("}\n", out);
+    fclose(out);
+    // one write per record, concurrent shells never interleave
+    if (write(runlog_fd, record, size) == -1) {
+        perror("90s");
+    }
+    free(record);
+}
+
+// parse a JSON string in place, returns the character after the closing quote
+static char *json_unescape(char *s, char **value)
+{
+    if (*s++ != '"') {
+        return NULL;
+    }
+    *value = s;
+    char *out = s;
+    while (*s != '"') {
+        if (*s == '\0') {
+            return NULL;
+        }
+        if (*s == '\\') {
+            s++;
+            if (*s == 'u') {
+                char hex[5] = { 0 };
+                strncpy(hex, s + 1, 4);
+                *out++ = strtol(hex, NULL, 16);
+                s += strlen(hex) + 1;
+                continue;
+            }
+        }
+        *out++ = *s++;
+    }
+    *out = '\0';
+    return s + 1;
+}
+
+static int by_max(const void *a, const void *b)
+{
+    double x = (*(cmdstat **) a)->max, y = (*(cmdstat **) b)->max;
+    return (x < y) - (x > y);
+}
+
+static int by_count(const void *a, const void *b)
+{
+    long x = (*(cmdstat **) a)->count, y = (*(cmdstat **) b)->count;
+    return (x < y) - (x > y);
+}
+
+/*
+ * runlog [-f] [-a] [-n count] [dir]
+ * slowest commands run in dir (default cwd), -f most frequent instead,
+ * -a across all directories
+ */
+int runlog_report(char **args)
+{
+    bool frequent = false, all = false;
+    long limit = 10;
+    char cwd[PATH_MAX];
+    char *dir = getcwd(cwd, sizeof(cwd));
+
+    for (int i = 1; args[i] != NULL; i++) {
+        if (strcmp(args[i], "-f") == 0) {
+            frequent = true;
+        } else if (strcmp(args[i], "-a") == 0) {
+            all = true;
+        } else if (strcmp(args[i], "-n") == 0 && args[i + 1] != NULL) {
+            limit = atol(args[++i]);
+        } else if (args[i][0] != '-') {
+            dir = args[i];
+        } else {
+            fprintf(stderr, "90s: runlog: usage: runlog [-f] [-a] [-n count] [dir]\n");
+            return -1;
+        }
+    }
+
+    if (runlog_path == NULL) {
+        fprintf(stderr, "90s: runlog: only in an interactive shell\n");
+        return -1;
+    }
+    FILE *log = fopen(runlog_path, "r");
+    if (log == NULL) {
+        perror("90s");
+        return -1;
+    }
+    htable stats;
+    ht_init(&stats, 256);
+    char *line = NULL;
+    size_t cap = 0;
+    while (getline(&line, &cap, log) != -1) {
+        double dur;
+        int consumed = 0;
+        char *rec_cwd, *cmd;
+        if (sscanf(line, "{\"time\":%*d,\"dur\":%lf,%*[^,],%*[^,],%*[^,],%*[^,],%*[^,],\"cwd\":%n",
+                    &dur, &consumed) < 1 || consumed == 0) {
+            continue;
+        }
+        char *rest = json_unescape(line + consumed, &rec_cwd);
+        if (rest == NULL || strncmp(rest, ",\"cmd\":", 7) != 0 ||
+                json_unescape(rest + 7, &cmd) == NULL) {
+            continue;
+        }
+        if (!all && (dir == NULL || strcmp(rec_cwd, dir) != 0)) {
+            continue;
+        }
+        size_t len = strlen(cmd);
+        cmdstat *st = ht_get(&stats, cmd, len);
+        if (st == NULL) {
+            st = memalloc(sizeof(cmdstat));
+            st->cmd = strdup(cmd);
+            st->count = 0;
+            st->total = 0;
+            st->max = 0;
+            ht_put(&stats, st->cmd, len, st);
+        }
+        st->count++;
+        st->total += dur;
+        if (dur > st->max) {
+            st->max = dur;
+        }
+    }
+    free(line);
+    fclose(log);
+
+    cmdstat **sorted = memalloc(sizeof(cmdstat *) * (stats.count + 1));
+    size_t n = 0;
+    for (size_t i = 0; i < stats.cap; i++) {
+        if (stats.slots[i].key != NULL) {
+            sorted[n++] = stats.slots[i].val;
+        }
+    }
+    qsort(sorted, n, sizeof(cmdstat *), frequent ? by_count : by_max);
+    out_printf("%8s %10s %10s  %s\n", "count", "avg", "max", "command");
+    for (size_t i = 0; i < n; i++) {
+        if ((long) i < limit) {
+            out_printf("%8ld %10.3f %10.3f  %s\n", sorted[i]->count,
+                    sorted[i]->total / sorted[i]->count, sorted[i]->max, sorted[i]->cmd);
+        }
+        free(sorted[i]->cmd);
+        free(sorted[i]);
+    }
+    free(sorted);
+    ht_free(&stats);
+    return 1;
+}
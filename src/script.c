@@ -0,0 +1,999 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <signal.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+
+#include "script.h"
+#include "commands.h"
+#include "vars.h"
+#include "hash.h"
+#include "scriptcache.h"
+#include "alias.h"
+#include "runlog.h"
+#include "90s.h"
+
+/*
+ * Command lists are compiled once into a flat array of ints, opcodes
+ * followed by their operands, every word being an offset into a string
+ * pool. if, while, until, for, && and || become jumps and a function is
+ * an entry point into the code, so running a loop body again only builds
+ * the argv of its commands from the pool (expanding the words with $
+ * references), nothing is tokenized twice. Code and pool make up one
+ * block which holds no pointers.
+ */
+enum {
+    OP_RUN, /* background, commands, then for each argc, words, redirections */
+    OP_JUMP, /* target */
+    OP_JUMP_FAIL, /* target, taken when the last status is not 0 */
+    OP_JUMP_OK, /* target, taken when it is 0 */
+    OP_STATUS, /* status */
+    OP_NOT,
+    OP_FOR, /* name, count, words: start a loop over the expanded words */
+    OP_NEXT, /* name, target: the next word into name, or leave the loop */
+    OP_POP, /* leave the innermost for loop early */
+    OP_FUNC, /* name, target: define the function whose body follows */
+    OP_RETURN /* status word or -1 */
+};
+
+#define MAX_LOOPS 32 // loops nested in one script or function
+#define MAX_CALLS 1000 // function calls nested
+#define BLOCK_MAGIC "90sprog1"
+
+typedef struct blockhead {
+    char magic[8];
+    int code_len;
+    int strings_len;
+} blockhead;
+
+typedef struct loop {
+    bool is_for;
+    int top; /* where continue jumps */
+    int breaks; /* chain of break jumps to patch with the end */
+} loop;
+
+typedef struct compiler {
+    cmdlist *list;
+    int pi; /* pipeline the next statement starts in */
+    int off; /* words of its first command taken by keywords */
+    int last_next; /* how the statement after a finished keyword line runs */
+    int *code;
+    int code_len;
+    int code_cap;
+    char *strings;
+    int strings_len;
+    int strings_cap;
+    htable pool; /* word -> offset + 1 */
+    loop loops[MAX_LOOPS];
+    int num_loops;
+    int loop_base; /* loops outside the function being compiled */
+    const char *error;
+} compiler;
+
+static const char *then_stop[] = { "then", NULL };
+static const char *branch_stop[] = { "elif", "else", "fi", NULL };
+static const char *fi_stop[] = { "fi", NULL };
+static const char *do_stop[] = { "do", NULL };
+static const char *done_stop[] = { "done", NULL };
+static const char *brace_stop[] = { "}", NULL };
+
+static htable functions;
+static bool functions_ready = false;
+static int calls = 0;
+static int running = 0;
+static bool interrupted = false; // ^C killed a command, the rest is dropped
+
+static void *grow(void *array, int *cap, int need, size_t size)
+{
+    if (need <= *cap) {
+        return array;
+    }
+    while (*cap < need) {
+        *cap = *cap == 0 ? 256 : *cap * 2;
+    }
+    array = realloc(array, *cap * size);
+    if (!array) {
+        fprintf(stderr, "90s: Error allocating memory\n");
+        exit(EXIT_FAILURE);
+    }
+    return array;
+}
+
+static void fail(compiler *c, const char *error)
+{
+    if (c->error == NULL) {
+        c->error = error;
+    }
+}
+
+static int emit(compiler *c, int value)
+{
+    c->code = grow(c->code, &c->code_cap, c->code_len + 1, sizeof(int));
+    c->code[c->code_len] = value;
+    return c->code_len++;
+}
+
+// emit a jump, returns where its target goes
+static int emit_jump(compiler *c, int op)
+{
+    emit(c, op);
+    return emit(c, -1);
+}
+
+// point every jump of a chain (linked through their targets) here
+static void patch_chain(compiler *c, int at)
+{
+    while (at != -1) {
+        int next = c->code[at];
+        c->code[at] = c->code_len;
+        at = next;
+    }
+}
+
+// offset of a word in the pool, each distinct word is stored once
+static int word(compiler *c, const char *s)
+{
+    size_t len = strlen(s);
+    intptr_t found = (intptr_t) ht_get(&c->pool, s, len);
+    if (found != 0) {
+        return found - 1;
+    }
+    int off = c->strings_len;
+    c->strings = grow(c->strings, &c->strings_cap, off + len + 1, 1);
+    memcpy(c->strings + off, s, len + 1);
+    c->strings_len += len + 1;
+    ht_put(&c->pool, s, len, (void *) (intptr_t) (off + 1));
+    return off;
+}
+
+static bool is(const char *w, const char *keyword)
+{
+    return w != NULL && strcmp(w, keyword) == 0;
+}
+
+static bool member(const char *w, const char **stop)
+{
+    for (int i = 0; w != NULL && stop != NULL && stop[i] != NULL; i++) {
+        if (strcmp(w, stop[i]) == 0) {
+            return true;
+        }
+    }
+    return false;
+}
+
+static command *first_cmd(compiler *c)
+{
+    return &c->list->pipes[c->pi].cmds[0];
+}
+
+// the first word of the next statement, NULL at the end or without words
+static const char *peek(compiler *c)
+{
+    if (c->pi >= c->list->num_pipes) {
+        return NULL;
+    }
+    command *cmd = first_cmd(c);
+    return c->off < cmd->argc ? cmd->argv[c->off] : NULL;
+}
+
+// whether the word after the next one is in the same command
+static bool more_words(compiler *c)
+{
+    return c->pi < c->list->num_pipes && c->off + 1 < first_cmd(c)->argc;
+}
+
+// take a keyword, its line is finished when no words are left
+static void take(compiler *c)
+{
+    pipeline *pipe = &c->list->pipes[c->pi];
+    if (++c->off < pipe->cmds[0].argc) {
+        return;
+    }
+    if (pipe->num_cmds > 1 || pipe->cmds[0].num_redirs > 0 || pipe->background) {
+        fail(c, "pipes, redirections and & do not apply to keywords");
+    }
+    c->last_next = pipe->next;
+    c->pi++;
+    c->off = 0;
+}
+
+static void expect(compiler *c, const char *keyword)
+{
+    static char error[64];
+    if (!is(peek(c), keyword)) {
+        snprintf(error, sizeof(error), "syntax error: '%s' expected", keyword);
+        fail(c, error);
+        return;
+    }
+    take(c);
+}
+
+// fi, done or } ends the command it is in
+static int close_compound(compiler *c, const char *keyword)
+{
+    static char error[64];
+    expect(c, keyword);
+    if (c->error == NULL && c->off != 0) {
+        snprintf(error, sizeof(error), "syntax error after '%s'", keyword);
+        fail(c, error);
+    }
+    return c->last_next;
+}
+
+static int compile_statement(compiler *c);
+
+/*
+ * Statements up to one of the keywords in stop, which is left for the
+ * caller. A statement after && or || is jumped over depending on the
+ * status the one before left.
+ */
+static void compile_list(compiler *c, const char **stop)
+{
+    int next = NEXT_ALWAYS;
+    while (c->error == NULL && c->pi < c->list->num_pipes) {
+        if (member(peek(c), stop)) {
+            if (next != NEXT_ALWAYS) {
+                fail(c, "syntax error: command expected after && or ||");
+            }
+            return;
+        }
+        int skip = -1;
+        if (next == NEXT_AND) {
+            skip = emit_jump(c, OP_JUMP_FAIL);
+        } else if (next == NEXT_OR) {
+            skip = emit_jump(c, OP_JUMP_OK);
+        }
+        next = compile_statement(c);
+        if (skip != -1) {
+            c->code[skip] = c->code_len;
+        }
+    }
+}
+
+static int compile_simple(compiler *c)
+{
+    pipeline *pipe = &c->list->pipes[c->pi];
+    emit(c, OP_RUN);
+    emit(c, pipe->background);
+    emit(c, pipe->num_cmds);
+    for (int i = 0; i < pipe->num_cmds; i++) {
+        command *cmd = &pipe->cmds[i];
+        int from = i == 0 ? c->off : 0;
+        emit(c, cmd->argc - from);
+        for (int k = from; k < cmd->argc; k++) {
+            emit(c, word(c, cmd->argv[k]));
+        }
+        emit(c, cmd->num_redirs);
+        for (int k = 0; k < cmd->num_redirs; k++) {
+            redir *r = &cmd->redirs[k];
+            emit(c, r->fd);
+            emit(c, r->kind);
+            emit(c, r->path != NULL ? word(c, r->path) : -1);
+            emit(c, r->target);
+        }
+    }
+    c->pi++;
+    c->off = 0;
+    return pipe->next;
+}
+
+// if with elif and else branches, 0 is the status when none ran
+static int compile_if(compiler *c)
+{
+    int ends = -1;
+    take(c);
+    compile_list(c, then_stop);
+    expect(c, "then");
+    int skip = emit_jump(c, OP_JUMP_FAIL);
+    compile_list(c, branch_stop);
+    while (c->error == NULL && is(peek(c), "elif")) {
+        emit(c, OP_JUMP);
+        ends = emit(c, ends);
+        c->code[skip] = c->code_len;
+        take(c);
+        compile_list(c, then_stop);
+        expect(c, "then");
+        skip = emit_jump(c, OP_JUMP_FAIL);
+        compile_list(c, branch_stop);
+    }
+    emit(c, OP_JUMP);
+    ends = emit(c, ends);
+    c->code[skip] = c->code_len;
+    if (is(peek(c), "else")) {
+        take(c);
+        compile_list(c, fi_stop);
+    } else {
+        emit(c, OP_STATUS);
+        emit(c, 0);
+    }
+    patch_chain(c, ends);
+    return close_compound(c, "fi");
+}
+
+static void push_loop(compiler *c, bool is_for, int top)
+{
+    if (c->num_loops == MAX_LOOPS) {
+        fail(c, "loops nested too deeply");
+        return;
+    }
+    loop *l = &c->loops[c->num_loops++];
+    l->is_for = is_for;
+    l->top = top;
+    l->breaks = -1;
+}
+
+static void pop_loop(compiler *c)
+{
+    if (c->error == NULL) {
+        patch_chain(c, c->loops[--c->num_loops].breaks);
+    }
+}
+
+// while and until, 0 is the status when the condition ends the loop
+static int compile_while(compiler *c)
+{
+    bool until = is(peek(c), "until");
+    take(c);
+    int top = c->code_len;
+    compile_list(c, do_stop);
+    expect(c, "do");
+    int exit = emit_jump(c, until ? OP_JUMP_OK : OP_JUMP_FAIL);
+    push_loop(c, false, top);
+    compile_list(c, done_stop);
+    emit(c, OP_JUMP);
+    emit(c, top);
+    c->code[exit] = c->code_len;
+    pop_loop(c);
+    emit(c, OP_STATUS);
+    emit(c, 0);
+    return close_compound(c, "done");
+}
+
+// for name [in words]; do ...; done, without in it loops over "$@"
+static int compile_for(compiler *c)
+{
+    take(c);
+    const char *name = peek(c);
+    if (name == NULL || !var_name(name, strlen(name))) {
+        fail(c, "syntax error: bad for loop variable");
+        return NEXT_ALWAYS;
+    }
+    int pi = c->pi;
+    emit(c, OP_FOR);
+    int name_word = emit(c, word(c, name));
+    int count = emit(c, 1);
+    take(c);
+    if (c->pi == pi && is(peek(c), "in")) {
+        command *cmd = first_cmd(c);
+        c->code[count] = cmd->argc - c->off - 1;
+        for (int k = c->off + 1; k < cmd->argc; k++) {
+            emit(c, word(c, cmd->argv[k]));
+        }
+        c->off = cmd->argc - 1;
+        take(c);
+    } else if (c->pi == pi) {
+        fail(c, "syntax error: 'in' expected");
+    } else {
+        static const char all[] = { EXPAND_QUOTED, '@', EXPAND_END, '\0' };
+        emit(c, word(c, all));
+    }
+    expect(c, "do");
+    int top = emit(c, OP_NEXT);
+    emit(c, c->code[name_word]);
+    int exit = emit(c, -1);
+    push_loop(c, true, top);
+    compile_list(c, done_stop);
+    emit(c, OP_JUMP);
+    emit(c, top);
+    c->code[exit] = c->code_len;
+    pop_loop(c);
+    return close_compound(c, "done");
+}
+
+// break and continue, with how many loops out
+static int compile_jump(compiler *c)
+{
+    bool is_break = is(peek(c), "break");
+    bool has_count = more_words(c);
+    take(c);
+    int n = 1;
+    if (has_count) {
+        n = atoi(peek(c));
+        take(c);
+    }
+    int visible = c->num_loops - c->loop_base;
+    if (n < 1 || visible == 0) {
+        fail(c, is_break ? "break: only meaningful in a loop" : "continue: only meaningful in a loop");
+        return NEXT_ALWAYS;
+    }
+    int target = c->num_loops - (n < visible ? n : visible);
+    for (int i = c->num_loops - 1; i >= target; i--) {
+        if (c->loops[i].is_for && (is_break || i > target)) {
+            emit(c, OP_POP);
+        }
+    }
+    emit(c, OP_JUMP);
+    if (is_break) {
+        c->loops[target].breaks = emit(c, c->loops[target].breaks);
+    } else {
+        emit(c, c->loops[target].top);
+    }
+    return c->last_next;
+}
+
+static int compile_return(compiler *c)
+{
+    bool has_status = more_words(c);
+    take(c);
+    int status = -1;
+    if (has_status) {
+        status = word(c, peek(c));
+        take(c);
+    }
+    emit(c, OP_RETURN);
+    emit(c, status);
+    return c->last_next;
+}
+
+// name() { ...; } or function name { ...; }, the name was taken
+static int compile_function(compiler *c, const char *name)
+{
+    if (!var_name(name, strlen(name))) {
+        fail(c, "syntax error: bad function name");
+        return NEXT_ALWAYS;
+    }
+    emit(c, OP_FUNC);
+    emit(c, word(c, name));
+    int end = emit(c, -1);
+    int base = c->loop_base;
+    c->loop_base = c->num_loops;
+    expect(c, "{");
+    compile_list(c, brace_stop);
+    int next = close_compound(c, "}");
+    c->loop_base = base;
+    emit(c, OP_RETURN);
+    emit(c, -1);
+    c->code[end] = c->code_len;
+    return next;
+}
+
+// the name of the function a statement defines, NULL when it is no definition
+static char *function_name(compiler *c)
+{
+    const char *w = peek(c);
+    size_t len = strlen(w);
+    char *name = NULL;
+    if (strcmp(w, "function") == 0 && more_words(c)) {
+        take(c);
+        w = peek(c);
+        len = strlen(w);
+        len -= len > 2 && strcmp(w + len - 2, "()") == 0 ? 2 : 0;
+    } else if (len > 2 && strcmp(w + len - 2, "()") == 0) {
+        len -= 2;
+    } else if (more_words(c) && strcmp(first_cmd(c)->argv[c->off + 1], "()") == 0) {
+        take(c);
+    } else {
+        return NULL;
+    }
+    name = arena_alloc(len + 1);
+    memcpy(name, w, len);
+    name[len] = '\0';
+    take(c);
+    return name;
+}
+
+static int compile_statement(compiler *c)
+{
+    static char error[64];
+    const char *w = peek(c);
+    char *name;
+    if (w == NULL) {
+        return compile_simple(c);
+    } else if (is(w, "if")) {
+        return compile_if(c);
+    } else if (is(w, "while") || is(w, "until")) {
+        return compile_while(c);
+    } else if (is(w, "for")) {
+        return compile_for(c);
+    } else if (is(w, "{")) {
+        take(c);
+        compile_list(c, brace_stop);
+        return close_compound(c, "}");
+    } else if (is(w, "!")) {
+        take(c);
+        int next = compile_statement(c);
+        emit(c, OP_NOT);
+        return next;
+    } else if (is(w, "break") || is(w, "continue")) {
+        return compile_jump(c);
+    } else if (is(w, "return")) {
+        return compile_return(c);
+    } else if (is(w, "then") || is(w, "elif") || is(w, "else") || is(w, "fi") ||
+            is(w, "do") || is(w, "done") || is(w, "}")) {
+        snprintf(error, sizeof(error), "syntax error near '%s'", w);
+        fail(c, error);
+        return NEXT_ALWAYS;
+    } else if ((name = function_name(c)) != NULL) {
+        return compile_function(c, name);
+    }
+    return compile_simple(c);
+}
+
+#define STR(x) #x
+#define XSTR(x) STR(x)
+
+// changes with every build of this file, where the opcodes are defined
+const char *script_build(void)
+{
+    return BLOCK_MAGIC " " XSTR(VERSION) " " __DATE__ " " __TIME__;
+}
+
+// operand i of the instruction at pc exists
+static bool has(const int *code, int code_len, int pc, int i)
+{
+    return pc + i < code_len;
+}
+
+/*
+ * Every instruction and operand is inside the code, every word inside
+ * the pool and every jump lands on an instruction, so a block read from
+ * a file can not make run() read outside of it
+ */
+static bool verify(const int *code, int code_len, const char *strings, int strings_len)
+{
+    if (strings_len > 0 && strings[strings_len - 1] != '\0') {
+        return false;
+    }
+    bool *starts = memalloc(code_len + 1);
+    memset(starts, 0, code_len + 1);
+    int pc = 0;
+    bool ok = true;
+#define WORD(w) ((w) >= 0 && (w) < strings_len)
+    while (ok && pc < code_len) {
+        starts[pc] = true;
+        int op = code[pc];
+        int next = pc + 1;
+        switch (op) {
+        case OP_RUN: {
+            ok = has(code, code_len, pc, 2) && code[pc + 2] > 0;
+            next = pc + 3;
+            for (int i = 0; ok && i < code[pc + 2]; i++) {
+                ok = next < code_len && code[next] >= 0 && next + code[next] < code_len;
+                for (int k = 1; ok && k <= code[next]; k++) {
+                    ok = WORD(code[next + k]);
+                }
+                if (!ok) {
+                    break;
+                }
+                next += code[next] + 1;
+                int redirs = next < code_len ? code[next++] : -1;
+                ok = redirs >= 0 && next + 4 * redirs <= code_len;
+                for (int k = 0; ok && k < redirs; k++, next += 4) {
+                    ok = code[next] >= 0 && code[next + 1] >= REDIR_IN && code[next + 1] <= REDIR_DUP &&
+                        (code[next + 2] == -1 || WORD(code[next + 2])) && code[next + 3] >= -1;
+                }
+            }
+            break;
+        }
+        case OP_JUMP:
+        case OP_JUMP_FAIL:
+        case OP_JUMP_OK:
+        case OP_STATUS:
+            ok = has(code, code_len, pc, 1);
+            next = pc + 2;
+            break;
+        case OP_NOT:
+        case OP_POP:
+            break;
+        case OP_FOR:
+            ok = has(code, code_len, pc, 2) && WORD(code[pc + 1]) && code[pc + 2] >= 0 &&
+                pc + 3 + code[pc + 2] <= code_len;
+            for (int k = 0; ok && k < code[pc + 2]; k++) {
+                ok = WORD(code[pc + 3 + k]);
+            }
+            next = ok ? pc + 3 + code[pc + 2] : code_len;
+            break;
+        case OP_NEXT:
+        case OP_FUNC:
+            ok = has(code, code_len, pc, 2) && WORD(code[pc + 1]);
+            next = pc + 3;
+            break;
+        case OP_RETURN:
+            ok = has(code, code_len, pc, 1) && (code[pc + 1] == -1 || WORD(code[pc + 1]));
+            next = pc + 2;
+            break;
+        default:
+            ok = false;
+            break;
+        }
+        pc = next;
+    }
+    starts[code_len] = true; // jumping to the end stops the program
+    for (pc = 0; ok && pc < code_len; ) {
+        int op = code[pc];
+        int target = op == OP_JUMP || op == OP_JUMP_FAIL || op == OP_JUMP_OK ? code[pc + 1] :
+            op == OP_NEXT || op == OP_FUNC ? code[pc + 2] : -2;
+        ok = target == -2 || (target >= 0 && target <= code_len && starts[target]);
+        do {
+            pc++;
+        } while (pc < code_len && !starts[pc]);
+    }
+#undef WORD
+    free(starts);
+    return ok;
+}
+
+/*
+ * A block holding a compiled program, as made by script_compile or read
+ * back from the cache, checked before it is used. The program does not
+ * own the block yet.
+ */
+program *script_load(void *block, size_t size)
+{
+    blockhead *head = block;
+    if (size < sizeof(blockhead) || memcmp(head->magic, BLOCK_MAGIC, 8) != 0 ||
+            head->code_len < 0 || head->strings_len < 0 ||
+            sizeof(blockhead) + sizeof(int) * head->code_len + head->strings_len != size) {
+        return NULL;
+    }
+    const int *code = (const int *) ((char *) block + sizeof(blockhead));
+    if (!verify(code, head->code_len, (const char *) (code + head->code_len), head->strings_len)) {
+        return NULL;
+    }
+    program *prog = memalloc(sizeof(program));
+    prog->code = (const int *) ((char *) block + sizeof(blockhead));
+    prog->code_len = head->code_len;
+    prog->strings = (const char *) (prog->code + head->code_len);
+    prog->block = block;
+    prog->size = size;
+    prog->mapped = false;
+    prog->refs = 1;
+    return prog;
+}
+
+/*
+ * Compile a parsed list, NULL after printing the error when it has one.
+ * name is the file it came from, for the message.
+ */
+program *script_compile(cmdlist *list, const char *name)
+{
+    compiler c;
+    memset(&c, 0, sizeof(c));
+    c.list = list;
+    c.error = list->error;
+    ht_init(&c.pool, 256);
+    compile_list(&c, NULL);
+
+    program *prog = NULL;
+    if (c.error != NULL) {
+        if (name != NULL) {
+            fprintf(stderr, "90s: %s: %s\n", name, c.error);
+        } else {
+            fprintf(stderr, "90s: %s\n", c.error);
+        }
+    } else {
+        size_t size = sizeof(blockhead) + sizeof(int) * c.code_len + c.strings_len;
+        char *block = memalloc(size);
+        blockhead head;
+        memset(&head, 0, sizeof(head));
+        memcpy(head.magic, BLOCK_MAGIC, 8);
+        head.code_len = c.code_len;
+        head.strings_len = c.strings_len;
+        memcpy(block, &head, sizeof(head));
+        memcpy(block + sizeof(head), c.code, sizeof(int) * c.code_len);
+        memcpy(block + sizeof(head) + sizeof(int) * c.code_len, c.strings, c.strings_len);
+        prog = script_load(block, size);
+    }
+    ht_free(&c.pool);
+    free(c.code);
+    free(c.strings);
+    return prog;
+}
+
+// drop a reference, the last one frees the program
+void script_release(program *prog)
+{
+    if (--prog->refs == 0) {
+        if (prog->mapped) {
+            munmap(prog->block, prog->size);
+        } else {
+            free(prog->block);
+        }
+        free(prog);
+    }
+}
+
+static const char *text(program *prog, int word)
+{
+    return prog->strings + word;
+}
+
+// build the pipeline of an OP_RUN from its operands, returns the next instruction
+static int decode(program *prog, int pc, pipeline *pipe)
+{
+    const int *code = prog->code;
+    pipe->background = code[pc++];
+    pipe->num_cmds = code[pc++];
+    pipe->next = NEXT_ALWAYS;
+    pipe->cmds = arena_alloc(sizeof(command) * pipe->num_cmds);
+    for (int i = 0; i < pipe->num_cmds; i++) {
+        command *cmd = &pipe->cmds[i];
+        int argc = code[pc++];
+        cmd->cap = argc + 1;
+        cmd->argv = arena_alloc(sizeof(char *) * cmd->cap);
+        cmd->argv[0] = NULL;
+        cmd->argc = 0;
+        for (int k = 0; k < argc; k++) {
+            expand_word(text(prog, code[pc++]), cmd);
+        }
+        cmd->num_redirs = code[pc++];
+        cmd->redirs = arena_alloc(sizeof(redir) * (cmd->num_redirs + 1));
+        for (int k = 0; k < cmd->num_redirs; k++) {
+            redir *r = &cmd->redirs[k];
+            r->fd = code[pc++];
+            r->kind = code[pc++];
+            r->path = code[pc] != -1 ? expand_text(text(prog, code[pc])) : NULL;
+            pc++;
+            r->target = code[pc++];
+        }
+    }
+    return pc;
+}
+
+static void define(program *prog, const char *name, int entry)
+{
+    if (!functions_ready) {
+        ht_init(&functions, 32);
+        functions_ready = true;
+    }
+    size_t len = strlen(name);
+    scriptfn *fn = ht_get(&functions, name, len);
+    if (fn == NULL) {
+        fn = memalloc(sizeof(scriptfn));
+        fn->name = memalloc(len + 1);
+        memcpy(fn->name, name, len + 1);
+        ht_put(&functions, fn->name, len, fn);
+    } else {
+        script_release(fn->prog);
+    }
+    prog->refs++;
+    fn->prog = prog;
+    fn->entry = entry;
+}
+
+/* a for loop being run: its words and the arena they are in */
+typedef struct loopframe {
+    command words;
+    int index;
+    arena_mark mark;
+} loopframe;
+
+// run code from pc until it ends or returns, 0 when the shell has to exit
+static int run(program *prog, int pc)
+{
+    const int *code = prog->code;
+    loopframe loops[MAX_LOOPS];
+    int num_loops = 0;
+    int ret = 1;
+    if (running++ == 0) {
+        interrupted = false;
+    }
+    prog->refs++;
+    while (ret != 0 && !interrupted && pc < prog->code_len) {
+        switch (code[pc]) {
+        case OP_RUN: {
+            arena_mark mark = arena_save();
+            pipeline pipe;
+            pc = decode(prog, pc + 1, &pipe);
+            last_signal = 0;
+            ret = execute_pipeline(&pipe);
+            interrupted = last_signal == SIGINT;
+            arena_restore(mark);
+            break;
+        }
+        case OP_JUMP:
+            pc = code[pc + 1];
+            break;
+        case OP_JUMP_FAIL:
+            pc = last_status != 0 ? code[pc + 1] : pc + 2;
+            break;
+        case OP_JUMP_OK:
+            pc = last_status == 0 ? code[pc + 1] : pc + 2;
+            break;
+        case OP_STATUS:
+            last_status = code[pc + 1];
+            pc += 2;
+            break;
+        case OP_NOT:
+            last_status = last_status == 0;
+            pc++;
+            break;
+        case OP_FOR: {
+            if (num_loops == MAX_LOOPS) {
+                fprintf(stderr, "90s: loops nested too deeply\n");
+                pc = prog->code_len;
+                break;
+            }
+            loopframe *l = &loops[num_loops++];
+            l->mark = arena_save();
+            l->words.cap = code[pc + 2] + 1;
+            l->words.argv = arena_alloc(sizeof(char *) * l->words.cap);
+            l->words.argv[0] = NULL;
+            l->words.argc = 0;
+            l->index = 0;
+            for (int k = 0; k < code[pc + 2]; k++) {
+                expand_word(text(prog, code[pc + 3 + k]), &l->words);
+            }
+            pc += 3 + code[pc + 2];
+            break;
+        }
+        case OP_NEXT: {
+            if (num_loops == 0) {
+                pc = prog->code_len;
+                break;
+            }
+            loopframe *l = &loops[num_loops - 1];
+            if (l->index < l->words.argc) {
+                var_set(text(prog, code[pc + 1]), l->words.argv[l->index++]);
+                pc += 3;
+            } else {
+                if (l->index == 0) {
+                    last_status = 0;
+                }
+                arena_restore(l->mark);
+                num_loops--;
+                pc = code[pc + 2];
+            }
+            break;
+        }
+        case OP_POP:
+            if (num_loops > 0) {
+                arena_restore(loops[--num_loops].mark);
+            }
+            pc++;
+            break;
+        case OP_FUNC:
+            define(prog, text(prog, code[pc + 1]), pc + 3);
+            pc = code[pc + 2];
+            break;
+        case OP_RETURN:
+            if (code[pc + 1] != -1) {
+                arena_mark mark = arena_save();
+                last_status = atoi(expand_text(text(prog, code[pc + 1]))) & 0xff;
+                arena_restore(mark);
+            }
+            pc = prog->code_len;
+            break;
+        default:
+            fprintf(stderr, "90s: bad instruction %d\n", code[pc]);
+            pc = prog->code_len;
+            break;
+        }
+    }
+    if (num_loops > 0) {
+        arena_restore(loops[0].mark);
+    }
+    running--;
+    script_release(prog);
+    return ret;
+}
+
+// run a whole program, args become $1 $2 ... unless NULL
+int script_run(program *prog, char **args, int count)
+{
+    params saved;
+    if (args != NULL) {
+        saved = params_set(args, count);
+    }
+    int ret = run(prog, 0);
+    if (args != NULL) {
+        params_restore(saved);
+    }
+    return ret;
+}
+
+// compile and run a command line, 0 when the shell has to exit
+int script_execute(cmdlist *list)
+{
+    program *prog = script_compile(list, NULL);
+    if (prog == NULL) {
+        last_status = 2;
+        return 1;
+    }
+    int ret = script_run(prog, NULL, 0);
+    script_release(prog);
+    return ret;
+}
+
+// read and compile a whole file, NULL when it has a syntax error
+static program *compile_file(int fd, const char *path, size_t size)
+{
+    size_t cap = size + 1;
+    size_t len = 0;
+    char *source = memalloc(cap);
+    ssize_t n;
+    while ((n = read(fd, source + len, cap - len)) > 0) {
+        len += n;
+        if (len == cap) {
+            cap *= 2;
+            source = realloc(source, cap);
+            if (!source) {
+                fprintf(stderr, "90s: Error allocating memory\n");
+                exit(EXIT_FAILURE);
+            }
+        }
+    }
+    arena_mark mark = arena_save();
+    program *prog = script_compile(parse(source, len, NULL, NULL), path);
+    arena_restore(mark);
+    free(source);
+    return prog;
+}
+
+/*
+ * Run a file: it is compiled as a whole before anything runs, a syntax
+ * error anywhere runs nothing. The compiled form is taken from the cache
+ * while the file is unchanged, it is not read then. 0 when it exited the
+ * shell.
+ */
+int script_file(const char *path, char **args, int count)
+{
+    int fd = open(path, O_RDONLY | O_CLOEXEC);
+    struct stat st;
+    if (fd == -1 || fstat(fd, &st) == -1 || !S_ISREG(st.st_mode)) {
+        fprintf(stderr, "90s: no such file or directory '%s'\n", path);
+        if (fd != -1) {
+            close(fd);
+        }
+        last_status = 1;
+        return 1;
+    }
+    program *prog = scriptcache_load(path, &st);
+    if (prog == NULL) {
+        alias_record();
+        prog = compile_file(fd, path, st.st_size);
+        size_t len;
+        const char *names = alias_recorded(&len);
+        if (prog != NULL) {
+            scriptcache_store(path, &st, prog, names, len);
+        }
+    }
+    close(fd);
+    if (prog == NULL) {
+        last_status = 2;
+        return 1;
+    }
+    int ret = script_run(prog, args, count);
+    script_release(prog);
+    return ret;
+}
+
+scriptfn *script_function(const char *name)
+{
+    return functions_ready ? ht_get(&functions, name, strlen(name)) : NULL;
+}
+
+// call a function with argv[1] ... as its arguments, 0 when it exited the shell
+int script_call(scriptfn *fn, char **argv)
+{
+    if (calls == MAX_CALLS) {
+        fprintf(stderr, "90s: %s: functions nested too deeply\n", fn->name);
+        last_status = 1;
+        return 1;
+    }
+    int count = 0;
+    while (argv[count + 1] != NULL) {
+        count++;
+    }
+    params saved = params_set(argv + 1, count);
+    calls++;
+    int ret = run(fn->prog, fn->entry);
+    calls--;
+    params_restore(saved);
+    return ret;
+}
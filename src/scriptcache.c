@@ -0,0 +1,166 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <limits.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+#include <sys/uio.h>
+
+#include "scriptcache.h"
+#include "constants.h"
+#include "history.h"
+#include "alias.h"
+#include "hash.h"
+#include "90s.h"
+
+/*
+ * Compiled scripts are kept in CACHEDIR next to the history, one file per
+ * script named after a hash of its real path. A file holds a header with
+ * what the script looked like when it was compiled, the program block,
+ * the path and the names the parser looked up as aliases. It is mapped
+ * and used as is while the script has the same device, inode, size and
+ * mtime and those names stand for the same aliases (they are expanded
+ * into the code), anything else compiles the script again and replaces
+ * the file. Files are written to a temporary name and renamed, so a
+ * shell never maps a half written one.
+ */
+typedef struct cachehead {
+    char magic[8];
+    uint64_t build; /* hash of script_build(), code of another build is not run */
+    uint64_t dev;
+    uint64_t ino;
+    uint64_t size;
+    int64_t mtime_sec;
+    int64_t mtime_nsec;
+    uint64_t aliases; /* alias_digest() of the names when it was compiled */
+    uint64_t block_size; /* program block following the header */
+    uint64_t path_len; /* real path of the script, after the block */
+    uint64_t names_len; /* names looked up as aliases, after the path */
+} cachehead;
+
+#define CACHE_MAGIC "90scach3"
+
+static char *cache_dir = NULL;
+
+// the cache file for a script, NULL when there is nowhere to keep it
+static char *cache_file(const char *path, char *real)
+{
+    if (realpath(path, real) == NULL) {
+        return NULL;
+    }
+    if (cache_dir == NULL) {
+        if (getenv("XDG_CONFIG_HOME") == NULL && getenv("HOME") == NULL) {
+            return NULL;
+        }
+        cache_dir = config_path(CACHEDIR);
+    }
+    char *file = memalloc(strlen(cache_dir) + 18);
+    sprintf(file, "%s/%016lx", cache_dir, strhash(real, strlen(real)));
+    return file;
+}
+
+static void expected(cachehead *head, struct stat *st)
+{
+    memset(head, 0, sizeof(cachehead));
+    memcpy(head->magic, CACHE_MAGIC, 8);
+    head->build = strhash(script_build(), strlen(script_build()));
+    head->dev = st->st_dev;
+    head->ino = st->st_ino;
+    head->size = st->st_size;
+    head->mtime_sec = st->st_mtim.tv_sec;
+    head->mtime_nsec = st->st_mtim.tv_nsec;
+}
+
+// the cached program of a script, NULL when there is none or it is stale
+program *scriptcache_load(const char *path, struct stat *st)
+{
+    char real[PATH_MAX];
+    char *file = cache_file(path, real);
+    if (file == NULL) {
+        return NULL;
+    }
+    int fd = open(file, O_RDONLY | O_CLOEXEC);
+    free(file);
+    struct stat cst;
+    if (fd == -1) {
+        return NULL;
+    }
+    if (fstat(fd, &cst) == -1 || (size_t) cst.st_size < sizeof(cachehead)) {
+        close(fd);
+        return NULL;
+    }
+    char *map = mmap(NULL, cst.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (map == MAP_FAILED) {
+        return NULL;
+    }
+    cachehead want;
+    expected(&want, st);
+    cachehead *head = (cachehead *) map;
+    uint64_t rest = cst.st_size - sizeof(cachehead);
+    want.block_size = head->block_size;
+    want.path_len = strlen(real);
+    want.names_len = head->names_len;
+    program *prog = NULL;
+    if (head->block_size <= rest && head->names_len <= rest &&
+            head->block_size + want.path_len + head->names_len == rest) {
+        char *path_at = map + sizeof(cachehead) + head->block_size;
+        want.aliases = alias_digest(path_at + want.path_len, head->names_len);
+        if (memcmp(head, &want, sizeof(cachehead)) == 0 &&
+                memcmp(path_at, real, want.path_len) == 0) {
+            prog = script_load(map + sizeof(cachehead), head->block_size);
+        }
+    }
+    if (prog == NULL) {
+        munmap(map, cst.st_size);
+        return NULL;
+    }
+    prog->block = map;
+    prog->size = cst.st_size;
+    prog->mapped = true;
+    return prog;
+}
+
+/*
+ * Keep the program compiled from a script for the next time it is run,
+ * names are the ones looked up as aliases while it was parsed
+ */
+void scriptcache_store(const char *path, struct stat *st, program *prog,
+        const char *names, size_t names_len)
+{
+    char real[PATH_MAX];
+    char *file = cache_file(path, real);
+    if (file == NULL) {
+        return;
+    }
+    mkdir(cache_dir, 0700);
+    char *tmp = memalloc(strlen(file) + 24);
+    sprintf(tmp, "%s.%ld", file, (long) getpid());
+    cachehead head;
+    expected(&head, st);
+    head.aliases = alias_digest(names, names_len);
+    head.block_size = prog->size;
+    head.path_len = strlen(real);
+    head.names_len = names_len;
+    struct iovec iov[4] = {
+        { &head, sizeof(head) },
+        { prog->block, prog->size },
+        { real, head.path_len },
+        { (char *) names, names_len },
+    };
+    size_t total = sizeof(head) + prog->size + head.path_len + names_len;
+    int fd = open(tmp, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0600);
+    bool ok = fd != -1 && writev(fd, iov, 4) == (ssize_t) total;
+    if (fd != -1 && close(fd) == -1) {
+        ok = false;
+    }
+    if (!ok || rename(tmp, file) == -1) {
+        unlink(tmp); // a cache that can not be written is not an error
+    }
+    free(tmp);
+    free(file);
+}
@@ -0,0 +1,148 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+#include <ctype.h>
+
+#include "search.h"
+#include "history.h"
+#include "fuzzy.h"
+#include "90s.h"
+
+/*
+ * Fuzzy search over the history for Ctrl-R and history -f. Every line
+ * is scored, the best ones are kept in a small array ordered by score.
+ * Lines are visited newest first and a line only displaces a strictly
+ * worse one, so among equal scores the newer line comes first, and a
+ * line equal to one already kept is skipped.
+ *
+ * Only lines that hold every byte of the query can match, so each line
+ * has a 64 bit mask of the bytes in it (letters and digits a bit each,
+ * case folded, other bytes share the rest). The masks are built on first
+ * use and extended with newer lines, a query checks one AND per line and
+ * scores only the lines that pass. The masks of lines that left the
+ * ring are dropped once they make up half the array.
+ *
+ * A line matching a query also matches every query before it that the
+ * query extends, so the ids of all lines the last query matched are kept
+ * and a query extending it scores only those and the lines added since.
+ */
+static uint64_t *masks = NULL;
+static size_t masks_from = 0; /* id of masks[0] */
+static size_t masks_end = 0; /* ids below this have a mask */
+static size_t masks_cap = 0;
+
+static size_t *matched = NULL; /* ids matching the last query, newest first */
+static size_t num_matched = 0;
+static size_t matched_end = 0; /* hist_end() when they were found */
+static char last_query[FUZZY_MAX];
+static size_t last_len = 0; /* 0 when there is no last query */
+
+static uint64_t byte_mask(const char *s, size_t len)
+{
+    uint64_t mask = 0;
+    for (size_t i = 0; i < len; i++) {
+        unsigned char c = tolower((unsigned char) s[i]);
+        int bit = c >= 'a' && c <= 'z' ? c - 'a' : c >= '0' && c <= '9' ? 26 + c - '0' : 36 + c % 28;
+        mask |= (uint64_t) 1 << bit;
+    }
+    return mask;
+}
+
+static void update_masks(void)
+{
+    if (masks == NULL) {
+        masks_from = masks_end = hist_first();
+    }
+    size_t first = hist_first();
+    size_t end = hist_end();
+    if (first > masks_from && first - masks_from > (masks_end - masks_from) / 2) {
+        if (masks_end > first) {
+            memmove(masks, masks + (first - masks_from), sizeof(uint64_t) * (masks_end - first));
+        } else {
+            masks_end = first;
+        }
+        masks_from = first;
+    }
+    if (end - masks_from > masks_cap) {
+        masks_cap = (end - masks_from) * 2 + 1024;
+        masks = realloc(masks, sizeof(uint64_t) * masks_cap);
+        if (!masks) {
+            fprintf(stderr, "90s: Error allocating memory\n");
+            exit(EXIT_FAILURE);
+        }
+    }
+    for (size_t id = masks_end; id < end; id++) {
+        size_t len;
+        const char *line = hist_entry(id, &len);
+        masks[id - masks_from] = byte_mask(line, len);
+    }
+    masks_end = end;
+}
+
+static bool kept(size_t *ids, int *scores, size_t n, int score, const char *line, size_t len)
+{
+    for (size_t i = 0; i < n && scores[i] >= score; i++) {
+        size_t other_len;
+        const char *other = hist_entry(ids[i], &other_len);
+        if (scores[i] == score && other_len == len && memcmp(other, line, len) == 0) {
+            return true;
+        }
+    }
+    return false;
+}
+
+// ids of the entries matching query best, best first, returns how many
+size_t hist_fuzzy(const char *query, size_t qlen, size_t *ids, size_t max)
+{
+    fuzzy f;
+    fuzzy_init(&f, query, qlen);
+    if (qlen == 0 || max == 0) {
+        return 0;
+    }
+    update_masks();
+    uint64_t need = byte_mask(query, f.len);
+    size_t first = hist_first() > masks_from ? hist_first() : masks_from;
+    size_t end = hist_end();
+    bool narrow = last_len > 0 && f.len >= last_len && memcmp(query, last_query, last_len) == 0;
+    size_t added_from = narrow && matched_end > first ? matched_end : first;
+    size_t added = end > added_from ? end - added_from : 0;
+    size_t old = narrow ? num_matched : 0;
+    size_t *found = memalloc(sizeof(size_t) * (added + old + 1));
+    size_t num_found = 0;
+    int *scores = memalloc(sizeof(int) * max);
+    size_t n = 0;
+    for (size_t i = 0; i < added + old; i++) {
+        size_t id = i < added ? end - 1 - i : matched[i - added];
+        if (id < first || (masks[id - masks_from] & need) != need) {
+            continue;
+        }
+        size_t len;
+        const char *line = hist_entry(id, &len);
+        int score = fuzzy_score(&f, line, len);
+        if (score < 0) {
+            continue;
+        }
+        found[num_found++] = id;
+        if ((n == max && score <= scores[n - 1]) || kept(ids, scores, n, score, line, len)) {
+            continue;
+        }
+        size_t at = n < max ? n++ : n - 1;
+        while (at > 0 && scores[at - 1] < score) {
+            scores[at] = scores[at - 1];
+            ids[at] = ids[at - 1];
+            at--;
+        }
+        scores[at] = score;
+        ids[at] = id;
+    }
+    free(scores);
+    free(matched);
+    matched = found;
+    num_matched = num_found;
+    matched_end = end;
+    memcpy(last_query, query, f.len);
+    last_len = f.len;
+    return n;
+}
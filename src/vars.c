@@ -0,0 +1,507 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdbool.h>
+#include <ctype.h>
+#include <unistd.h>
+
+#include "vars.h"
+#include "hash.h"
+#include "runlog.h"
+#include "cmdcache.h"
+#include "90s.h"
+
+/*
+ * Shell variables and positional parameters, and the expansion of the $
+ * references the parser marked in words. A variable that is in the
+ * environment is kept only there, assigning it changes the environment.
+ * Expanded text is allocated from the arena, unquoted values are split
+ * into fields on blanks.
+ */
+typedef struct shellvar {
+    char *value;
+    char name[];
+} shellvar;
+
+static htable vars;
+static bool vars_ready = false;
+static params current = { NULL, 0 };
+
+static shellvar *find_var(const char *name)
+{
+    if (!vars_ready) {
+        ht_init(&vars, 64);
+        vars_ready = true;
+    }
+    return ht_get(&vars, name, strlen(name));
+}
+
+static void drop_var(shellvar *v)
+{
+    ht_del(&vars, v->name, strlen(v->name));
+    free(v->value);
+    free(v);
+}
+
+const char *var_get(const char *name)
+{
+    shellvar *v = find_var(name);
+    return v != NULL ? v->value : getenv(name);
+}
+
+void var_set(const char *name, const char *value)
+{
+    shellvar *v = find_var(name);
+    if (v == NULL && getenv(name) != NULL) {
+        var_export(name, value);
+        return;
+    }
+    if (v == NULL) {
+        size_t len = strlen(name);
+        v = memalloc(sizeof(shellvar) + len + 1);
+        memcpy(v->name, name, len + 1);
+        ht_put(&vars, v->name, len, v);
+    } else {
+        free(v->value);
+    }
+    v->value = memalloc(strlen(value) + 1);
+    strcpy(v->value, value);
+}
+
+// put a variable in the environment, a NULL value exports the shell variable
+void var_export(const char *name, const char *value)
+{
+    shellvar *v = find_var(name);
+    if (value == NULL && v == NULL) {
+        return;
+    }
+    if (setenv(name, value != NULL ? value : v->value, 1) != 0) {
+        fprintf(stderr, "90s: Error setting environment variable\n");
+    }
+    if (v != NULL) {
+        drop_var(v);
+    }
+    if (strcmp(name, "PATH") == 0) {
+        cmdcache_init(); // new directory list, rebuild command cache
+    }
+}
+
+void var_unset(const char *name)
+{
+    shellvar *v = find_var(name);
+    if (v != NULL) {
+        drop_var(v);
+    } else if (getenv(name) != NULL) {
+        unsetenv(name);
+        if (strcmp(name, "PATH") == 0) {
+            cmdcache_init();
+        }
+    }
+}
+
+bool var_name(const char *name, int len)
+{
+    if (len <= 0 || isdigit((unsigned char) name[0])) {
+        return false;
+    }
+    for (int i = 0; i < len; i++) {
+        if (!isalnum((unsigned char) name[i]) && name[i] != '_') {
+            return false;
+        }
+    }
+    return true;
+}
+
+// NAME=value
+bool var_assignment(const char *word)
+{
+    const char *eq = strchr(word, '=');
+    return eq != NULL && var_name(word, eq - word);
+}
+
+void var_assign(const char *word)
+{
+    const char *eq = strchr(word, '=');
+    char name[256];
+    if ((size_t) (eq - word) < sizeof(name)) {
+        memcpy(name, word, eq - word);
+        name[eq - word] = '\0';
+        var_set(name, eq + 1);
+    }
+}
+
+// make args $1 $2 ..., returns what to give params_restore afterwards
+params params_set(char **args, int count)
+{
+    params saved = current;
+    current.args = args;
+    current.count = count;
+    return saved;
+}
+
+void params_restore(params saved)
+{
+    current = saved;
+}
+
+bool params_shift(int n)
+{
+    if (n < 0 || n > current.count) {
+        return false;
+    }
+    current.args += n;
+    current.count -= n;
+    return true;
+}
+
+/*
+ * $((...)): integer arithmetic with C precedence for || && == != < <= >
+ * >= + - * / % and unary ! - +, variables by name with or without $
+ */
+typedef struct arith {
+    const char *s;
+    const char *end;
+    bool error;
+} arith;
+
+static const char *arith_ops[][5] = {
+    { "||", NULL }, { "&&", NULL }, { "==", "!=", NULL },
+    { "<=", ">=", "<", ">", NULL }, { "+", "-", NULL }, { "*", "/", "%", NULL }
+};
+#define ARITH_LEVELS 6
+
+static void arith_blank(arith *a)
+{
+    while (a->s < a->end && isspace((unsigned char) *a->s)) {
+        a->s++;
+    }
+}
+
+static bool arith_accept(arith *a, const char *op)
+{
+    size_t n = strlen(op);
+    arith_blank(a);
+    if ((size_t) (a->end - a->s) >= n && memcmp(a->s, op, n) == 0) {
+        a->s += n;
+        return true;
+    }
+    return false;
+}
+
+static long arith_binary(arith *a, int level);
+static const char *value_of(const char *ref, size_t len);
+
+static long arith_unary(arith *a)
+{
+    if (arith_accept(a, "!")) {
+        return !arith_unary(a);
+    } else if (arith_accept(a, "-")) {
+        return -arith_unary(a);
+    } else if (arith_accept(a, "+")) {
+        return arith_unary(a);
+    } else if (arith_accept(a, "(")) {
+        long v = arith_binary(a, 0);
+        if (!arith_accept(a, ")")) {
+            a->error = true;
+        }
+        return v;
+    }
+    if (a->s < a->end && isdigit((unsigned char) *a->s)) {
+        char *end;
+        long v = strtol(a->s, &end, 0);
+        a->s = end;
+        return v;
+    }
+    if (a->s + 1 < a->end && *a->s == '$' && strchr("?#0123456789", a->s[1]) != NULL) {
+        a->s += 2;
+        const char *value = value_of(a->s - 1, 1);
+        return value != NULL ? strtol(value, NULL, 0) : 0;
+    } else if (a->s < a->end && *a->s == '$') {
+        a->s++;
+    }
+    const char *name = a->s;
+    while (a->s < a->end && (isalnum((unsigned char) *a->s) || *a->s == '_')) {
+        a->s++;
+    }
+    char buf[256];
+    if (!var_name(name, a->s - name) || (size_t) (a->s - name) >= sizeof(buf)) {
+        a->error = true;
+        return 0;
+    }
+    memcpy(buf, name, a->s - name);
+    buf[a->s - name] = '\0';
+    const char *value = var_get(buf);
+    return value != NULL ? strtol(value, NULL, 0) : 0;
+}
+
+static long arith_binary(arith *a, int level)
+{
+    if (level == ARITH_LEVELS) {
+        return arith_unary(a);
+    }
+    long v = arith_binary(a, level + 1);
+    for (;;) {
+        const char *op = NULL;
+        for (int k = 0; arith_ops[level][k] != NULL && op == NULL; k++) {
+            if (arith_accept(a, arith_ops[level][k])) {
+                op = arith_ops[level][k];
+            }
+        }
+        if (op == NULL || a->error) {
+            return v;
+        }
+        long r = arith_binary(a, level + 1);
+        if ((*op == '/' || *op == '%') && r == 0) {
+            a->error = true;
+            return 0;
+        }
+        switch (op[0]) {
+        case '|': v = v || r; break;
+        case '&': v = v && r; break;
+        case '=': v = v == r; break;
+        case '!': v = v != r; break;
+        case '<': v = op[1] == '=' ? v <= r : v < r; break;
+        case '>': v = op[1] == '=' ? v >= r : v > r; break;
+        case '+': v = v + r; break;
+        case '-': v = v - r; break;
+        case '*': v = v * r; break;
+        case '/': v = v / r; break;
+        default: v = v % r; break;
+        }
+    }
+}
+
+static long arithmetic(const char *s, size_t len)
+{
+    arith a = { s, s + len, false };
+    long v = arith_binary(&a, 0);
+    arith_blank(&a);
+    if (a.error || a.s != a.end) {
+        fprintf(stderr, "90s: arithmetic syntax error: %.*s\n", (int) len, s);
+        return 0;
+    }
+    return v;
+}
+
+static char *copy_text(const char *s, size_t len)
+{
+    char *copy = arena_alloc(len + 1);
+    memcpy(copy, s, len);
+    copy[len] = '\0';
+    return copy;
+}
+
+// ${name}, ${#name}, ${name-word} and ${name:-word}, ${name=word} and ${name:=word}
+static const char *braced(const char *s, size_t len)
+{
+    bool length = len > 1 && *s == '#';
+    s += length;
+    len -= length;
+    size_t n = 0;
+    while (n < len && (isalnum((unsigned char) s[n]) || s[n] == '_')) {
+        n++;
+    }
+    char *name = copy_text(s, n);
+    const char *value;
+    if (n > 0 && isdigit((unsigned char) *s)) {
+        int i = atoi(name);
+        value = i == 0 ? "90s" : i <= current.count ? current.args[i - 1] : NULL;
+    } else {
+        value = var_get(name);
+    }
+    if (length) {
+        char *buf = arena_alloc(24);
+        snprintf(buf, 24, "%zu", value != NULL ? strlen(value) : 0);
+        return buf;
+    }
+    if (n == len) {
+        return value;
+    }
+    bool colon = s[n] == ':';
+    char op = s[n + colon];
+    const char *word = copy_text(s + n + colon + 1, len - n - colon - 1);
+    bool unset = value == NULL || (colon && *value == '\0');
+    if (!unset) {
+        return value;
+    } else if (op == '-') {
+        return word;
+    } else if (op == '=') {
+        var_set(name, word);
+        return word;
+    }
+    fprintf(stderr, "90s: bad substitution: ${%.*s}\n", (int) len, s);
+    return NULL;
+}
+
+// the value of the reference between a marker and EXPAND_END
+static const char *value_of(const char *ref, size_t len)
+{
+    char *buf = arena_alloc(24);
+    if (*ref == '?') {
+        snprintf(buf, 24, "%d", last_status);
+    } else if (*ref == '$') {
+        snprintf(buf, 24, "%ld", (long) getpid());
+    } else if (*ref == '#') {
+        snprintf(buf, 24, "%d", current.count);
+    } else if (isdigit((unsigned char) *ref)) {
+        int i = *ref - '0';
+        return i == 0 ? "90s" : i <= current.count ? current.args[i - 1] : NULL;
+    } else if (*ref == '@' || *ref == '*') {
+        size_t total = 1;
+        for (int i = 0; i < current.count; i++) {
+            total += strlen(current.args[i]) + 1;
+        }
+        char *all = arena_alloc(total);
+        char *p = all;
+        *p = '\0';
+        for (int i = 0; i < current.count; i++) {
+            p = stpcpy(p, current.args[i]);
+            if (i + 1 < current.count) {
+                *p++ = ' ';
+            }
+        }
+        *p = '\0';
+        return all;
+    } else if (*ref == '{') {
+        return braced(ref + 1, len - 2);
+    } else if (*ref == '(') {
+        snprintf(buf, 24, "%ld", arithmetic(ref + 2, len - 4));
+    } else {
+        return var_get(copy_text(ref, len));
+    }
+    return buf;
+}
+
+/* one field being built by expansion */
+typedef struct field {
+    char *buf;
+    size_t len;
+    size_t cap;
+    bool present; /* quoted empty text makes a field too */
+} field;
+
+static void field_add(field *f, const char *s, size_t n)
+{
+    if (f->len + n + 1 > f->cap) {
+        size_t cap = f->cap == 0 ? 64 : f->cap;
+        while (cap < f->len + n + 1) {
+            cap *= 2;
+        }
+        f->buf = arena_grow(f->buf, f->cap, cap);
+        f->cap = cap;
+    }
+    memcpy(f->buf + f->len, s, n);
+    f->len += n;
+    f->buf[f->len] = '\0';
+    f->present = true;
+}
+
+static void field_end(field *f, command *cmd)
+{
+    if (f->present) {
+        if (f->buf == NULL) {
+            field_add(f, "", 0);
+        }
+        command_insert(cmd, cmd->argc, f->buf);
+    }
+    f->buf = NULL;
+    f->len = 0;
+    f->cap = 0;
+    f->present = false;
+}
+
+/*
+ * An unquoted value, blanks end the field being built and make none of
+ * their own, so leading, trailing and only blanks add no empty fields
+ */
+static void field_split(field *f, const char *value, command *cmd)
+{
+    while (*value != '\0') {
+        size_t n = strcspn(value, " \t\n");
+        if (n > 0) {
+            field_add(f, value, n);
+            value += n;
+        }
+        if (*value != '\0') {
+            field_end(f, cmd);
+            value += strspn(value, " \t\n");
+        }
+    }
+}
+
+static void expand(const char *word, command *cmd, bool split)
+{
+    field f = { NULL, 0, 0, false };
+    const char *s = word;
+    while (*s != '\0') {
+        size_t n = strcspn(s, "\001\003");
+        if (n > 0) {
+            field_add(&f, s, n);
+            s += n;
+            continue;
+        }
+        bool quoted = *s == EXPAND_QUOTED || !split;
+        const char *ref = s + 1;
+        const char *end = strchr(ref, EXPAND_END);
+        if (end == NULL) {
+            break;
+        }
+        s = end + 1;
+        if (quoted && *ref == '@' && end - ref == 1) {
+            for (int i = 0; i < current.count; i++) {
+                if (i > 0) {
+                    field_end(&f, cmd);
+                }
+                field_add(&f, current.args[i], strlen(current.args[i]));
+            }
+            continue;
+        }
+        const char *value = value_of(ref, end - ref);
+        if (value == NULL) {
+            f.present |= quoted;
+        } else if (quoted) {
+            field_add(&f, value, strlen(value));
+        } else {
+            field_split(&f, value, cmd);
+        }
+    }
+    field_end(&f, cmd);
+}
+
+// append the fields a word expands to as arguments of cmd
+void expand_word(const char *word, command *cmd)
+{
+    if (strpbrk(word, "\001\003") == NULL) {
+        command_insert(cmd, cmd->argc, copy_text(word, strlen(word)));
+    } else {
+        expand(word, cmd, true);
+    }
+}
+
+// a word expanded without splitting, for file names and loop variables
+char *expand_text(const char *word)
+{
+    if (strpbrk(word, "\001\003") == NULL) {
+        return copy_text(word, strlen(word));
+    }
+    command cmd = { arena_alloc(sizeof(char *) * 4), 0, 4, NULL, 0 };
+    cmd.argv[0] = NULL;
+    expand(word, &cmd, false);
+    if (cmd.argc == 1) {
+        return cmd.argv[0];
+    }
+    size_t total = 1;
+    for (int i = 0; i < cmd.argc; i++) {
+        total += strlen(cmd.argv[i]) + 1;
+    }
+    char *text = arena_alloc(total);
+    char *p = text;
+    for (int i = 0; i < cmd.argc; i++) {
+        p = stpcpy(p, cmd.argv[i]);
+        if (i + 1 < cmd.argc) {
+            *p++ = ' ';
+        }
+    }
+    *p = '\0';
+    return text;
+}
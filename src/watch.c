@@ -0,0 +1,149 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <sys/inotify.h>
+
+#include "watch.h"
+#include "90s.h"
+
+/*
+ * One inotify descriptor for every cache that needs to know when the
+ * filesystem changed under it. Watch descriptors are small integers, the
+ * handlers of each are found by indexing. A directory watched by two
+ * caches has one descriptor with both handlers, each gets every event of
+ * it. Events are only read when a cache asks, or when the line editor
+ * sees the descriptor readable.
+ */
+typedef struct watcher {
+    watch_fn fn;
+    void *data;
+    struct watcher *next;
+} watcher;
+
+static int inotify_fd = -1;
+static watcher **watchers = NULL;
+static int num_watchers = 0;
+
+// returns the watch descriptor, -1 when the path can not be watched
+int watch_add(const char *path, uint32_t mask, watch_fn fn, void *data)
+{
+    if (inotify_fd == -1) {
+        inotify_fd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+        if (inotify_fd == -1) {
+            return -1;
+        }
+    }
+    // events another cache asked for on the same directory are kept
+    int wd = inotify_add_watch(inotify_fd, path, mask | IN_MASK_ADD);
+    if (wd == -1) {
+        return -1;
+    }
+    if (wd >= num_watchers) {
+        int size = num_watchers == 0 ? 64 : num_watchers;
+        while (size <= wd) {
+            size *= 2;
+        }
+        watchers = realloc(watchers, sizeof(watcher *) * size);
+        if (!watchers) {
+            fprintf(stderr, "90s: Error allocating memory\n");
+            exit(EXIT_FAILURE);
+        }
+        memset(watchers + num_watchers, 0, sizeof(watcher *) * (size - num_watchers));
+        num_watchers = size;
+    }
+    for (watcher *w = watchers[wd]; w != NULL; w = w->next) {
+        if (w->fn == fn && w->data == data) {
+            return wd;
+        }
+    }
+    watcher *w = memalloc(sizeof(watcher));
+    w->fn = fn;
+    w->data = data;
+    w->next = watchers[wd];
+    watchers[wd] = w;
+    return wd;
+}
+
+// forget one handler, the watch itself goes with the last one
+void watch_remove(int wd, watch_fn fn, void *data)
+{
+    if (wd < 0 || wd >= num_watchers) {
+        return;
+    }
+    for (watcher **w = &watchers[wd]; *w != NULL; w = &(*w)->next) {
+        if ((*w)->fn == fn && (*w)->data == data) {
+            watcher *gone = *w;
+            *w = gone->next;
+            free(gone);
+            break;
+        }
+    }
+    if (watchers[wd] == NULL) {
+        inotify_rm_watch(inotify_fd, wd);
+    }
+}
+
+int watch_fd(void)
+{
+    return inotify_fd;
+}
+
+// hand every queued event to its handlers, never blocks
+void watch_poll(void)
+{
+    union {
+        struct inotify_event align;
+        char buf[16384];
+    } events;
+    char *buf = events.buf;
+    if (inotify_fd == -1) {
+        return;
+    }
+    for (;;) {
+        ssize_t n = read(inotify_fd, buf, sizeof(events.buf));
+        if (n == -1 && errno == EINTR) {
+            continue;
+        }
+        if (n <= 0) {
+            return;
+        }
+        for (char *p = buf; p < buf + n; ) {
+            struct inotify_event *ev = (struct inotify_event *) p;
+            p += sizeof(struct inotify_event) + ev->len;
+            if (ev->mask & IN_Q_OVERFLOW) {
+                // events were lost, everyone has to assume everything changed
+                for (int i = 0; i < num_watchers; i++) {
+                    for (watcher *w = watchers[i]; w != NULL; ) {
+                        watcher *next = w->next; // the handler may remove itself
+                        w->fn(w->data, NULL, IN_Q_OVERFLOW);
+                        w = next;
+                    }
+                }
+                continue;
+            }
+            if (ev->wd < 0 || ev->wd >= num_watchers) {
+                continue;
+            }
+            const char *name = ev->len > 0 ? ev->name : NULL;
+            if (ev->mask & IN_IGNORED) {
+                // the kernel dropped the watch, tell everyone before forgetting them
+                watcher *w = watchers[ev->wd];
+                watchers[ev->wd] = NULL;
+                while (w != NULL) {
+                    watcher *next = w->next;
+                    w->fn(w->data, name, ev->mask);
+                    free(w);
+                    w = next;
+                }
+                continue;
+            }
+            for (watcher *w = watchers[ev->wd]; w != NULL; ) {
+                watcher *next = w->next;
+                w->fn(w->data, name, ev->mask);
+                w = next;
+            }
+        }
+    }
+}
@@ -0,0 +1,21 @@
+#!/bin/sh
+# Runs every tests/*.sh with 90s and compares its output, stderr
+# included, with the .out file next to it. Usage: tests/run.sh [90s]
+shell=$(cd "$(dirname "${1:-./90s}")" && pwd)/$(basename "${1:-./90s}")
+here=$(cd "$(dirname "$0")" && pwd)
+dir=$(mktemp -d)
+trap 'rm -rf "$dir"' EXIT INT TERM
+failed=0
+for test in "$here"/*.sh; do
+    name=$(basename "$test" .sh)
+    [ "$name" = run ] && continue
+    (cd "$dir" && XDG_CONFIG_HOME=$dir "$shell" "$test") > "$dir/$name.got" 2>&1
+    if cmp -s "$dir/$name.got" "$here/$name.out"; then
+        echo "ok   $name"
+    else
+        echo "FAIL $name"
+        diff "$here/$name.out" "$dir/$name.got"
+        failed=1
+    fi
+done
+exit $failed
@@ -0,0 +1,24 @@
+# unquoted expansions split at blanks, blanks alone make no fields
+count() {
+    echo "$# [$1] [$2]"
+}
+x=" a b"
+count $x
+x="a b "
+count $x
+x="  a   b  "
+count $x
+y=" "
+count $y
+count $y $y
+empty=
+count $empty
+count "$y"
+count a$y
+count a${y}b
+for w in $x; do
+    echo "w=[$w]"
+done
+for w in $y; do
+    echo "never [$w]"
+done
@@ -0,0 +1,7 @@
+# a failing builtin is a failed status for && and ||
+cd /nonexistent-90s-test && echo RAN
+echo cd=$?
+cd /nonexistent-90s-test || echo else
+hash no-such-command-90s && echo RAN
+echo hash=$?
+cd / && pwd
@@ -0,0 +1,128 @@
+/*
+ * Generate the builtin table from builtins.def: a perfect hash table
+ * found by trying seeds until every name lands in a slot of its own, so
+ * a lookup is one hash, one probe and one strcmp. Also a list of the
+ * builtins sorted by name for help and completion.
+ *
+ * mkbuiltins < builtins.def > builtins.c
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+
+#define MAX_BUILTINS 256
+
+typedef struct def {
+    char name[64];
+    char func[64];
+    char flags[64];
+} def;
+
+static def defs[MAX_BUILTINS];
+static int num_defs = 0;
+
+/* must match the copy written into the generated file */
+static uint32_t hash(const char *s, uint32_t seed)
+{
+    uint32_t h = 2166136261u ^ seed;
+    for (; *s != '\0'; s++) {
+        h ^= (unsigned char) *s;
+        h *= 16777619u;
+    }
+    return h ^ (h >> 16);
+}
+
+static int cmp_def(const void *a, const void *b)
+{
+    return strcmp(((const def *) a)->name, ((const def *) b)->name);
+}
+
+static int find_seed(uint32_t size, uint32_t *seed)
+{
+    char used[MAX_BUILTINS * 4];
+    for (uint32_t s = 0; s < 1000000; s++) {
+        memset(used, 0, size);
+        int i;
+        for (i = 0; i < num_defs; i++) {
+            uint32_t slot = hash(defs[i].name, s) & (size - 1);
+            if (used[slot]) {
+                break;
+            }
+            used[slot] = 1;
+        }
+        if (i == num_defs) {
+            *seed = s;
+            return 1;
+        }
+    }
+    return 0;
+}
+
+int main(void)
+{
+    char line[256];
+    while (fgets(line, sizeof(line), stdin) != NULL) {
+        if (line[0] == '#' || line[strspn(line, " \t\n")] == '\0') {
+            continue;
+        }
+        if (num_defs == MAX_BUILTINS) {
+            fprintf(stderr, "mkbuiltins: too many builtins\n");
+            return 1;
+        }
+        def *d = &defs[num_defs];
+        d->flags[0] = '\0';
+        if (sscanf(line, "%63s %63s %63s", d->name, d->func, d->flags) < 2) {
+            fprintf(stderr, "mkbuiltins: bad line: %s", line);
+            return 1;
+        }
+        num_defs++;
+    }
+    qsort(defs, num_defs, sizeof(def), cmp_def);
+
+    uint32_t size = 1, seed;
+    while (size < (uint32_t) num_defs) {
+        size <<= 1;
+    }
+    while (!find_seed(size, &seed)) {
+        size <<= 1;
+    }
+
+    printf("/* generated by tools/mkbuiltins from tools/builtins.def, do not edit */\n");
+    printf("#include <stdint.h>\n#include <string.h>\n\n#include \"builtins.h\"\n\n");
+    for (int i = 0; i < num_defs; i++) {
+        int seen = 0;
+        for (int k = 0; k < i && !seen; k++) {
+            seen = strcmp(defs[k].func, defs[i].func) == 0;
+        }
+        if (!seen) {
+            printf("int %s(char **args);\n", defs[i].func);
+        }
+    }
+    printf("\n/* sorted by name */\nconst builtin builtin_list[] = {\n");
+    for (int i = 0; i < num_defs; i++) {
+        printf("    { \"%s\", %s, %s },\n", defs[i].name, defs[i].func,
+                strcmp(defs[i].flags, "prints") == 0 ? "BUILTIN_PRINTS" : "0");
+    }
+    printf("};\n\nconst int builtin_count = %d;\n\n", num_defs);
+
+    printf("/* slot of each name, -1 for none */\nstatic const signed char slots[%u] = {", size);
+    for (uint32_t slot = 0; slot < size; slot++) {
+        int found = -1;
+        for (int i = 0; i < num_defs; i++) {
+            if ((hash(defs[i].name, seed) & (size - 1)) == slot) {
+                found = i;
+            }
+        }
+        printf("%s%d,", slot % 16 == 0 ? "\n    " : " ", found);
+    }
+    printf("\n};\n\n");
+    printf("static uint32_t name_hash(const char *s)\n{\n");
+    printf("    uint32_t h = 2166136261u ^ %uu;\n", seed);
+    printf("    for (; *s != '\\0'; s++) {\n        h ^= (unsigned char) *s;\n        h *= 16777619u;\n    }\n");
+    printf("    return h ^ (h >> 16);\n}\n\n");
+    printf("const builtin *builtin_find(const char *name)\n{\n");
+    printf("    int i = slots[name_hash(name) & %u];\n", size - 1);
+    printf("    return i != -1 && strcmp(builtin_list[i].name, name) == 0 ? &builtin_list[i] : NULL;\n}\n");
+    return 0;
+}